@@ -0,0 +1,111 @@
+/* -*-c++-*- VirtualPlanetBuilder - Copyright (C) 1998-2009 Robert Osfield
+ *
+ * This application is open source and may be redistributed and/or modified
+ * freely and without restriction, both in commericial and non commericial applications,
+ * as long as this copyright notice is maintained.
+ *
+ * This application is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+#include <vpb/ShardedArchive>
+#include <vpb/Version>
+
+#include <osg/ArgumentParser>
+#include <osg/ApplicationUsage>
+
+#include <iostream>
+
+int main(int argc, char** argv)
+{
+    osg::ArgumentParser arguments(&argc,argv);
+
+    // set up the usage document, in case we need to print out how to use this program.
+    arguments.getApplicationUsage()->setApplicationName(arguments.getApplicationName());
+    arguments.getApplicationUsage()->setDescription(arguments.getApplicationName()+" application is a utility for listing and merging VirtualPlanetBuilder .vpba tile archives.");
+    arguments.getApplicationUsage()->setCommandLineUsage(arguments.getApplicationName()+" [options] archive ...");
+    arguments.getApplicationUsage()->addCommandLineOption("-h or --help","Display this information");
+    arguments.getApplicationUsage()->addCommandLineOption("--version","Display version information");
+    arguments.getApplicationUsage()->addCommandLineOption("--list","List the files held in the specified archives.");
+    arguments.getApplicationUsage()->addCommandLineOption("-o <archive>","Merge the specified archives into a new archive index, the data shards are referenced in place rather than copied.");
+
+    // if user requests help write it out to cout.
+    if (arguments.read("-h") || arguments.read("--help"))
+    {
+        arguments.getApplicationUsage()->write(std::cout,osg::ApplicationUsage::COMMAND_LINE_OPTION);
+        return 1;
+    }
+
+    if (arguments.read("--version"))
+    {
+        std::cout<<"VirtualPlanetBuilder/vpbarchive version "<<vpbGetVersion()<<std::endl;
+        return 0;
+    }
+
+    bool list = false;
+    while (arguments.read("--list")) { list = true; }
+
+    std::string outputArchive;
+    while (arguments.read("-o",outputArchive)) {}
+
+    // any options left unread are converted into errors to write out later.
+    arguments.reportRemainingOptionsAsUnrecognized();
+
+    // report any errors if they have occured when parsing the program aguments.
+    if (arguments.errors())
+    {
+        arguments.writeErrorMessages(std::cout);
+        return 1;
+    }
+
+    std::vector<std::string> inputArchives;
+    for(int pos=1; pos<arguments.argc(); ++pos)
+    {
+        if (!arguments.isOption(pos)) inputArchives.push_back(arguments[pos]);
+    }
+
+    if (inputArchives.empty())
+    {
+        std::cout<<"No archives specified."<<std::endl;
+        arguments.getApplicationUsage()->write(std::cout,osg::ApplicationUsage::COMMAND_LINE_OPTION);
+        return 1;
+    }
+
+    if (list)
+    {
+        for(std::vector<std::string>::iterator itr = inputArchives.begin();
+            itr != inputArchives.end();
+            ++itr)
+        {
+            osg::ref_ptr<vpb::ShardedArchive> archive = new vpb::ShardedArchive;
+            if (!archive->open(*itr))
+            {
+                std::cout<<"Unable to open archive "<<*itr<<std::endl;
+                return 1;
+            }
+
+            osgDB::Archive::FileNameList fileNames;
+            archive->getFileNames(fileNames);
+
+            std::cout<<*itr<<" : master file = "<<archive->getMasterFileName()<<", "<<fileNames.size()<<" files"<<std::endl;
+            for(osgDB::Archive::FileNameList::iterator fitr = fileNames.begin();
+                fitr != fileNames.end();
+                ++fitr)
+            {
+                std::cout<<"    "<<*fitr<<std::endl;
+            }
+        }
+    }
+
+    if (!outputArchive.empty())
+    {
+        if (!vpb::ShardedArchive::merge(outputArchive, inputArchives))
+        {
+            std::cout<<"Failed to merge archives into "<<outputArchive<<std::endl;
+            return 1;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,570 @@
+/* -*-c++-*- VirtualPlanetBuilder - Copyright (C) 1998-2009 Robert Osfield
+ *
+ * This application is open source and may be redistributed and/or modified
+ * freely and without restriction, both in commericial and non commericial applications,
+ * as long as this copyright notice is maintained.
+ *
+ * This application is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+#include <vpb/Commandline>
+#include <vpb/DataSet>
+#include <vpb/System>
+#include <vpb/FileUtils>
+#include <vpb/Profiler>
+#include <vpb/Version>
+
+#include <osg/ArgumentParser>
+#include <osg/ApplicationUsage>
+#include <osg/Timer>
+
+#include <osgDB/FileNameUtils>
+#include <osgDB/FileUtils>
+#include <osgDB/fstream>
+
+#include <OpenThreads/Thread>
+
+#include <gdal_priv.h>
+#include <ogr_spatialref.h>
+
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <vector>
+
+#include <math.h>
+
+// layout of the imagery sources covering a scenario's extents.
+enum Pattern
+{
+    SINGLE,     // one image covering the extents
+    GRID,       // 2x2 images meeting at their edges
+    OVERLAP     // three full size images offset diagonally, so each tile composites several sources
+};
+
+struct Scenario
+{
+    const char*     name;
+    int             epsg;
+    double          originX;
+    double          originY;
+    double          extent;
+    Pattern         pattern;
+    const char*     options;
+};
+
+// projected sources are built geocentric so that every source is reprojected.
+static const Scenario s_scenarios[] =
+{
+    { "geographic_single",      4326,   -10.0,      10.0,       2.0,        SINGLE,     "" },
+    { "geographic_grid",        4326,   -10.0,      10.0,       2.0,        GRID,       "" },
+    { "geographic_polygonal",   4326,   -10.0,      10.0,       2.0,        SINGLE,     "--polygonal" },
+    { "mercator_overlap",       3857,   0.0,        1000000.0,  200000.0,   OVERLAP,    "--geocentric" },
+    { "utm_grid",               32633,  400000.0,   5000000.0,  100000.0,   GRID,       "--geocentric" }
+};
+
+static const unsigned int s_numScenarios = sizeof(s_scenarios)/sizeof(Scenario);
+
+struct Size
+{
+    const char*     name;
+    unsigned int    imageSize;
+    unsigned int    numLevels;
+};
+
+static const Size s_sizes[] =
+{
+    { "small",  512,    3 },
+    { "medium", 2048,   5 },
+    { "large",  8192,   7 }
+};
+
+static const unsigned int s_numSizes = sizeof(s_sizes)/sizeof(Size);
+
+struct Placement
+{
+    double  x;
+    double  y;
+    double  extent;
+};
+
+// cheap deterministic noise, so the imagery has detail for the resamplers and compressors to work on.
+static unsigned char noise(unsigned int x, unsigned int y, unsigned int seed)
+{
+    unsigned int h = x*374761393u + y*668265263u + seed*2246822519u;
+    h = (h ^ (h >> 13)) * 1274126177u;
+    return static_cast<unsigned char>((h ^ (h >> 16)) & 0xff);
+}
+
+static bool createDataset(const std::string& filename, int epsg, double originX, double originY, double extent,
+                          unsigned int size, unsigned int numBands, GDALDataType dataType, unsigned int seed)
+{
+    GDALDriver* driver = GetGDALDriverManager()->GetDriverByName("GTiff");
+    if (!driver) return false;
+
+    GDALDataset* dataset = driver->Create(filename.c_str(), size, size, numBands, dataType, 0);
+    if (!dataset) return false;
+
+    double geoTransform[6] = { originX, extent/double(size), 0.0, originY, 0.0, -extent/double(size) };
+    dataset->SetGeoTransform(geoTransform);
+
+    OGRSpatialReference srs;
+    srs.importFromEPSG(epsg);
+    char* wkt = 0;
+    srs.exportToWkt(&wkt);
+    dataset->SetProjection(wkt);
+    CPLFree(wkt);
+
+    bool success = true;
+    if (dataType==GDT_Byte)
+    {
+        std::vector<unsigned char> row(size);
+        for(unsigned int b=0; b<numBands && success; ++b)
+        {
+            GDALRasterBand* band = dataset->GetRasterBand(b+1);
+            for(unsigned int y=0; y<size && success; ++y)
+            {
+                for(unsigned int x=0; x<size; ++x)
+                {
+                    // smooth gradients with noise on top, differing per band.
+                    unsigned int gradient = ((b==0 ? x : (b==1 ? y : x+y))*255)/(b==2 ? 2*size : size);
+                    row[x] = static_cast<unsigned char>((gradient*3 + noise(x,y,seed+b))/4);
+                }
+                success = band->RasterIO(GF_Write, 0, y, size, 1, &row.front(), size, 1, GDT_Byte, 0, 0)==CE_None;
+            }
+        }
+    }
+    else
+    {
+        std::vector<float> row(size);
+        GDALRasterBand* band = dataset->GetRasterBand(1);
+        for(unsigned int y=0; y<size && success; ++y)
+        {
+            for(unsigned int x=0; x<size; ++x)
+            {
+                // rolling hills a few hundred metres high.
+                double s = double(x)/double(size);
+                double t = double(y)/double(size);
+                row[x] = static_cast<float>(500.0 + 300.0*sin(s*12.0)*cos(t*9.0) + 50.0*sin(s*61.0+t*47.0));
+            }
+            success = band->RasterIO(GF_Write, 0, y, size, 1, &row.front(), size, 1, GDT_Float32, 0, 0)==CE_None;
+        }
+    }
+
+    GDALClose(dataset);
+
+    return success;
+}
+
+static bool createFixtures(const std::string& directory, const Scenario& scenario, const Size& size,
+                           std::vector<std::string>& imageFiles, std::string& demFile)
+{
+    std::string prefix = directory + "/" + scenario.name + "_" + size.name;
+
+    std::vector<Placement> placements;
+
+    double e = scenario.extent;
+    switch(scenario.pattern)
+    {
+        case(SINGLE):
+        {
+            Placement p = { scenario.originX, scenario.originY, e };
+            placements.push_back(p);
+            break;
+        }
+        case(GRID):
+        {
+            for(unsigned int j=0; j<2; ++j)
+            {
+                for(unsigned int i=0; i<2; ++i)
+                {
+                    Placement p = { scenario.originX + e*0.5*double(i), scenario.originY - e*0.5*double(j), e*0.5 };
+                    placements.push_back(p);
+                }
+            }
+            break;
+        }
+        case(OVERLAP):
+        {
+            for(unsigned int i=0; i<3; ++i)
+            {
+                Placement p = { scenario.originX + e*double(i)/6.0, scenario.originY - e*double(i)/6.0, e*2.0/3.0 };
+                placements.push_back(p);
+            }
+            break;
+        }
+    }
+
+    for(unsigned int i=0; i<placements.size(); ++i)
+    {
+        std::ostringstream filename;
+        filename<<prefix<<"_image"<<i<<".tif";
+        imageFiles.push_back(filename.str());
+
+        if (osgDB::fileExists(filename.str())) continue;
+
+        std::cout<<"Generating "<<filename.str()<<std::endl;
+        if (!createDataset(filename.str(), scenario.epsg, placements[i].x, placements[i].y, placements[i].extent,
+                           size.imageSize, 3, GDT_Byte, i)) return false;
+    }
+
+    demFile = prefix + "_dem.tif";
+    if (!osgDB::fileExists(demFile))
+    {
+        std::cout<<"Generating "<<demFile<<std::endl;
+        if (!createDataset(demFile, scenario.epsg, scenario.originX, scenario.originY, e,
+                           std::max(size.imageSize/4, 64u), 1, GDT_Float32, 0)) return false;
+    }
+
+    return true;
+}
+
+static void splitOptions(const std::string& str, std::vector<std::string>& options)
+{
+    std::istringstream in(str);
+    std::string option;
+    while (in>>option) options.push_back(option);
+}
+
+// run a complete osgdem build of the fixtures in this process, so the profiler sees all of its phases.
+static int build(const std::vector<std::string>& options)
+{
+    std::vector<char*> argv;
+    argv.push_back(const_cast<char*>("osgdem"));
+    for(std::vector<std::string>::const_iterator itr = options.begin();
+        itr != options.end();
+        ++itr)
+    {
+        argv.push_back(const_cast<char*>(itr->c_str()));
+    }
+    argv.push_back(0);
+
+    int argc = argv.size()-1;
+    osg::ArgumentParser arguments(&argc, &argv.front());
+
+    osg::ref_ptr<osgTerrain::TerrainTile> terrain = new osgTerrain::TerrainTile;
+
+    vpb::Commandline commandline;
+    int result = commandline.read(std::cout, arguments, terrain.get());
+    if (result) return result;
+
+    arguments.reportRemainingOptionsAsUnrecognized();
+    if (arguments.errors())
+    {
+        arguments.writeErrorMessages(std::cout);
+        return 1;
+    }
+
+    osg::ref_ptr<vpb::DataSet> dataset = new vpb::DataSet;
+    dataset->addTerrain(terrain.get());
+
+    std::string buildProblems = dataset->checkBuildValidity();
+    if (!buildProblems.empty())
+    {
+        std::cout<<"Build configuration invalid : "<<buildProblems<<std::endl;
+        return 1;
+    }
+
+    return dataset->run();
+}
+
+struct PhaseResult
+{
+    PhaseResult(): count(0.0), totalTime(0.0), selfTime(0.0) {}
+
+    double  count;
+    double  totalTime;
+    double  selfTime;
+};
+
+typedef std::map<std::string, PhaseResult> PhaseResults;
+
+struct ScenarioResult
+{
+    std::string             name;
+    const Scenario*         scenario;
+    unsigned int            numSources;
+    double                  sourcePixels;
+    std::vector<double>     times;
+    PhaseResults            phases;
+    bool                    success;
+};
+
+static void writeResults(std::ostream& out, const Size& size, unsigned int iterations, const std::vector<ScenarioResult>& results)
+{
+    out.precision(6);
+    out<<"{"<<std::endl;
+    out<<"  \"version\": \""<<vpbGetVersion()<<"\","<<std::endl;
+    out<<"  \"size\": \""<<size.name<<"\","<<std::endl;
+    out<<"  \"image_size\": "<<size.imageSize<<","<<std::endl;
+    out<<"  \"levels\": "<<size.numLevels<<","<<std::endl;
+    out<<"  \"iterations\": "<<iterations<<","<<std::endl;
+    out<<"  \"processors\": "<<OpenThreads::GetNumberOfProcessors()<<","<<std::endl;
+    out<<"  \"scenarios\": ["<<std::endl;
+
+    for(std::vector<ScenarioResult>::const_iterator itr = results.begin();
+        itr != results.end();
+        ++itr)
+    {
+        std::vector<double> times = itr->times;
+        std::sort(times.begin(), times.end());
+
+        double total = 0.0;
+        for(unsigned int i=0; i<times.size(); ++i) total += times[i];
+
+        double minimum = times.empty() ? 0.0 : times.front();
+        double median = times.empty() ? 0.0 : times[times.size()/2];
+        double mean = times.empty() ? 0.0 : total/double(times.size());
+
+        out<<"    {"<<std::endl;
+        out<<"      \"name\": \""<<itr->name<<"\","<<std::endl;
+        out<<"      \"projection\": \"EPSG:"<<itr->scenario->epsg<<"\","<<std::endl;
+        out<<"      \"options\": \""<<itr->scenario->options<<"\","<<std::endl;
+        out<<"      \"sources\": "<<itr->numSources<<","<<std::endl;
+        out<<"      \"success\": "<<(itr->success ? "true" : "false")<<","<<std::endl;
+        out<<"      \"wall_time\": { \"min\": "<<minimum<<", \"median\": "<<median<<", \"mean\": "<<mean<<" },"<<std::endl;
+        out<<"      \"source_pixels_per_second\": "<<(median>0.0 ? itr->sourcePixels/median : 0.0)<<","<<std::endl;
+        out<<"      \"phases\": {";
+
+        double numIterations = osg::maximum(double(times.size()), 1.0);
+        for(PhaseResults::const_iterator pitr = itr->phases.begin();
+            pitr != itr->phases.end();
+            ++pitr)
+        {
+            if (pitr != itr->phases.begin()) out<<",";
+            out<<std::endl<<"        \""<<pitr->first<<"\": { \"count\": "<<pitr->second.count/numIterations
+               <<", \"total\": "<<pitr->second.totalTime/numIterations
+               <<", \"self\": "<<pitr->second.selfTime/numIterations<<" }";
+        }
+
+        out<<std::endl<<"      }"<<std::endl;
+        out<<"    }"<<((itr+1)!=results.end() ? "," : "")<<std::endl;
+    }
+
+    out<<"  ]"<<std::endl;
+    out<<"}"<<std::endl;
+}
+
+int main(int argc, char** argv)
+{
+    osg::ArgumentParser arguments(&argc,argv);
+
+    // set up the usage document, in case we need to print out how to use this program.
+    arguments.getApplicationUsage()->setApplicationName(arguments.getApplicationName());
+    arguments.getApplicationUsage()->setDescription(arguments.getApplicationName()+" application generates synthetic imagery and DEMs and times complete osgdem builds of them, reporting the time spent in each phase of the build.");
+    arguments.getApplicationUsage()->setCommandLineUsage(arguments.getApplicationName()+" [options] [-- osgdem options]");
+    arguments.getApplicationUsage()->addCommandLineOption("-h or --help","Display this information");
+    arguments.getApplicationUsage()->addCommandLineOption("--version","Display version information");
+    arguments.getApplicationUsage()->addCommandLineOption("--list","List the benchmark scenarios.");
+    arguments.getApplicationUsage()->addCommandLineOption("--scenario <name>","Run only the named scenario, may be given several times.");
+    arguments.getApplicationUsage()->addCommandLineOption("--size <name>","The size of the fixtures, small, medium or large, defaults to small.");
+    arguments.getApplicationUsage()->addCommandLineOption("--iterations <num>","The number of times each build is run, defaults to 3.");
+    arguments.getApplicationUsage()->addCommandLineOption("--fixtures <directory>","The directory the fixtures and builds are written to, defaults to vpbbenchmark. Existing fixtures are reused.");
+    arguments.getApplicationUsage()->addCommandLineOption("--results <filename>","The JSON file the results are written to, defaults to vpbbenchmark.json.");
+    arguments.getApplicationUsage()->addCommandLineOption("--compressed","Build with compressed textures, so that texture compression is included, requires a graphics context.");
+
+    // if user requests help write it out to cout.
+    if (arguments.read("-h") || arguments.read("--help"))
+    {
+        arguments.getApplicationUsage()->write(std::cout,osg::ApplicationUsage::COMMAND_LINE_OPTION);
+        return 1;
+    }
+
+    if (arguments.read("--version"))
+    {
+        std::cout<<"VirtualPlanetBuilder/vpbbenchmark version "<<vpbGetVersion()<<std::endl;
+        return 0;
+    }
+
+    if (arguments.read("--list"))
+    {
+        for(unsigned int i=0; i<s_numScenarios; ++i)
+        {
+            std::cout<<"    "<<s_scenarios[i].name<<" : EPSG:"<<s_scenarios[i].epsg<<" "<<s_scenarios[i].options<<std::endl;
+        }
+        return 0;
+    }
+
+    // everything after -- is passed on to each build.
+    std::vector<std::string> extraOptions;
+    for(int i=1; i<arguments.argc(); ++i)
+    {
+        if (std::string(arguments[i])=="--")
+        {
+            for(int j=i+1; j<arguments.argc(); ++j) extraOptions.push_back(arguments[j]);
+            arguments.remove(i, arguments.argc()-i);
+            break;
+        }
+    }
+
+    std::vector<std::string> scenarioNames;
+    std::string scenarioName;
+    while (arguments.read("--scenario",scenarioName)) { scenarioNames.push_back(scenarioName); }
+
+    const Size* size = &s_sizes[0];
+    std::string sizeName;
+    while (arguments.read("--size",sizeName))
+    {
+        size = 0;
+        for(unsigned int i=0; i<s_numSizes; ++i)
+        {
+            if (sizeName==s_sizes[i].name) size = &s_sizes[i];
+        }
+        if (!size)
+        {
+            std::cout<<"Unknown size "<<sizeName<<", must be small, medium or large."<<std::endl;
+            return 1;
+        }
+    }
+
+    unsigned int iterations = 3;
+    while (arguments.read("--iterations",iterations)) {}
+
+    std::string fixturesDirectory("vpbbenchmark");
+    while (arguments.read("--fixtures",fixturesDirectory)) {}
+
+    std::string resultsFileName("vpbbenchmark.json");
+    while (arguments.read("--results",resultsFileName)) {}
+
+    bool compressed = false;
+    while (arguments.read("--compressed")) { compressed = true; }
+
+    // any options left unread are converted into errors to write out later.
+    arguments.reportRemainingOptionsAsUnrecognized();
+
+    // report any errors if they have occured when parsing the program aguments.
+    if (arguments.errors())
+    {
+        arguments.writeErrorMessages(std::cout);
+        return 1;
+    }
+
+    // make sure GDAL has its drivers registered.
+    vpb::System::instance();
+
+    if (vpb::mkpath(fixturesDirectory.c_str(), 0755)!=0)
+    {
+        std::cout<<"Unable to create fixtures directory "<<fixturesDirectory<<std::endl;
+        return 1;
+    }
+
+    std::vector<ScenarioResult> results;
+
+    for(unsigned int s=0; s<s_numScenarios; ++s)
+    {
+        const Scenario& scenario = s_scenarios[s];
+        if (!scenarioNames.empty() && std::find(scenarioNames.begin(), scenarioNames.end(), scenario.name)==scenarioNames.end()) continue;
+
+        std::vector<std::string> imageFiles;
+        std::string demFile;
+        if (!createFixtures(fixturesDirectory, scenario, *size, imageFiles, demFile))
+        {
+            std::cout<<"Unable to create fixtures for "<<scenario.name<<std::endl;
+            return 1;
+        }
+
+        std::string outputDirectory = fixturesDirectory + "/" + scenario.name + "_" + size->name + "_build";
+        vpb::mkpath(outputDirectory.c_str(), 0755);
+
+        std::vector<std::string> options;
+        for(std::vector<std::string>::iterator itr = imageFiles.begin();
+            itr != imageFiles.end();
+            ++itr)
+        {
+            options.push_back("-t");
+            options.push_back(*itr);
+        }
+        options.push_back("-d");
+        options.push_back(demFile);
+
+        std::ostringstream numLevels;
+        numLevels<<size->numLevels;
+        options.push_back("-l");
+        options.push_back(numLevels.str());
+
+        options.push_back("-o");
+        options.push_back(outputDirectory + "/terrain.ive");
+
+        if (compressed) options.push_back("--compressed");
+        else options.push_back("--RGB_24");
+
+        splitOptions(scenario.options, options);
+        options.insert(options.end(), extraOptions.begin(), extraOptions.end());
+
+        ScenarioResult result;
+        result.name = scenario.name;
+        result.scenario = &scenario;
+        result.numSources = imageFiles.size() + 1;
+        result.sourcePixels = double(imageFiles.size())*double(size->imageSize)*double(size->imageSize);
+        result.success = true;
+
+        for(unsigned int i=0; i<iterations && result.success; ++i)
+        {
+            vpb::Profiler::instance()->setEnabled(true);
+            vpb::Profiler::instance()->clear();
+
+            // keep the build's own logging out of the results.
+            osg::NotifySeverity notifyLevel = osg::getNotifyLevel();
+            osg::setNotifyLevel(osg::WARN);
+
+            // reopen the sources each time so every build starts cold.
+            vpb::System::instance()->clearDatasetCache();
+
+            osg::Timer_t startTick = osg::Timer::instance()->tick();
+            int status = build(options);
+            double duration = osg::Timer::instance()->delta_s(startTick, osg::Timer::instance()->tick());
+
+            osg::setNotifyLevel(notifyLevel);
+
+            if (status!=0)
+            {
+                std::cout<<scenario.name<<" build failed."<<std::endl;
+                result.success = false;
+                break;
+            }
+
+            result.times.push_back(duration);
+
+            vpb::Profiler::PhaseSummaries summaries;
+            vpb::Profiler::instance()->computeSummaries(summaries);
+            for(vpb::Profiler::PhaseSummaries::iterator pitr = summaries.begin();
+                pitr != summaries.end();
+                ++pitr)
+            {
+                PhaseResult& phase = result.phases[pitr->first];
+                phase.count += double(pitr->second.count);
+                phase.totalTime += pitr->second.totalTime;
+                phase.selfTime += pitr->second.selfTime;
+            }
+
+            std::cout<<scenario.name<<" ("<<size->name<<") iteration "<<i+1<<" : "<<duration<<" seconds"<<std::endl;
+        }
+
+        results.push_back(result);
+    }
+
+    vpb::Profiler::instance()->setEnabled(false);
+
+    osgDB::ofstream fout(resultsFileName.c_str());
+    if (!fout)
+    {
+        std::cout<<"Unable to write results to "<<resultsFileName<<std::endl;
+        return 1;
+    }
+
+    writeResults(fout, *size, iterations, results);
+
+    std::cout<<"Results written to "<<resultsFileName<<std::endl;
+
+    for(std::vector<ScenarioResult>::iterator itr = results.begin();
+        itr != results.end();
+        ++itr)
+    {
+        if (!itr->success) return 1;
+    }
+
+    return 0;
+}
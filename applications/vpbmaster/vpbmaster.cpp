@@ -16,6 +16,8 @@
 #include <vpb/FileUtils>
 #include <vpb/DatabaseBuilder>
 #include <vpb/Version>
+#include <vpb/Profiler>
+#include <vpb/Metrics>
 
 #include <osg/Timer>
 #include <osgDB/ReadFile>
@@ -51,6 +53,10 @@ int main(int argc, char** argv)
     arguments.getApplicationUsage()->addCommandLineOption("--version","Display version information");
     arguments.getApplicationUsage()->addCommandLineOption("--cache <filename>","Read the cache file to use a look up for locally cached files.");
     arguments.getApplicationUsage()->addCommandLineOption("-h or --help","Display this information");
+    arguments.getApplicationUsage()->addCommandLineOption("--dry-run","When patching, report the tiles at each level that would be rebuilt and then exit.");
+    arguments.getApplicationUsage()->addCommandLineOption("--profile <filename>","Write a Chrome trace of where the build time goes, with a trace alongside each task file, and report a summary of each phase.");
+    arguments.getApplicationUsage()->addCommandLineOption("--metrics <basename>","Periodically write build metrics to basename.prom, a Prometheus textfile, and basename.json, with metrics alongside each task file.");
+    arguments.getApplicationUsage()->addCommandLineOption("--metrics-interval <seconds>","Number of seconds between writes of the metrics files, defaults to 10.");
 
     if (arguments.read("--version"))
     {
@@ -239,9 +245,13 @@ int main(int argc, char** argv)
         result = 1;
     }
 
+    vpb::Profiler::instance()->write();
+    vpb::Metrics::instance()->stop();
+
     // make sure the OS writes changes to disk
     vpb::sync();    
     taskManager->log(osg::NOTICE,"Run Complete.");   
+    vpb::LogFile::flushAll();
     taskManager->exit(SIGTERM);
     return result;
 }
@@ -10,12 +10,23 @@
 */
 
 #include <vpb/BuildOperation>
+#include <vpb/Commandline>
+#include <vpb/DataSet>
+#include <vpb/MachinePool>
+#include <vpb/System>
+#include <vpb/Task>
+
 #include <osg/CoordinateSystemNode>
 
 #include <osgDB/ReadFile>
+#include <osgDB/FileUtils>
+#include <osgDB/FileNameUtils>
 #include <osgTerrain/Terrain>
 
+#include <algorithm>
 #include <iostream>
+#include <sstream>
+#include <stdio.h>
 
 
 unsigned int computeNumTiles(unsigned int numTilesLevel1, int level)
@@ -64,11 +75,224 @@ double computeEfficiency(unsigned int numXTilesLevel1, unsigned int numYTilesLev
     return efficiency;
 }
 
+// collect the task files of a previous build, descending into the nested subtile directories.
+void collectTaskFiles(const std::string& path, std::vector<std::string>& taskFiles)
+{
+    osgDB::FileType type = osgDB::fileType(path);
+    if (type==osgDB::REGULAR_FILE)
+    {
+        if (osgDB::getLowerCaseFileExtension(path)=="task") taskFiles.push_back(path);
+    }
+    else if (type==osgDB::DIRECTORY)
+    {
+        osgDB::DirectoryContents contents = osgDB::getDirectoryContents(path);
+        for(osgDB::DirectoryContents::iterator itr = contents.begin();
+            itr != contents.end();
+            ++itr)
+        {
+            if (*itr=="." || *itr=="..") continue;
+            collectTaskFiles(osgDB::concatPaths(path, *itr), taskFiles);
+        }
+    }
+}
+
+// the part of a task file name that identifies the tile it builds, i.e. subtile_L3_X1_Y2.
+std::string getTaskKey(const std::string& filename)
+{
+    std::string name = osgDB::getNameLessExtension(osgDB::getSimpleFileName(filename));
+
+    std::string::size_type pos = name.rfind("_subtile_");
+    if (pos==std::string::npos) pos = name.rfind("_root_");
+    return pos!=std::string::npos ? name.substr(pos+1) : std::string();
+}
+
+std::string getTaskKey(const vpb::DataSet::TaskEstimate& task)
+{
+    std::ostringstream key;
+    key<<(task._type=="root" ? "root" : "subtile")<<"_L"<<task._level<<"_X"<<task._tileX<<"_Y"<<task._tileY;
+    return key.str();
+}
+
+std::string formatBytes(double bytes)
+{
+    const char* units[] = { "B", "KB", "MB", "GB", "TB", "PB" };
+    unsigned int unit = 0;
+    while (bytes>=1024.0 && unit<5)
+    {
+        bytes /= 1024.0;
+        ++unit;
+    }
+
+    char str[32];
+    sprintf(str, "%.1f %s", bytes, units[unit]);
+    return str;
+}
+
+std::string formatDuration(double seconds)
+{
+    unsigned int totalMinutes = static_cast<unsigned int>(seconds/60.0);
+
+    char str[64];
+    if (totalMinutes>=24*60) sprintf(str, "%ud %uh %um", totalMinutes/(24*60), (totalMinutes/60)%24, totalMinutes%60);
+    else if (totalMinutes>=60) sprintf(str, "%uh %um", totalMinutes/60, totalMinutes%60);
+    else sprintf(str, "%.0fs", seconds);
+    return str;
+}
+
+// estimate a build from the osgdem options of its sources, and predict its running time on the machine pool,
+// calibrated against the tasks of previous builds.
+int estimateBuild(osg::ArgumentParser& arguments)
+{
+    std::vector<std::string> taskFiles;
+    std::string path;
+    while (arguments.read("--calibrate", path)) collectTaskFiles(path, taskFiles);
+
+    vpb::System::instance()->readArguments(arguments);
+
+    osg::ref_ptr<osgTerrain::TerrainTile> terrain = new osgTerrain::TerrainTile;
+
+    vpb::Commandline commandline;
+    int result = commandline.read(std::cout, arguments, terrain.get());
+    if (result) return result;
+
+    arguments.reportRemainingOptionsAsUnrecognized();
+    if (arguments.errors())
+    {
+        arguments.writeErrorMessages(std::cout);
+        return 1;
+    }
+
+    osg::ref_ptr<vpb::DataSet> dataset = new vpb::DataSet;
+    dataset->addTerrain(terrain.get());
+
+    vpb::MachinePool* machinePool = vpb::System::instance()->getMachinePool();
+
+    // the durations of the completed tasks, by the tile they built, and their calibration of the cost model.
+    typedef std::map<std::string, double> PreviousDurations;
+    PreviousDurations previousDurations;
+    unsigned int numTasksCalibrated = 0;
+    for(std::vector<std::string>::iterator itr = taskFiles.begin();
+        itr != taskFiles.end();
+        ++itr)
+    {
+        osg::ref_ptr<vpb::Task> task = new vpb::Task(*itr);
+        if (!task->read() || !machinePool->addTaskHistory(task.get())) continue;
+
+        double duration = 0.0;
+        task->getProperty("duration",duration);
+        previousDurations[getTaskKey(*itr)] = duration;
+        ++numTasksCalibrated;
+    }
+
+    vpb::DataSet::BuildEstimate estimate;
+    if (!dataset->estimateBuild(estimate))
+    {
+        std::cout<<"Unable to estimate build, no valid sources."<<std::endl;
+        return 1;
+    }
+
+    std::cout<<std::endl<<"Maximum level "<<estimate._maxLevel<<", split at level "<<estimate._splitLevel;
+    if (estimate._secondarySplitLevel!=0) std::cout<<", secondary split at level "<<estimate._secondarySplitLevel;
+    std::cout<<std::endl<<std::endl;
+
+    printf("%6s %16s %14s %14s\n", "level", "tiles", "output", "source read");
+
+    double totalTiles = 0.0;
+    double totalOutputBytes = 0.0;
+    double totalSourceBytesRead = 0.0;
+    for(unsigned int l=0; l<estimate._levels.size(); ++l)
+    {
+        const vpb::DataSet::LevelEstimate& level = estimate._levels[l];
+        printf("%6u %16.0f %14s %14s\n", l, level._numTiles, formatBytes(level._outputBytes).c_str(), formatBytes(level._sourceBytesRead).c_str());
+
+        totalTiles += level._numTiles;
+        totalOutputBytes += level._outputBytes;
+        totalSourceBytesRead += level._sourceBytesRead;
+    }
+    printf("%6s %16.0f %14s %14s\n\n", "total", totalTiles, formatBytes(totalOutputBytes).c_str(), formatBytes(totalSourceBytesRead).c_str());
+
+    // predict the duration of each task as the MachinePool will, then the makespan by assigning the tasks
+    // longest first to the thread that frees up first.
+    unsigned int numThreads = std::max(machinePool->getNumThreads(), 1u);
+    std::vector<double> durations;
+    double totalCost = 0.0;
+    double peakMemory = 0.0;
+    unsigned int numTasksWithoutEstimate = 0;
+    for(std::vector<vpb::DataSet::TaskEstimate>::iterator itr = estimate._tasks.begin();
+        itr != estimate._tasks.end();
+        ++itr)
+    {
+        osg::ref_ptr<vpb::Task> task = new vpb::Task(std::string());
+        task->setProperty("type",itr->_type);
+        if (itr->_cost>0.0) task->setProperty("estimated_cost",itr->_cost);
+
+        PreviousDurations::iterator pitr = previousDurations.find(getTaskKey(*itr));
+        if (pitr != previousDurations.end()) task->setProperty("previous_duration",pitr->second);
+
+        double duration = machinePool->estimateTaskDuration(task.get());
+        if (duration==0.0) ++numTasksWithoutEstimate;
+
+        durations.push_back(duration);
+        totalCost += itr->_cost;
+        peakMemory = std::max(peakMemory, itr->_peakMemory);
+    }
+
+    std::sort(durations.begin(), durations.end());
+    std::reverse(durations.begin(), durations.end());
+
+    std::vector<double> threadEndTimes(numThreads, 0.0);
+    double totalDuration = 0.0;
+    for(std::vector<double>::iterator itr = durations.begin();
+        itr != durations.end();
+        ++itr)
+    {
+        *std::min_element(threadEndTimes.begin(), threadEndTimes.end()) += *itr;
+        totalDuration += *itr;
+    }
+    double makespan = *std::max_element(threadEndTimes.begin(), threadEndTimes.end());
+
+    std::cout<<"Tasks "<<estimate._tasks.size()<<", total estimated cost "<<totalCost<<std::endl;
+    std::cout<<"Peak memory per task "<<formatBytes(peakMemory)<<std::endl;
+    std::cout<<"Calibrated against "<<numTasksCalibrated<<" completed tasks"<<std::endl;
+
+    if (numTasksWithoutEstimate==estimate._tasks.size())
+    {
+        std::cout<<"No task timings to calibrate against, use --calibrate to predict the build time."<<std::endl;
+    }
+    else
+    {
+        std::cout<<"Predicted compute time "<<formatDuration(totalDuration)
+                 <<", wall clock time on "<<numThreads<<" threads "<<formatDuration(makespan);
+        if (numTasksWithoutEstimate!=0) std::cout<<", "<<numTasksWithoutEstimate<<" tasks without an estimate";
+        std::cout<<std::endl;
+    }
+
+    return 0;
+}
+
 int main( int argc, char **argv )
 {
     // use an ArgumentParser object to manage the program arguments.
     osg::ArgumentParser arguments(&argc,argv);
 
+    arguments.getApplicationUsage()->setApplicationName(arguments.getApplicationName());
+    arguments.getApplicationUsage()->setCommandLineUsage(arguments.getApplicationName()+" [--estimate [osgdem options]] [options]");
+    arguments.getApplicationUsage()->addCommandLineOption("--size <width> <height>","Size in pixels of the idealized whole earth source.");
+    arguments.getApplicationUsage()->addCommandLineOption("-r <resolution>","Resolution in metres of the idealized whole earth source.");
+    arguments.getApplicationUsage()->addCommandLineOption("-s <size>","Tile size of the idealized whole earth source.");
+    arguments.getApplicationUsage()->addCommandLineOption("--estimate","Estimate the tiles, output and source bytes per level, peak memory per task and build time of the build given by the osgdem options that follow.");
+    arguments.getApplicationUsage()->addCommandLineOption("--calibrate <path>","Calibrate the estimated build time against the completed task files in the file or directory of a previous build.");
+    arguments.getApplicationUsage()->addCommandLineOption("--machines <filename>","Machine pool to predict the build time on, defaults to the local host.");
+
+    if (arguments.read("-h") || arguments.read("--help"))
+    {
+        arguments.getApplicationUsage()->write(std::cout,osg::ApplicationUsage::COMMAND_LINE_OPTION);
+        return 1;
+    }
+
+    if (arguments.read("--estimate")) return estimateBuild(arguments);
+
+
     osg::ref_ptr<osg::EllipsoidModel> ellipsoid = new osg::EllipsoidModel;
     double circumferance = ellipsoid->getRadiusEquator() * 2.0 * osg::PI;
     
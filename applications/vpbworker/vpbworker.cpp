@@ -0,0 +1,105 @@
+/* -*-c++-*- VirtualPlanetBuilder - Copyright (C) 1998-2009 Robert Osfield
+ *
+ * This application is open source and may be redistributed and/or modified
+ * freely and without restriction, both in commericial and non commericial applications,
+ * as long as this copyright notice is maintained.
+ *
+ * This application is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+#include <vpb/Worker>
+#include <vpb/Version>
+
+#include <OpenThreads/Thread>
+
+#include <osg/ArgumentParser>
+#include <osg/ApplicationUsage>
+
+#include <iostream>
+#include <string.h>
+#include <stdlib.h>
+
+int main(int argc, char** argv)
+{
+    // everything after --submit is the application to run, so take it before parsing the other options.
+    std::string application;
+    for(int i=1; i<argc; ++i)
+    {
+        if (strcmp(argv[i],"--submit")==0)
+        {
+            for(int j=i+1; j<argc; ++j)
+            {
+                if (!application.empty()) application += " ";
+                application += argv[j];
+            }
+            argc = i;
+            break;
+        }
+    }
+
+    osg::ArgumentParser arguments(&argc,argv);
+
+    // set up the usage document, in case we need to print out how to use this program.
+    arguments.getApplicationUsage()->setApplicationName(arguments.getApplicationName());
+    arguments.getApplicationUsage()->setDescription(arguments.getApplicationName()+" application is a long lived worker that runs osgdem tasks sent to it by vpbmaster, keeping the source datasets open between tasks.");
+    arguments.getApplicationUsage()->setCommandLineUsage(arguments.getApplicationName()+" [options]");
+    arguments.getApplicationUsage()->addCommandLineOption("-h or --help","Display this information");
+    arguments.getApplicationUsage()->addCommandLineOption("--version","Display version information");
+    arguments.getApplicationUsage()->addCommandLineOption("--socket <filename>","The UNIX domain socket to listen on, referenced by the worker entry of the machines file.");
+    arguments.getApplicationUsage()->addCommandLineOption("-j <num>","The number of tasks to run at once, defaults to the number of cores.");
+    arguments.getApplicationUsage()->addCommandLineOption("--submit <application>","Send the rest of the command line to the worker listening on the socket and wait for it to complete, running it directly if there is no worker.");
+
+    // if user requests help write it out to cout.
+    if (arguments.read("-h") || arguments.read("--help"))
+    {
+        arguments.getApplicationUsage()->write(std::cout,osg::ApplicationUsage::COMMAND_LINE_OPTION);
+        return 1;
+    }
+
+    if (arguments.read("--version"))
+    {
+        std::cout<<"VirtualPlanetBuilder/vpbworker version "<<vpbGetVersion()<<std::endl;
+        return 0;
+    }
+
+    std::string socketName;
+    while (arguments.read("--socket",socketName)) {}
+
+    unsigned int numProcesses = OpenThreads::GetNumberOfProcessors();
+    while (arguments.read("-j",numProcesses)) {}
+
+    // any options left unread are converted into errors to write out later.
+    arguments.reportRemainingOptionsAsUnrecognized();
+
+    // report any errors if they have occured when parsing the program aguments.
+    if (arguments.errors())
+    {
+        arguments.writeErrorMessages(std::cout);
+        return 1;
+    }
+
+    if (socketName.empty())
+    {
+        std::cout<<"No socket specified."<<std::endl;
+        arguments.getApplicationUsage()->write(std::cout,osg::ApplicationUsage::COMMAND_LINE_OPTION);
+        return 1;
+    }
+
+    if (!application.empty())
+    {
+        int result = vpb::Worker::execute(socketName, application);
+        if (result<0)
+        {
+            std::cout<<"No worker listening on "<<socketName<<", running "<<application<<std::endl;
+            result = system(application.c_str());
+        }
+
+        // system() returns a wait status rather than an exit code, so just pass on success or failure.
+        return result==0 ? 0 : 1;
+    }
+
+    osg::ref_ptr<vpb::Worker> worker = new vpb::Worker(socketName, numProcesses);
+    return worker->run() ? 0 : 1;
+}
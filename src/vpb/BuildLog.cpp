@@ -13,9 +13,19 @@
 
 #include <vpb/BuildLog>
 #include <vpb/BuildOperation>
+#include <vpb/System>
 
+#include <OpenThreads/ScopedLock>
+
+#include <algorithm>
 #include <iostream>
 #include <iomanip>
+#include <map>
+#include <vector>
+
+#ifndef WIN32
+    #include <pthread.h>
+#endif
 
 using namespace vpb;
 
@@ -111,6 +121,210 @@ void vpb::popOperationLog()
 //  LogFile
 
 
+// a queued message, holding a reference to its log file so the file outlives its unwritten messages.
+struct LogEntry
+{
+    osg::ref_ptr<LogFile>   logFile;
+    double                  time;
+    std::string             message;
+};
+
+// fixed size ring of the messages queued by one thread, only ever contended when it's being drained.
+struct LogBuffer : public osg::Referenced
+{
+    LogBuffer(unsigned int size): entries(size), start(0), count(0), inUse(false) {}
+
+    bool push(LogFile* logFile, double time, const std::string& message)
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mutex);
+        if (count==entries.size()) return false;
+
+        LogEntry& entry = entries[(start+count)%entries.size()];
+        entry.logFile = logFile;
+        entry.time = time;
+        entry.message = message;
+        ++count;
+        return true;
+    }
+
+    void drain(std::vector<LogEntry>& drained)
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mutex);
+        for(; count>0; --count)
+        {
+            LogEntry& entry = entries[start];
+            drained.push_back(LogEntry());
+            drained.back().logFile.swap(entry.logFile);
+            drained.back().time = entry.time;
+            drained.back().message.swap(entry.message);
+            start = (start+1)%entries.size();
+        }
+    }
+
+    OpenThreads::Mutex      mutex;
+    std::vector<LogEntry>   entries;
+    unsigned int            start;
+    unsigned int            count;
+
+    // set while a thread is queuing to the buffer, guarded by the writer's buffers mutex.
+    bool                    inUse;
+};
+
+static bool compareLogEntryTime(const LogEntry& lhs, const LogEntry& rhs) { return lhs.time < rhs.time; }
+
+// each thread's buffer, so queuing a message needn't look the thread up.
+static VPB_THREAD_LOCAL LogBuffer* s_logBuffer = 0;
+
+class LogWriter : public OpenThreads::Thread
+{
+    public:
+
+        static LogWriter* instance()
+        {
+            static LogWriter s_logWriter;
+            return &s_logWriter;
+        }
+
+        void write(LogFile* logFile, double time, const std::string& message)
+        {
+            LogBuffer* buffer = getBuffer();
+            while (!buffer->push(logFile, time, message))
+            {
+                // the writer has fallen behind, so drain the buffers on this thread rather than drop the message.
+                flush();
+            }
+
+            // a forked process doesn't inherit the writer thread, so it writes its messages straight away.
+            if (getProcessID()!=_processID) flush();
+        }
+
+        void flush()
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_flushMutex);
+
+            std::vector<LogEntry> entries;
+            {
+                OpenThreads::ScopedLock<OpenThreads::Mutex> buffers_lock(_buffersMutex);
+                for(LogBuffers::iterator itr = _buffers.begin();
+                    itr != _buffers.end();
+                    ++itr)
+                {
+                    (*itr)->drain(entries);
+                }
+            }
+
+            if (entries.empty()) return;
+
+            // interleave the messages from different threads back into the order they were logged in.
+            std::stable_sort(entries.begin(), entries.end(), compareLogEntryTime);
+
+            typedef std::map<LogFile*, const LogEntry*> LastEntries;
+            LastEntries lastEntries;
+
+            for(std::vector<LogEntry>::const_iterator itr = entries.begin();
+                itr != entries.end();
+                ++itr)
+            {
+                LogFile* logFile = itr->logFile.get();
+                logFile->_fout<<std::setw(12)<<itr->time<<" : "<<itr->message<<"\n";
+                lastEntries[logFile] = &(*itr);
+            }
+
+            for(LastEntries::iterator itr = lastEntries.begin();
+                itr != lastEntries.end();
+                ++itr)
+            {
+                LogFile* logFile = itr->first;
+                logFile->_fout.flush();
+
+                if (logFile->_taskFile.valid())
+                {
+                    logFile->_taskFile->setProperty("last message time",itr->second->time);
+                    logFile->_taskFile->setProperty("last message",itr->second->message);
+                }
+            }
+        }
+
+        virtual void run()
+        {
+            while (!_done)
+            {
+                OpenThreads::Thread::microSleep(100000);
+                flush();
+            }
+        }
+
+    protected:
+
+        LogWriter():
+            _done(false),
+            _processID(getProcessID())
+        {
+#ifndef WIN32
+            // hand a thread's buffer back when the thread exits, so short lived threads don't each leave one behind.
+            pthread_key_create(&_threadExitKey, releaseBuffer);
+#endif
+            startThread();
+        }
+
+        virtual ~LogWriter()
+        {
+            _done = true;
+            if (isRunning()) join();
+            flush();
+        }
+
+        LogBuffer* getBuffer()
+        {
+            if (!s_logBuffer)
+            {
+                OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_buffersMutex);
+
+                // reuse the buffer of a thread that has exited, any messages it still holds are drained as usual.
+                for(LogBuffers::iterator itr = _buffers.begin();
+                    itr != _buffers.end() && !s_logBuffer;
+                    ++itr)
+                {
+                    if (!(*itr)->inUse) s_logBuffer = itr->get();
+                }
+
+                if (!s_logBuffer)
+                {
+                    _buffers.push_back(new LogBuffer(1024));
+                    s_logBuffer = _buffers.back().get();
+                }
+
+                s_logBuffer->inUse = true;
+
+#ifndef WIN32
+                pthread_setspecific(_threadExitKey, s_logBuffer);
+#endif
+            }
+            return s_logBuffer;
+        }
+
+        static void releaseBuffer(void* buffer)
+        {
+            LogWriter* writer = instance();
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock(writer->_buffersMutex);
+            static_cast<LogBuffer*>(buffer)->inUse = false;
+        }
+
+        typedef std::vector< osg::ref_ptr<LogBuffer> > LogBuffers;
+
+        volatile bool       _done;
+        int                 _processID;
+
+#ifndef WIN32
+        pthread_key_t       _threadExitKey;
+#endif
+
+        OpenThreads::Mutex  _flushMutex;
+
+        OpenThreads::Mutex  _buffersMutex;
+        LogBuffers          _buffers;
+};
+
 LogFile::LogFile(const std::string& filename)
 {
     _fout.open(filename.c_str());
@@ -122,14 +336,17 @@ LogFile::LogFile(const std::string& filename)
 
 void LogFile::write(Message* message)
 {
-    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
-    _fout<<std::setw(12)<<message->time<<" : "<<message->message<<std::endl;
-    
-    if (_taskFile.valid())
-    {
-        _taskFile->setProperty("last message time",message->time);
-        _taskFile->setProperty("last message",message->message);
-    }
+    write(message->time, message->message);
+}
+
+void LogFile::write(double time, const std::string& message)
+{
+    LogWriter::instance()->write(this, time, message);
+}
+
+void LogFile::flushAll()
+{
+    LogWriter::instance()->flush();
 }
 
 
@@ -142,7 +359,8 @@ OperationLog::OperationLog():
     Object(true),
     _startPendingTime(-1.0),
     _startRunningTime(-1.0),
-    _endRunningTime(-1.0)
+    _endRunningTime(-1.0),
+    _maxNumMessages(1000)
 {
 }
 
@@ -150,7 +368,8 @@ OperationLog::OperationLog(const std::string& name):
     Object(true),
     _startPendingTime(-1.0),
     _startRunningTime(-1.0),
-    _endRunningTime(-1.0)
+    _endRunningTime(-1.0),
+    _maxNumMessages(1000)
 {
     setName(name);
     openLogFile(name);
@@ -161,7 +380,8 @@ OperationLog::OperationLog(const OperationLog& log, const osg::CopyOp& copyop):
     osg::Object(log,copyop),
     _startPendingTime(log._startPendingTime),
     _startRunningTime(log._startRunningTime),
-    _endRunningTime(log._endRunningTime)
+    _endRunningTime(log._endRunningTime),
+    _maxNumMessages(log._maxNumMessages)
 {
 }
 
@@ -171,25 +391,41 @@ OperationLog::~OperationLog()
 
 void OperationLog::log(osg::NotifySeverity level, const std::string& str)
 {
-    Message* message = new Message(osg::Timer::instance()->time_s(), level, str);
-    _messages.push_back(message);
-    if (_logFile.valid()) _logFile->write(message);
+    if (level>osg::getNotifyLevel()) return;
+
+    addMessage(level, str);
 }
 
 void OperationLog::log(osg::NotifySeverity level, const char* format, ...)
 {
+    if (level>osg::getNotifyLevel()) return;
+
     char str[1024];
     va_list args; va_start(args, format);
     vsnprintf(str, sizeof(str), format, args);
     va_end(args);
 
-    Message* message = new Message(osg::Timer::instance()->time_s(), level, str);
-    _messages.push_back(message);
-    if (_logFile.valid()) _logFile->write(message);
+    addMessage(level, str);
+}
+
+void OperationLog::addMessage(osg::NotifySeverity level, const std::string& str)
+{
+    double time = osg::Timer::instance()->time_s();
+
+    if (_maxNumMessages>0)
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_messagesMutex);
+        _messages.push_back(new Message(time, level, str));
+        while (_messages.size()>_maxNumMessages) _messages.pop_front();
+    }
+
+    if (_logFile.valid()) _logFile->write(time, str);
 }
 
 void OperationLog::report(std::ostream& out)
 {
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_messagesMutex);
+
     out<<getName()<<":: waiting time: "<<getWaitingTime()<<" running time: "<<getRunningTime()<<std::endl;
     for(Messages::iterator itr = _messages.begin();
         itr != _messages.end();
@@ -13,6 +13,7 @@
 
 #include <vpb/BuildOperation>
 #include <vpb/ThreadPool>
+#include <vpb/Metrics>
 
 using namespace vpb;
 
@@ -41,7 +42,19 @@ void BuildOperation::operator () (osg::Object*)
         _log->setLogFile(_buildLog->getLogFile());
     }
     
+    osg::Timer_t startTick = osg::Timer::instance()->tick();
+
     build();
+
+    // the rate of this counter is the average number of the pool's threads kept busy.
+    if (_threadPool && Metrics::instance()->getEnabled())
+    {
+        OpenThreads::Thread* thread = OpenThreads::Thread::CurrentThread();
+
+        std::ostringstream labels;
+        labels<<"pool=\""<<_threadPool->getName()<<"\",thread=\""<<(thread ? thread->getThreadId() : 0)<<"\"";
+        Metrics::instance()->count("vpb_thread_busy_seconds_total", osg::Timer::instance()->delta_s(startTick, osg::Timer::instance()->tick()), labels.str());
+    }
     
     if (_buildLog.valid()) _buildLog->completedOperation(this);
     
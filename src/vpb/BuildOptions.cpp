@@ -114,6 +114,15 @@ BuildOptions::BuildOptions()
     _maximumVisiableDistanceOfTopLevel = 1e10;
     _radiusToMaxVisibleDistanceRatio = 7.0f;
     _simplifyTerrain = true;
+    _terrainErrorTolerance = 0.0f;
+    _optimizeVertexCache = true;
+    _buildBottomUp = false;
+    _asynchronousWriteBufferSize = 0;
+    _deduplicateOutput = false;
+    _dirtyTilesFileName = "";
+    _batchShapeFileGeometry = true;
+    _shapeFileFeatureIDAttribute = -1;
+    _instanceRepeatedModels = false;
     _skirtRatio = 0.02f;
     _tileBasename = "output";
     _tileExtension = ".osgb";
@@ -198,6 +207,15 @@ void BuildOptions::setBuildOptions(const BuildOptions& rhs)
     _maximumVisiableDistanceOfTopLevel = rhs._maximumVisiableDistanceOfTopLevel;
     _radiusToMaxVisibleDistanceRatio = rhs._radiusToMaxVisibleDistanceRatio;
     _simplifyTerrain = rhs._simplifyTerrain;
+    _terrainErrorTolerance = rhs._terrainErrorTolerance;
+    _optimizeVertexCache = rhs._optimizeVertexCache;
+    _buildBottomUp = rhs._buildBottomUp;
+    _asynchronousWriteBufferSize = rhs._asynchronousWriteBufferSize;
+    _deduplicateOutput = rhs._deduplicateOutput;
+    _dirtyTilesFileName = rhs._dirtyTilesFileName;
+    _batchShapeFileGeometry = rhs._batchShapeFileGeometry;
+    _shapeFileFeatureIDAttribute = rhs._shapeFileFeatureIDAttribute;
+    _instanceRepeatedModels = rhs._instanceRepeatedModels;
     _skirtRatio = rhs._skirtRatio;
     _tileBasename = rhs._tileBasename;
     _tileExtension = rhs._tileExtension;
@@ -360,6 +378,15 @@ bool BuildOptions::compatible(BuildOptions& rhs) const
     if (_maximumVisiableDistanceOfTopLevel != rhs._maximumVisiableDistanceOfTopLevel) return false;
     if (_radiusToMaxVisibleDistanceRatio != rhs._radiusToMaxVisibleDistanceRatio) return false;
     if (_simplifyTerrain != rhs._simplifyTerrain) return false;
+    if (_terrainErrorTolerance != rhs._terrainErrorTolerance) return false;
+    if (_optimizeVertexCache != rhs._optimizeVertexCache) return false;
+    if (_buildBottomUp != rhs._buildBottomUp) return false;
+    if (_asynchronousWriteBufferSize != rhs._asynchronousWriteBufferSize) return false;
+    if (_deduplicateOutput != rhs._deduplicateOutput) return false;
+    if (_dirtyTilesFileName != rhs._dirtyTilesFileName) return false;
+    if (_batchShapeFileGeometry != rhs._batchShapeFileGeometry) return false;
+    if (_shapeFileFeatureIDAttribute != rhs._shapeFileFeatureIDAttribute) return false;
+    if (_instanceRepeatedModels != rhs._instanceRepeatedModels) return false;
     if (_skirtRatio != rhs._skirtRatio) return false;
     if (_tileBasename != rhs._tileBasename) return false;
     if (_tileExtension != rhs._tileExtension) return false;
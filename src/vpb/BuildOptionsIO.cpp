@@ -269,7 +269,13 @@ public:
         VPB_ADD_ENUM_PROPERTY_TWO_VALUES(DatabaseType, LOD_DATABASE, PagedLOD_DATABASE)
 
 
-        VPB_ADD_ENUM_PROPERTY_THREE_VALUES(GeometryType, HEIGHT_FIELD, POLYGONAL, TERRAIN)
+        {
+            VPB_AEP(GeometryType);
+            VPB_AEV(HEIGHT_FIELD);
+            VPB_AEV(POLYGONAL);
+            VPB_AEV(TERRAIN);
+            VPB_AEV(QUANTIZED_POLYGONAL);
+        }
         VPB_ADD_ENUM_PROPERTY_THREE_VALUES(MipMappingMode, NO_MIP_MAPPING, MIP_MAPPING_HARDWARE,MIP_MAPPING_IMAGERY)
 
         {
@@ -306,6 +312,15 @@ public:
         VPB_ADD_BOOL_PROPERTY(ConvertFromGeographicToGeocentric);
         VPB_ADD_BOOL_PROPERTY(UseLocalTileTransform);
         VPB_ADD_BOOL_PROPERTY(SimplifyTerrain);
+        VPB_ADD_FLOAT_PROPERTY(TerrainErrorTolerance);
+        VPB_ADD_BOOL_PROPERTY(OptimizeVertexCache);
+        VPB_ADD_BOOL_PROPERTY(BuildBottomUp);
+        VPB_ADD_UINT_PROPERTY(AsynchronousWriteBufferSize);
+        VPB_ADD_BOOL_PROPERTY(DeduplicateOutput);
+        VPB_ADD_STRING_PROPERTY(DirtyTilesFileName);
+        VPB_ADD_BOOL_PROPERTY(BatchShapeFileGeometry);
+        VPB_ADD_INT_PROPERTY(ShapeFileFeatureIDAttribute);
+        VPB_ADD_BOOL_PROPERTY(InstanceRepeatedModels);
         VPB_ADD_BOOL_PROPERTY(DecorateGeneratedSceneGraphWithCoordinateSystemNode);
         VPB_ADD_BOOL_PROPERTY(DecorateGeneratedSceneGraphWithMultiTextureControl);
         VPB_ADD_BOOL_PROPERTY(WriteNodeBeforeSimplification);
@@ -624,6 +639,15 @@ REGISTER_OBJECT_WRAPPER( BuildOptions,
     ADD_BOOL_SERIALIZER( ConvertFromGeographicToGeocentric, false);
     ADD_BOOL_SERIALIZER( UseLocalTileTransform, true);
     ADD_BOOL_SERIALIZER( SimplifyTerrain, true);
+    ADD_FLOAT_SERIALIZER( TerrainErrorTolerance, 0.0f);
+    ADD_BOOL_SERIALIZER( OptimizeVertexCache, true);
+    ADD_BOOL_SERIALIZER( BuildBottomUp, false);
+    ADD_UINT_SERIALIZER( AsynchronousWriteBufferSize, 0);
+    ADD_BOOL_SERIALIZER( DeduplicateOutput, false);
+    ADD_STRING_SERIALIZER( DirtyTilesFileName, "");
+    ADD_BOOL_SERIALIZER( BatchShapeFileGeometry, true);
+    ADD_INT_SERIALIZER( ShapeFileFeatureIDAttribute, -1);
+    ADD_BOOL_SERIALIZER( InstanceRepeatedModels, false);
 
     ADD_BOOL_SERIALIZER( DecorateGeneratedSceneGraphWithCoordinateSystemNode, true);
     ADD_BOOL_SERIALIZER( DecorateGeneratedSceneGraphWithMultiTextureControl, true);
@@ -638,6 +662,7 @@ REGISTER_OBJECT_WRAPPER( BuildOptions,
         ADD_ENUM_VALUE( HEIGHT_FIELD );
         ADD_ENUM_VALUE( POLYGONAL );
         ADD_ENUM_VALUE( TERRAIN );
+        ADD_ENUM_VALUE( QUANTIZED_POLYGONAL );
     END_ENUM_SERIALIZER();
 
     ADD_STRING_SERIALIZER( DestinationCoordinateSystem, "");
@@ -16,6 +16,7 @@
 #include <vpb/BuildOptions>
 #include <vpb/DatabaseBuilder>
 #include <vpb/System>
+#include <vpb/ShardedArchive>
 
 #include <osg/Notify>
 #include <osg/io_utils>
@@ -494,7 +495,8 @@ void Commandline::getUsage(osg::ApplicationUsage& usage)
     usage.addCommandLineOption("-t <filename>","Specify the texture map input file to process.");
     usage.addCommandLineOption("--building <filename>","Specify building outlines using shapefiles.");
     usage.addCommandLineOption("--forest <filename>","Specify forest outlines using shapefiles.");
-    usage.addCommandLineOption("-a <archivename>","Specify the archive to place the generated database.");
+    usage.addCommandLineOption("-a <archivename>","Specify the archive to place the generated database, a .vpba archive is written as one data shard per write thread.");
+    usage.addCommandLineOption("--archive <archivename>","Specify the archive to place the generated database, a .vpba archive is written as one data shard per write thread.");
     usage.addCommandLineOption("--ibn <buildname>","Specify the intermediate build file name.");
     usage.addCommandLineOption("-o <outputfile>","Specify the output master file to generate.");
     usage.addCommandLineOption("-l <numOfLevels>","Specify the number of PagedLOD levels to generate.");
@@ -512,6 +514,7 @@ void Commandline::getUsage(osg::ApplicationUsage& usage)
     usage.addCommandLineOption("--HEIGHT_FIELD","Create a height field database.");
     usage.addCommandLineOption("--POLYGONAL","Create a height field database.");
     usage.addCommandLineOption("--TERRAIN","Create a osgTerrain::Terrain database.");
+    usage.addCommandLineOption("--QUANTIZED_POLYGONAL","Create a polygonal database with compact quantized vertices decoded by a vertex shader.");
     usage.addCommandLineOption("--LOD","Create a LOD'd database.");
     usage.addCommandLineOption("--PagedLOD","Create a PagedLOD'd database.");
     usage.addCommandLineOption("-v","Set the vertical multiplier.");
@@ -534,6 +537,15 @@ void Commandline::getUsage(osg::ApplicationUsage& usage)
     usage.addCommandLineOption("--raster","Interpret input as a raster data set (default).");
     usage.addCommandLineOption("--max-visible-distance-of-top-level","Set the maximum visible distance that the top most tile can be viewed at.");
     usage.addCommandLineOption("--no-terrain-simplification","Switch off terrain simplification.");
+    usage.addCommandLineOption("--terrain-error-tolerance <height>","Reduce the resolution of nearly flat terrain tiles to the coarsest power of two plus one grid within the specified vertical error.");
+    usage.addCommandLineOption("--bottom-up","Build PagedLOD databases from the finest level up, filtering coarser levels down from their children rather than reading them from the sources.");
+    usage.addCommandLineOption("--async-write-buffer <MB>","Write tiles from a background thread, buffering at most the specified number of megabytes of encoded files. Default of 0 writes synchronously.");
+    usage.addCommandLineOption("--dedup or --deduplicate-output","Write byte identical output images once, to a shared file referenced by all the tiles that use them.");
+    usage.addCommandLineOption("--dirty-tiles <file>","Only rebuild the tiles listed in the file, one \"level x y\" per line, as generated by vpbmaster for a patch build.");
+    usage.addCommandLineOption("--no-shapefile-batching","Keep each feature placed from a shapefile as its own drawable rather than merging them into per tile triangle lists.");
+    usage.addCommandLineOption("--shapefile-feature-ids <index>","Record the feature id of each vertex of batched shapefile geometry in the specified vertex attribute, from 1 to 15.");
+    usage.addCommandLineOption("--instance-models","Draw subgraphs that models place many times on a tile as instances, positioned from a per tile instance table. Requires GL_EXT_gpu_shader4 to view.");
+    usage.addCommandLineOption("--no-vertex-cache-optimization","Switch off the vertex cache optimized re-indexing of polygonal tiles.");
     usage.addCommandLineOption("--default-color <r,g,b,a>","Sets the default color of the terrain.");
     usage.addCommandLineOption("--radius-to-max-visible-distance-ratio","Set the maximum visible distance ratio for all tiles apart from the top most tile. The maximum visuble distance is computed from the ratio * tile radius.");
     usage.addCommandLineOption("--no-mip-mapping","Disable mip mapping of textures.");
@@ -877,6 +889,11 @@ int Commandline::read(std::ostream& fout, osg::ArgumentParser& arguments, osgTer
         buildOptions->setGeometryType(vpb::BuildOptions::TERRAIN);
     }
 
+    while (arguments.read("--QUANTIZED_POLYGONAL") || arguments.read("--quantized-polygonal"))
+    {
+        buildOptions->setGeometryType(vpb::BuildOptions::QUANTIZED_POLYGONAL);
+    }
+
     while (arguments.read("--LOD"))
     {
         buildOptions->setDatabaseType(vpb::BuildOptions::LOD_DATABASE);
@@ -896,11 +913,18 @@ int Commandline::read(std::ostream& fout, osg::ArgumentParser& arguments, osgTer
 
 
     std::string archiveName;
-    while (arguments.read("-a",archiveName))
+    while (arguments.read("-a",archiveName) || arguments.read("--archive",archiveName))
     {
-        osg::notify(osg::NOTICE)<<"Warning: archive option -a is temporarily disabled, building with archive."<<std::endl;
-        
-        // buildOptions->setArchiveName(archiveName);
+        if (vpb::ShardedArchive::isShardedArchiveFileName(archiveName))
+        {
+            buildOptions->setArchiveName(archiveName);
+        }
+        else
+        {
+            osg::notify(osg::NOTICE)<<"Warning: archive option -a is temporarily disabled for non .vpba archives, building without archive."<<std::endl;
+
+            // buildOptions->setArchiveName(archiveName);
+        }
     }
 
     unsigned int numLevels = 10;
@@ -946,6 +970,67 @@ int Commandline::read(std::ostream& fout, osg::ArgumentParser& arguments, osgTer
         buildOptions->setSimplifyTerrain(false);
     }
 
+    float terrainErrorTolerance;
+    while (arguments.read("--terrain-error-tolerance",terrainErrorTolerance))
+    {
+        buildOptions->setTerrainErrorTolerance(terrainErrorTolerance);
+    }
+
+    while (arguments.read("--no-vertex-cache-optimization"))
+    {
+        buildOptions->setOptimizeVertexCache(false);
+    }
+
+    while (arguments.read("--bottom-up"))
+    {
+        buildOptions->setBuildBottomUp(true);
+    }
+
+    unsigned int asynchronousWriteBufferSize;
+    while (arguments.read("--async-write-buffer",asynchronousWriteBufferSize))
+    {
+        buildOptions->setAsynchronousWriteBufferSize(asynchronousWriteBufferSize);
+    }
+
+    while (arguments.read("--dedup") || arguments.read("--deduplicate-output"))
+    {
+        buildOptions->setDeduplicateOutput(true);
+    }
+
+    std::string dirtyTilesFileName;
+    while (arguments.read("--dirty-tiles",dirtyTilesFileName))
+    {
+        buildOptions->setDirtyTilesFileName(dirtyTilesFileName);
+    }
+
+    while (arguments.read("--no-shapefile-batching"))
+    {
+        buildOptions->setBatchShapeFileGeometry(false);
+    }
+
+    int shapeFileFeatureIDAttribute;
+    while (arguments.read("--shapefile-feature-ids",shapeFileFeatureIDAttribute))
+    {
+        // attribute 0 is the vertex position, and only 16 generic attributes are guaranteed.
+        if (shapeFileFeatureIDAttribute<1 || shapeFileFeatureIDAttribute>15)
+        {
+            arguments.reportError("--shapefile-feature-ids index must be between 1 and 15.");
+            continue;
+        }
+
+        if (shapeFileFeatureIDAttribute<=3)
+        {
+            osg::notify(osg::NOTICE)<<"Warning: --shapefile-feature-ids "<<shapeFileFeatureIDAttribute<<" shares its vertex attribute with the normals or colours on drivers that alias the fixed function arrays, consider an index such as 6 or 7."<<std::endl;
+        }
+
+        buildOptions->setShapeFileFeatureIDAttribute(shapeFileFeatureIDAttribute);
+    }
+
+    while (arguments.read("--instance-models"))
+    {
+        buildOptions->setInstanceRepeatedModels(true);
+    }
+
     while (arguments.read("--write_node_before_simplification") ||
            arguments.read("--write_node_before_simplification"))
     {
@@ -28,12 +28,19 @@
 #include <osgViewer/Viewer>
 #include <osgViewer/Version>
 
+#include <OpenThreads/ScopedLock>
+#include <OpenThreads/Thread>
+
 #include <vpb/DataSet>
 #include <vpb/DatabaseBuilder>
 #include <vpb/TaskManager>
 #include <vpb/System>
 #include <vpb/FileUtils>
 #include <vpb/FilePathManager>
+#include <vpb/FileWriter>
+#include <vpb/ShardedArchive>
+#include <vpb/Profiler>
+#include <vpb/Metrics>
 
 #include <vpb/ShapeFilePlacer>
 
@@ -43,7 +50,9 @@
 
 // standard library includes
 #include <sstream>
+#include <fstream>
 #include <iostream>
+#include <iomanip>
 #include <algorithm>
 
 
@@ -70,6 +79,13 @@ void DataSet::init()
 
     _newDestinationGraph = false;
 
+    _incrementalBuild = false;
+
+    _targetTaskCost = 0.0;
+
+    _vertexCacheNumTriangles = 0.0;
+    _vertexCacheMissesBefore = 0.0;
+    _vertexCacheMissesAfter = 0.0;
 }
 
 void DataSet::addSource(Source* source, unsigned int revisionNumber)
@@ -94,6 +110,8 @@ void DataSet::addSource(CompositeSource* composite)
 #endif
 void DataSet::loadSources()
 {
+    Profiler::ScopedPhase phase("loadSources");
+
     assignIntermediateCoordinateSystem();
 
     FileCache* fileCache = System::instance()->getFileCache();
@@ -1195,6 +1213,8 @@ bool DataSet::requiresReprojection()
 
 void DataSet::reprojectSourcesAndGenerateOverviews()
 {
+    Profiler::ScopedPhase phase("reproject");
+
     if (!_sourceGraph) return;
 
     std::string temporyFilePrefix("temporaryfile_");
@@ -1248,6 +1268,22 @@ void DataSet::reprojectSourcesAndGenerateOverviews()
 
     log(osg::NOTICE,"Time for after_reproject %f", osg::Timer::instance()->delta_s(before_reproject, after_reproject));
 
+    // index the features of the shapefiles, now they are in the intermediate coordinate system, rather than leave
+    // the first tile to place each one to do it while the others wait on it.
+    ShapeFilePlacer* shapeFilePlacer = dynamic_cast<ShapeFilePlacer*>(getShapeFilePlacer());
+    if (shapeFilePlacer)
+    {
+        for(CompositeSource::source_iterator itr(_sourceGraph.get());itr.valid();++itr)
+        {
+            Source* source = itr->get();
+            if (source && source->getType()==Source::SHAPEFILE &&
+                source->getSourceData() && source->getSourceData()->_model.valid())
+            {
+                shapeFilePlacer->getFeatureIndex(source->getSourceData()->_model.get());
+            }
+        }
+    }
+
     // do sampling of data to required values.
     if (getBuildOverlays())
     {
@@ -1387,6 +1423,8 @@ class ReadFromOperation : public BuildOperation
 
 void DataSet::_readRow(Row& row)
 {
+    Profiler::ScopedPhase phase("readRow");
+
     log(osg::NOTICE, "_readRow %u",row.size());
 
     CompositeSource* sourceGraph = _newDestinationGraph ? 0 : _sourceGraph.get();
@@ -1431,6 +1469,8 @@ void DataSet::_readRow(Row& row)
 
 void DataSet::_equalizeRow(Row& row)
 {
+    Profiler::ScopedPhase phase("equalize");
+
     log(osg::NOTICE, "_equalizeRow %d",row.size());
     for(Row::iterator citr=row.begin();
         citr!=row.end();
@@ -1445,22 +1485,194 @@ void DataSet::_equalizeRow(Row& row)
             log(osg::NOTICE, "   equalizing tile level=%u X=%u Y=%u",tile->_level,tile->_tileX,tile->_tileY);
             tile->equalizeBoundaries();
             tile->setTileComplete(true);
+
+            Metrics::instance()->count("vpb_tiles_equalized_total");
+        }
+    }
+}
+
+void DataSet::_downsampleRowToParents(Row& row)
+{
+    log(osg::INFO, "_downsampleRowToParents %d",row.size());
+    for(Row::iterator citr=row.begin();
+        citr!=row.end();
+        ++citr)
+    {
+        CompositeDestination* cd = citr->second;
+        CompositeDestination* parent = cd->_parent;
+
+        // parents only partially covered by their children are read from the sources as usual.
+        if (!parent || parent->_type==GROUP || !parent->childrenCoverExtents()) continue;
+
+        for(CompositeDestination::TileList::iterator ptitr=parent->_tiles.begin();
+            ptitr!=parent->_tiles.end();
+            ++ptitr)
+        {
+            for(CompositeDestination::TileList::iterator titr=cd->_tiles.begin();
+                titr!=cd->_tiles.end();
+                ++titr)
+            {
+                DestinationTile* tile = titr->get();
+                log(osg::INFO, "   downsampling tile level=%u X=%u Y=%u",tile->_level,tile->_tileX,tile->_tileY);
+                (*ptitr)->downsampleFrom(tile);
+            }
+        }
+    }
+}
+
+// the state of a level while rows stream up through it, rows are read in order once all the rows of the finer level that
+// downsample into them are finished, and each is equalized and written once the row after it has been read.
+struct DataSet::BottomUpLevel
+{
+    BottomUpLevel(): level(0), hasPrevious(false) {}
+
+    typedef std::map<unsigned int, unsigned int> PendingRows;
+    typedef std::set< std::pair<unsigned int, unsigned int> > ParentRows;
+
+    Level*              level;
+    Level::iterator     next;
+    Level::iterator     previous;
+    bool                hasPrevious;
+
+    // the number of rows of the finer level still to finish, for each row of this level.
+    PendingRows         pendingChildRows;
+
+    static void getParentRows(Row& row, ParentRows& parentRows)
+    {
+        for(Row::iterator citr=row.begin();
+            citr!=row.end();
+            ++citr)
+        {
+            CompositeDestination* parent = citr->second->_parent;
+            if (parent) parentRows.insert(std::make_pair(parent->_level, parent->_tileY));
+        }
+    }
+};
+
+void DataSet::_buildLevelsBottomUp(const std::vector<unsigned int>& levelNums, bool writeToDisk)
+{
+    BottomUpLevels levels;
+    for(std::vector<unsigned int>::const_iterator litr=levelNums.begin();
+        litr!=levelNums.end();
+        ++litr)
+    {
+        BottomUpLevel& bl = levels[*litr];
+        bl.level = &_quadMap[*litr];
+        bl.next = bl.level->begin();
+    }
+
+    for(BottomUpLevels::iterator litr=levels.begin();
+        litr!=levels.end();
+        ++litr)
+    {
+        for(Level::iterator ritr=litr->second.level->begin();
+            ritr!=litr->second.level->end();
+            ++ritr)
+        {
+            BottomUpLevel::ParentRows parentRows;
+            BottomUpLevel::getParentRows(ritr->second, parentRows);
+            for(BottomUpLevel::ParentRows::iterator pitr=parentRows.begin();
+                pitr!=parentRows.end();
+                ++pitr)
+            {
+                BottomUpLevels::iterator parentLevel = levels.find(pitr->first);
+                if (parentLevel!=levels.end()) ++(parentLevel->second.pendingChildRows[pitr->second]);
+            }
+        }
+    }
+
+    // finest first, each level's last row is only finished once no more rows of the level can be read.
+    for(BottomUpLevels::reverse_iterator litr=levels.rbegin();
+        litr!=levels.rend();
+        ++litr)
+    {
+        _advanceLevelBottomUp(levels, litr->first, writeToDisk);
+
+        BottomUpLevel& bl = litr->second;
+        if (bl.next!=bl.level->end())
+        {
+            log(osg::WARN, "Warning: bottom up build left %u rows of level %u unread.",(unsigned int)std::distance(bl.next, bl.level->end()),litr->first);
+        }
+
+        if (bl.hasPrevious)
+        {
+            bl.hasPrevious = false;
+            _finishRowBottomUp(levels, litr->first, bl.previous->second, writeToDisk);
         }
     }
 }
 
+void DataSet::_advanceLevelBottomUp(BottomUpLevels& levels, unsigned int levelNum, bool writeToDisk)
+{
+    BottomUpLevel& bl = levels[levelNum];
+    while(bl.next!=bl.level->end() && bl.pendingChildRows[bl.next->first]==0)
+    {
+        _readRow(bl.next->second);
+
+        if (bl.hasPrevious) _finishRowBottomUp(levels, levelNum, bl.previous->second, writeToDisk);
+
+        bl.previous = bl.next;
+        bl.hasPrevious = true;
+        ++bl.next;
+    }
+}
+
+void DataSet::_finishRowBottomUp(BottomUpLevels& levels, unsigned int levelNum, Row& row, bool writeToDisk)
+{
+    _equalizeRow(row);
+    _downsampleRowToParents(row);
+    if (writeToDisk) _writeRow(row);
+
+    // the parent rows this row fed may now be complete, in which case they can be read and passed on up.
+    BottomUpLevel::ParentRows parentRows;
+    BottomUpLevel::getParentRows(row, parentRows);
+    for(BottomUpLevel::ParentRows::iterator pitr=parentRows.begin();
+        pitr!=parentRows.end();
+        ++pitr)
+    {
+        BottomUpLevels::iterator parentLevel = levels.find(pitr->first);
+        if (parentLevel==levels.end()) continue;
+
+        unsigned int& pending = parentLevel->second.pendingChildRows[pitr->second];
+        if (pending>0) --pending;
+        if (pending==0) _advanceLevelBottomUp(levels, pitr->first, writeToDisk);
+    }
+}
+
 void DataSet::_writeNodeFile(osg::Node& node,const std::string& filename)
 {
+    Profiler::ScopedPhase phase("write");
+
     if (getDisableWrites()) return;
 
+    Metrics::instance()->count("vpb_tiles_written_total");
+
     if (_archive.valid()) _archive->writeNode(node,filename);
     else
     {
         osg::NotifySeverity notifylevel = getAbortTaskOnError() ? osg::FATAL : osg::WARN;
 
-        if (vpb::hasWritePermission(filename))
+        bool fileExistedBeforeWrite = FilePathManager::instance()->registerFileWrite(filename);
+
+        if (_fileWriter.valid())
+        {
+            // encode on this thread and leave the file system work to the background writer.
+            osgDB::ReaderWriter* rw = osgDB::Registry::instance()->getReaderWriterForExtension(osgDB::getLowerCaseFileExtension(filename));
+            if (rw)
+            {
+                std::ostringstream out(std::ios::out | std::ios::binary);
+                osgDB::ReaderWriter::WriteResult result = rw->writeNode(node, out, osgDB::Registry::instance()->getOptions());
+                if (result.success())
+                {
+                    std::string data = out.str();
+                    _fileWriter->write(filename, data, fileExistedBeforeWrite);
+                    return;
+                }
+            }
+        }
+
+        if (FilePathManager::instance()->checkWritePermissionAndEnsurePathAvailability(filename))
         {
-            bool fileExistedBeforeWrite = osgDB::fileExists(filename);
 
             osgDB::ReaderWriter::WriteResult result =
                 osgDB::Registry::instance()->writeNode(node, filename,osgDB::Registry::instance()->getOptions());
@@ -1468,17 +1680,7 @@ void DataSet::_writeNodeFile(osg::Node& node,const std::string& filename)
 
             if (result.success())
             {
-                if (_databaseRevision.valid())
-                {
-                    if (fileExistedBeforeWrite)
-                    {
-                        if (_databaseRevision->getFilesModified()) _databaseRevision->getFilesModified()->addFile(filename);
-                    }
-                    else
-                    {
-                        if (_databaseRevision->getFilesAdded()) _databaseRevision->getFilesAdded()->addFile(filename);
-                    }
-                }
+                recordFileWritten(filename, fileExistedBeforeWrite);
             }
             else
             {
@@ -1508,10 +1710,34 @@ void DataSet::_writeNodeFile(osg::Node& node,const std::string& filename)
     }
 }
 
+static osg::ref_ptr<osgDB::Options> createImageWriteOptions(const std::string& filename)
+{
+    osg::ref_ptr<osgDB::Options> options = osgDB::Registry::instance()->getOptions();
+
+    bool isDDS = (osgDB::getLowerCaseFileExtension(filename)=="dds");
+    if (isDDS)
+    {
+        const char* ddsNoAtuoFlipWrite = "ddsNoAutoFlipWrite";
+        if (!options) options = new osgDB::Options;
+        if (options->getOptionString().find(ddsNoAtuoFlipWrite)==std::string::npos)
+        {
+            options = osg::clone(options.get());
+            if (options->getOptionString().empty()) options->setOptionString(ddsNoAtuoFlipWrite);
+            else options->setOptionString(options->getOptionString()+" "+ddsNoAtuoFlipWrite);
+        }
+    }
+
+    return options;
+}
+
 void DataSet::_writeImageFile(osg::Image& image,const std::string& filename)
 {
+    Profiler::ScopedPhase phase("writeImage");
+
     if (getDisableWrites()) return;
 
+    Metrics::instance()->count("vpb_images_written_total");
+
     //image.setFileName(filename.c_str());
 
     // remove any ../ from the filename
@@ -1522,38 +1748,37 @@ void DataSet::_writeImageFile(osg::Image& image,const std::string& filename)
     {
         osg::NotifySeverity notifylevel = getAbortTaskOnError() ? osg::FATAL : osg::WARN;
 
-        if (FilePathManager::instance()->checkWritePermissionAndEnsurePathAvailability(simpliedFileName))
+        osg::ref_ptr<osgDB::Options> options = createImageWriteOptions(simpliedFileName);
+
+        bool fileExistedBeforeWrite = FilePathManager::instance()->registerFileWrite(simpliedFileName);
+
+        if (_fileWriter.valid())
         {
-            bool fileExistedBeforeWrite = osgDB::fileExists(filename);
-            bool isDDS = (osgDB::getLowerCaseFileExtension(simpliedFileName)=="dds");
-            osg::ref_ptr<osgDB::Options> options = osgDB::Registry::instance()->getOptions();
-            if (isDDS)
+            // encode on this thread and leave the file system work to the background writer.
+            osgDB::ReaderWriter* rw = osgDB::Registry::instance()->getReaderWriterForExtension(osgDB::getLowerCaseFileExtension(simpliedFileName));
+            if (rw)
             {
-                const char* ddsNoAtuoFlipWrite = "ddsNoAutoFlipWrite";
-                if (options->getOptionString().find(ddsNoAtuoFlipWrite)==std::string::npos)
+                std::ostringstream out(std::ios::out | std::ios::binary);
+                osgDB::ReaderWriter::WriteResult result = rw->writeImage(image, out, options.get());
+                if (result.success())
                 {
-                    options = osg::clone(options.get());
-                    if (options->getOptionString().empty()) options->setOptionString(ddsNoAtuoFlipWrite);
-                    else options->setOptionString(options->getOptionString()+" "+ddsNoAtuoFlipWrite);
+                    std::string data = out.str();
+                    _fileWriter->write(simpliedFileName, data, fileExistedBeforeWrite);
+                    return;
                 }
             }
+        }
+
+        if (FilePathManager::instance()->checkWritePermissionAndEnsurePathAvailability(simpliedFileName))
+        {
 
             osgDB::ReaderWriter::WriteResult result =
                 osgDB::Registry::instance()->writeImage(image, simpliedFileName, options.get());
 
             if (result.success())
             {
-                if (_databaseRevision.valid())
-                {
-                    if (fileExistedBeforeWrite)
-                    {
-                        if (_databaseRevision->getFilesModified()) _databaseRevision->getFilesModified()->addFile(filename);
-                    }
-                    else
-                    {
-                        if (_databaseRevision->getFilesAdded()) _databaseRevision->getFilesAdded()->addFile(filename);
-                    }
-                }
+                // record the same name as the background writer does, so both paths produce the same revision entries.
+                recordFileWritten(simpliedFileName, fileExistedBeforeWrite);
             }
             else
             {
@@ -1587,11 +1812,12 @@ class WriteImageFilesVisitor : public osg::NodeVisitor
 {
 public:
 
-    WriteImageFilesVisitor(vpb::DataSet* dataSet, const std::string& directory):
+    WriteImageFilesVisitor(vpb::DataSet* dataSet, const std::string& directory, unsigned int level):
         osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN),
         _dataSet(dataSet),
         _directory(directory),
-        _writeHint(osg::Image::STORE_INLINE)
+        _writeHint(osg::Image::STORE_INLINE),
+        _level(level)
     {
         if (!_directory.empty())
         {
@@ -1610,6 +1836,7 @@ public:
     vpb::DataSet*           _dataSet;
     std::string             _directory;
     osg::Image::WriteHint   _writeHint;
+    unsigned int            _level;
 
     bool needToWriteOutImage(const osg::Image* image) const
     {
@@ -1619,6 +1846,26 @@ public:
             return _writeHint==osg::Image::EXTERNAL_FILE;
     }
 
+    void writeImage(osg::Image* image, osgTerrain::Layer* layer)
+    {
+        bool external = needToWriteOutImage(image);
+
+        if (_dataSet->getDeduplicateOutput())
+        {
+            std::string sharedFileName = _dataSet->_deduplicateImage(*image, _directory, external ? _directory+image->getFileName() : std::string(), _level);
+            if (!sharedFileName.empty())
+            {
+                // reference the shared copy rather than writing out or inlining another one.
+                image->setFileName(sharedFileName);
+                image->setWriteHint(osg::Image::EXTERNAL_FILE);
+                if (layer) layer->setFileName(sharedFileName);
+                return;
+            }
+        }
+
+        if (external) _dataSet->_writeImageFile(*image,_directory+image->getFileName());
+    }
+
     virtual void apply(osg::Node& node)
     {
         if (node.getStateSet()) apply(*(node.getStateSet()));
@@ -1651,7 +1898,7 @@ public:
             if (image)
             {
                 _dataSet->log(osg::NOTICE,"Writing out image layer %s, _directory=%s ",image->getFileName().c_str(),_directory.c_str());
-                if (needToWriteOutImage(image)) _dataSet->_writeImageFile(*image,_directory+image->getFileName());
+                writeImage(image, imageLayer);
             }
             return;
         }
@@ -1681,6 +1928,9 @@ public:
 
     void applyTerrain(osgTerrain::TerrainTile& terrainTile)
     {
+        unsigned int previousLevel = _level;
+        if (terrainTile.getTileID().level>=0) _level = terrainTile.getTileID().level;
+
 #if 0
         if (terrainTile.getElevationLayer()) writeLayer(terrainTile.getElevationLayer());
 #endif
@@ -1692,6 +1942,8 @@ public:
                 writeLayer(terrainTile.getColorLayer(i));
             }
         }
+
+        _level = previousLevel;
     }
 
     virtual void apply(osg::Geode& geode)
@@ -1714,22 +1966,22 @@ public:
             osg::Texture2D* texture2D = dynamic_cast<osg::Texture2D*>(stateset.getTextureAttribute(i,osg::StateAttribute::TEXTURE));
             if (texture2D) image = texture2D->getImage();
 
-            if (image && needToWriteOutImage(image))
+            if (image)
             {
-                _dataSet->_writeImageFile(*image,_directory+image->getFileName());
+                writeImage(image, 0);
             }
         }
     }
 };
 
-void DataSet::_writeNodeFileAndImages(osg::Node& node,const std::string& filename)
+void DataSet::_writeNodeFileAndImages(osg::Node& node,const std::string& filename, unsigned int level)
 {
     if (getDisableWrites()) return;
 
     log(osg::NOTICE,"_writeNodeFile(%s)",filename.c_str());
 
     // write out any image data that is an external file
-    WriteImageFilesVisitor wifv(this, osgDB::getFilePath(filename));
+    WriteImageFilesVisitor wifv(this, osgDB::getFilePath(filename), level);
     const_cast<osg::Node&>(node).accept(wifv);
 
     // write out the nodes
@@ -1757,7 +2009,7 @@ class WriteOperation : public BuildOperation
             {
                 if (_buildLog.valid()) _buildLog->log(osg::NOTICE, "   writeSubTile filename= %s",_filename.c_str());
 
-                _dataset->_writeNodeFileAndImages(*node,_filename);
+                _dataset->_writeNodeFileAndImages(*node,_filename,_cd->_level+1);
 
                 _cd->setSubTilesGenerated(true);
                 _cd->unrefSubTileData();
@@ -1773,10 +2025,71 @@ class WriteOperation : public BuildOperation
         std::string                         _filename;
 };
 
+class CreateSceneOperation : public BuildOperation
+{
+    public:
+
+        CreateSceneOperation(ThreadPool* threadPool, BuildLog* buildLog, DestinationTile* tile):
+            BuildOperation(threadPool, buildLog, "CreateSceneOperation", false),
+            _tile(tile) {}
+
+        virtual void build()
+        {
+            log(osg::INFO, "   CreateSceneOperation: creating tile level=%u X=%u Y=%u",_tile->_level,_tile->_tileX,_tile->_tileY);
+            _tile->createScene();
+        }
+
+        osg::ref_ptr<DestinationTile> _tile;
+};
+
+class CollectDestinationTilesVisitor : public DestinationVisitor
+{
+    public:
+
+        typedef std::vector< osg::ref_ptr<DestinationTile> > TileList;
+        typedef std::map<unsigned int, TileList> LevelTileMap;
+
+        virtual void apply(DestinationTile& tile)
+        {
+            _levelTileMap[tile._level].push_back(&tile);
+        }
+
+        LevelTileMap _levelTileMap;
+};
+
+void DataSet::_createTileScenes()
+{
+    if (!_writeThreadPool || !_destinationGraph) return;
+
+    log(osg::NOTICE, "_createTileScenes");
+
+    CollectDestinationTilesVisitor collectTiles;
+    _destinationGraph->accept(collectTiles);
+
+    // queue the deepest levels first. DestinationTile::createScene() caches its result, so the serial
+    // CompositeDestination::createScene() that follows just assembles the tiles in their usual order.
+    for(CollectDestinationTilesVisitor::LevelTileMap::reverse_iterator litr = collectTiles._levelTileMap.rbegin();
+        litr != collectTiles._levelTileMap.rend();
+        ++litr)
+    {
+        CollectDestinationTilesVisitor::TileList& tiles = litr->second;
+        for(CollectDestinationTilesVisitor::TileList::iterator titr = tiles.begin();
+            titr != tiles.end();
+            ++titr)
+        {
+            _writeThreadPool->run(new CreateSceneOperation(_writeThreadPool.get(), getBuildLog(), titr->get()));
+        }
+    }
+
+    _writeThreadPool->waitForCompletion();
+}
+
 #define NEW_NAMING
 
 void DataSet::_writeRow(Row& row)
 {
+    Profiler::ScopedPhase phase("writeRow");
+
     log(osg::NOTICE, "_writeRow %u",row.size());
     for(Row::iterator citr=row.begin();
         citr!=row.end();
@@ -1808,7 +2121,7 @@ void DataSet::_writeRow(Row& row)
                     if (node.valid())
                     {
                         log(osg::NOTICE, "   writeSubTile filename= %s",filename.c_str());
-                        _writeNodeFileAndImages(*node,filename);
+                        _writeNodeFileAndImages(*node,filename,parent->_level+1);
 
 
                         parent->setSubTilesGenerated(true);
@@ -1872,7 +2185,7 @@ void DataSet::_writeRow(Row& row)
             {
                 log(osg::NOTICE, "   writeNodeFile = %u X=%u Y=%u filename=%s",cd->_level,cd->_tileX,cd->_tileY,filename.c_str());
 
-                _writeNodeFileAndImages(*node,filename);
+                _writeNodeFileAndImages(*node,filename,cd->_level);
             }
             else
             {
@@ -1971,8 +2284,61 @@ osg::Node* DataSet::decorateWithMultiTextureControl(osg::Node* subgraph)
 }
 
 
+class DatabaseRevisionWriteCallback : public FileWriter::WriteCallback
+{
+    public:
+
+        DatabaseRevisionWriteCallback(DataSet* dataSet):
+            _dataSet(dataSet) {}
+
+        virtual void fileWritten(const std::string& filename, bool existedBefore, bool success)
+        {
+            if (success) _dataSet->recordFileWritten(filename, existedBefore);
+            else _dataSet->log(_dataSet->getAbortTaskOnError() ? osg::FATAL : osg::WARN, "Error, in writing file %s",filename.c_str());
+        }
+
+        DataSet* _dataSet;
+};
+
+void DataSet::recordFileWritten(const std::string& filename, bool existedBefore)
+{
+    if (Metrics::instance()->getEnabled())
+    {
+        Metrics::instance()->count("vpb_files_written_total");
+        Metrics::instance()->count("vpb_bytes_written_total", System::instance()->getFileSize(filename));
+    }
+
+    if (!_databaseRevision) return;
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_databaseRevisionMutex);
+
+    osgDB::FileList* filesAdded = _databaseRevision->getFilesAdded();
+    osgDB::FileList* filesRemoved = _databaseRevision->getFilesRemoved();
+    osgDB::FileList* filesModified = _databaseRevision->getFilesModified();
+
+    // a file rewritten within this revision is still just an addition, and one written again after being
+    // removed is no longer removed, so drop the stale entries rather than listing the file twice.
+    if (filesRemoved && filesRemoved->containsFile(filename))
+    {
+        filesRemoved->removeFile(filename);
+        existedBefore = true;
+    }
+
+    if (existedBefore && !(filesAdded && filesAdded->containsFile(filename)))
+    {
+        if (filesModified) filesModified->addFile(filename);
+    }
+    else
+    {
+        if (filesModified) filesModified->removeFile(filename);
+        if (filesAdded) filesAdded->addFile(filename);
+    }
+}
+
 void DataSet::_buildDestination(bool writeToDisk)
 {
+    Profiler::ScopedPhase phase("buildDestination");
+
     //if (!_state) _state = new osg::State;
 
     osg::ref_ptr<osgDB::ReaderWriter::Options> previous_options = osgDB::Registry::instance()->getOptions();
@@ -1988,8 +2354,44 @@ void DataSet::_buildDestination(bool writeToDisk)
 
     if (!_archive && !_archiveName.empty())
     {
-        unsigned int indexBlockSizeHint=4096;
-        _archive = osgDB::openArchive(_archiveName, osgDB::Archive::CREATE, indexBlockSizeHint);
+        if (ShardedArchive::isShardedArchiveFileName(_archiveName))
+        {
+            // each task of a distributed build writes its own part, vpbmaster merges them once all tasks have completed.
+            std::string archiveName = _archiveName;
+            if (getGenerateSubtile())
+            {
+                std::ostringstream partName;
+                partName<<"L"<<getSubtileLevel()<<"_X"<<getSubtileX()<<"_Y"<<getSubtileY();
+                archiveName = ShardedArchive::getPartFileName(_archiveName, partName.str());
+            }
+            else if (getRecordSubtileFileNamesOnLeafTile())
+            {
+                archiveName = ShardedArchive::getPartFileName(_archiveName, "root");
+            }
+
+            // one shard per write thread plus one for the main thread so writers don't contend.
+            unsigned int numShards = static_cast<unsigned int>(ceilf(getNumWriteThreadsToCoresRatio() * float(OpenThreads::GetNumberOfProcessors()))) + 1;
+
+            osg::ref_ptr<ShardedArchive> archive = new ShardedArchive;
+            if (archive->create(archiveName, numShards))
+            {
+                archive->setMasterFileName(_directory+_tileBasename+_tileExtension);
+                _archive = archive.get();
+            }
+        }
+        else
+        {
+            unsigned int indexBlockSizeHint=4096;
+            _archive = osgDB::openArchive(_archiveName, osgDB::Archive::CREATE, indexBlockSizeHint);
+        }
+    }
+
+    if (!_archive && !_fileWriter && writeToDisk && getAsynchronousWriteBufferSize()>0)
+    {
+        log(osg::NOTICE, "Starting asynchronous file writer with %u MB buffer.",getAsynchronousWriteBufferSize());
+        _fileWriter = new FileWriter(getAsynchronousWriteBufferSize()*1024*1024);
+        _fileWriter->setWriteCallback(new DatabaseRevisionWriteCallback(this));
+        _fileWriter->startThread();
     }
 
     if (_destinationGraph.valid())
@@ -2013,7 +2415,13 @@ void DataSet::_buildDestination(bool writeToDisk)
 
         if (_databaseType==LOD_DATABASE)
         {
+            if (!getDirtyTilesFileName().empty())
+            {
+                log(osg::NOTICE, "LOD_DATABASE is built as a single scene, ignoring dirty tiles file %s.",getDirtyTilesFileName().c_str());
+            }
+
             populateDestinationGraphFromSources();
+            _createTileScenes();
             _rootNode = _destinationGraph->createScene();
 
             if (_decorateWithMultiTextureControl)
@@ -2042,6 +2450,18 @@ void DataSet::_buildDestination(bool writeToDisk)
         }
         else  // _databaseType==PagedLOD_DATABASE
         {
+            _dirtyTiles.clear();
+            _incrementalBuild = !getDirtyTilesFileName().empty() && readDirtyTiles(getDirtyTilesFileName(), _dirtyTiles);
+
+            bool buildBottomUp = getBuildBottomUp();
+            if (_incrementalBuild && buildBottomUp)
+            {
+                log(osg::NOTICE, "Incremental build, disabling bottom up build as only the dirty tiles are read.");
+                buildBottomUp = false;
+            }
+
+            // bottom up builds pass each row on to its parents as soon as it is finished, rather than level by level.
+            std::vector<unsigned int> bottomUpLevelNums;
 
             // for each level build read and write the rows.
             for(QuadMap::iterator qitr=_quadMap.begin();
@@ -2058,8 +2478,47 @@ void DataSet::_buildDestination(bool writeToDisk)
 
                 if (getRecordSubtileFileNamesOnLeafTile() && qitr->first>=getMaximumNumOfLevels()) continue;
 
+                if (buildBottomUp)
+                {
+                    bottomUpLevelNums.push_back(qitr->first);
+                    continue;
+                }
+
                 log(osg::INFO, "New level");
 
+                if (_incrementalBuild)
+                {
+                    // read the dirty tiles along with their neighbours, then equalize and write just the dirty tiles.
+                    Level buildLevel, readLevel;
+                    _selectDirtyTiles(qitr->first, level, buildLevel, readLevel);
+
+                    log(osg::NOTICE, "Incremental build level %u, rebuilding %u rows",qitr->first,(unsigned int)buildLevel.size());
+
+                    for(Level::iterator ritr = readLevel.begin(); ritr != readLevel.end(); ++ritr)
+                    {
+                        _readRow(ritr->second);
+                    }
+
+                    for(Level::iterator ritr = buildLevel.begin(); ritr != buildLevel.end(); ++ritr)
+                    {
+                        _equalizeRow(ritr->second);
+                        if (writeToDisk) _writeRow(ritr->second);
+                    }
+
+                    // the neighbours were only read for equalization and are never written, so release them here.
+                    for(Level::iterator ritr = readLevel.begin(); ritr != readLevel.end(); ++ritr)
+                    {
+                        Level::iterator blitr = buildLevel.find(ritr->first);
+                        for(Row::iterator citr = ritr->second.begin(); citr != ritr->second.end(); ++citr)
+                        {
+                            if (blitr!=buildLevel.end() && blitr->second.count(citr->first)!=0) continue;
+                            citr->second->unrefLocalData();
+                        }
+                    }
+
+                    continue;
+                }
+
                 Level::iterator prev_itr = level.begin();
                 _readRow(prev_itr->second);
                 Level::iterator curr_itr = prev_itr;
@@ -2088,6 +2547,8 @@ void DataSet::_buildDestination(bool writeToDisk)
 #endif
             }
 
+            if (!bottomUpLevelNums.empty()) _buildLevelsBottomUp(bottomUpLevelNums, writeToDisk);
+
         }
 
         if (_archive.valid())
@@ -2103,12 +2564,21 @@ void DataSet::_buildDestination(bool writeToDisk)
 
         if (_writeThreadPool.valid()) _writeThreadPool->waitForCompletion();
 
+        reportTerrainResolutionReductions();
+        reportVertexCacheOptimization();
+        reportDeduplication();
     }
     else
     {
         log(osg::WARN, "Error: no scene graph to output, no file written.");
     }
 
+    if (_fileWriter.valid())
+    {
+        _fileWriter->stop();
+        _fileWriter = 0;
+    }
+
     if (_archive.valid()) _archive->close();
 
     osgDB::Registry::instance()->setOptions(previous_options.get());
@@ -2174,6 +2644,22 @@ bool DataSet::addModel(Source::Type type, osg::Node* model, unsigned int revisio
     return true;
 }
 
+// record the extents of a layer's source from its locator, which maps the unit square onto the source's extents.
+static void assignRecordedExtents(vpb::Source* source, osgTerrain::Layer* layer)
+{
+    osgTerrain::Locator* locator = layer->getLocator();
+    if (!locator) return;
+
+    osg::Vec3d bottomLeft = osg::Vec3d(0.0,0.0,0.0) * locator->getTransform();
+    osg::Vec3d topRight = osg::Vec3d(1.0,1.0,0.0) * locator->getTransform();
+
+    GeospatialExtents extents(osg::minimum(bottomLeft.x(), topRight.x()), osg::minimum(bottomLeft.y(), topRight.y()),
+                              osg::maximum(bottomLeft.x(), topRight.x()), osg::maximum(bottomLeft.y(), topRight.y()),
+                              locator->getCoordinateSystemType()==osgTerrain::Locator::GEOGRAPHIC);
+
+    source->setRecordedExtents(extents, locator->getCoordinateSystem());
+}
+
 bool DataSet::addLayer(Source::Type type, osgTerrain::Layer* layer, unsigned layerNum, unsigned int revisionNumber)
 {
 
@@ -2200,6 +2686,8 @@ bool DataSet::addLayer(Source::Type type, osgTerrain::Layer* layer, unsigned lay
             source->setCoordinateSystem(layer->getLocator()->getCoordinateSystem());
         }
 
+        assignRecordedExtents(source, layer);
+
         addSource(source, revisionNumber);
         return true;
     }
@@ -2227,6 +2715,8 @@ bool DataSet::addLayer(Source::Type type, osgTerrain::Layer* layer, unsigned lay
             source->setCoordinateSystem(layer->getLocator()->getCoordinateSystem());
         }
 
+        assignRecordedExtents(source, layer);
+
         addSource(source, revisionNumber);
         return true;
     }
@@ -2256,6 +2746,8 @@ bool DataSet::addLayer(Source::Type type, osgTerrain::Layer* layer, unsigned lay
             source->setCoordinateSystem(layer->getLocator()->getCoordinateSystem());
         }
 
+        assignRecordedExtents(source, layer);
+
         addSource(source, revisionNumber);
         return true;
     }
@@ -2663,9 +3155,679 @@ bool DataSet::createTileMap(unsigned int level, TilePairMap& tilepairMap)
     return true;
 }
 
-bool DataSet::generateTasks(TaskManager* taskManager)
+GeospatialExtents DataSet::computeTileExtents(unsigned int level, unsigned int X, unsigned int Y) const
 {
-    if (!getLogFileName().empty() && !getBuildLog())
+    GeospatialExtents extents = _destinationExtents;
+    if (level>0)
+    {
+        double destination_xRange = _destinationExtents.xMax()-_destinationExtents.xMin();
+        double destination_yRange = _destinationExtents.yMax()-_destinationExtents.yMin();
+
+        int Ck = int(pow(2.0, double(level-1))) * _C1;
+        int Rk = int(pow(2.0, double(level-1))) * _R1;
+
+        extents.xMin() = _destinationExtents.xMin() + (double(X)/double(Ck)) * destination_xRange;
+        extents.xMax() = _destinationExtents.xMin() + (double(X+1)/double(Ck)) * destination_xRange;
+        extents.yMin() = _destinationExtents.yMin() + (double(Y)/double(Rk)) * destination_yRange;
+        extents.yMax() = _destinationExtents.yMin() + (double(Y+1)/double(Rk)) * destination_yRange;
+    }
+    return extents;
+}
+
+double DataSet::estimateTaskCost(unsigned int level, unsigned int X, unsigned int Y, unsigned int maxLevel)
+{
+    osg::CoordinateSystemNode* cs = _intermediateCoordinateSystem.get();
+
+    double destination_xRange = _destinationExtents.xMax()-_destinationExtents.xMin();
+    double destination_yRange = _destinationExtents.yMax()-_destinationExtents.yMin();
+
+    GeospatialExtents extents = computeTileExtents(level, X, Y);
+
+    double cost = 0.0;
+    for(CompositeSource::source_iterator itr(_sourceGraph.get());itr.valid();++itr)
+    {
+        Source* source = (*itr).get();
+        if (source->getPatchStatus()==Source::UNCHANGED) continue;
+
+        SourceData* sd = source->getSourceData();
+        if (!sd) continue;
+
+        int k = 0;
+        if (!computeOptimumLevel(source, maxLevel, k) || k<static_cast<int>(level)) continue;
+
+        const SpatialProperties& sp = sd->computeSpatialProperties(cs);
+
+        double overlap_x = std::min(extents.xMax(), sp._extents.xMax()) - std::max(extents.xMin(), sp._extents.xMin());
+        double overlap_y = std::min(extents.yMax(), sp._extents.yMax()) - std::max(extents.yMin(), sp._extents.yMin());
+        if (overlap_x<=0.0 || overlap_y<=0.0) continue;
+
+        double source_area = (sp._extents.xMax()-sp._extents.xMin()) * (sp._extents.yMax()-sp._extents.yMin());
+        if (source_area<=0.0) continue;
+
+        double sourcePixels = (overlap_x*overlap_y/source_area) * double(sp._numValuesX) * double(sp._numValuesY);
+
+        // the task never reads more pixels than the finest level it builds needs, plus a third again for the coarser levels.
+        double tileSize = source->getType()==Source::IMAGE ? getLayerMaximumTileImageSize(source->getLayer()) : _maximumTileTerrainSize;
+        double numTilesAtK = k==0 ? 1.0 : pow(2.0, 2.0*double(k-1)) * double(_C1) * double(_R1);
+        double tile_area = (destination_xRange*destination_yRange) / numTilesAtK;
+        double outputPixels = (overlap_x*overlap_y/tile_area) * tileSize * tileSize * 4.0/3.0;
+
+        // the overviews mean no more source pixels are read than the output needs, each with all its bands.
+        double bytesRead = std::min(sourcePixels, outputPixels) * double(osg::maximum(sp._numValuesZ, 1u));
+
+        double reprojectionFactor = source->needReproject(cs) ? 2.0 : 1.0;
+
+        cost += (outputPixels + bytesRead) * reprojectionFactor;
+    }
+
+    return cost;
+}
+
+std::string DataSet::getTaskSourceFiles(unsigned int level, unsigned int X, unsigned int Y, unsigned int maxLevel)
+{
+    osg::CoordinateSystemNode* cs = _intermediateCoordinateSystem.get();
+
+    GeospatialExtents extents = computeTileExtents(level, X, Y);
+
+    std::string sourceFiles;
+    for(CompositeSource::source_iterator itr(_sourceGraph.get());itr.valid();++itr)
+    {
+        Source* source = (*itr).get();
+        if (source->getFileName().empty()) continue;
+
+        SourceData* sd = source->getSourceData();
+        if (!sd) continue;
+
+        int k = 0;
+        if (!computeOptimumLevel(source, maxLevel, k) || k<static_cast<int>(level)) continue;
+
+        const SpatialProperties& sp = sd->computeSpatialProperties(cs);
+        if (!extents.intersects(sp._extents)) continue;
+
+        if (!sourceFiles.empty()) sourceFiles += ";";
+        sourceFiles += source->getFileName();
+    }
+
+    return sourceFiles;
+}
+
+static double computeTextureBytesPerPixel(BuildOptions::TextureType textureType)
+{
+    switch(textureType)
+    {
+        case(BuildOptions::RGBA): return 4.0;
+        case(BuildOptions::RGB_16):
+        case(BuildOptions::RGBA_16): return 2.0;
+        case(BuildOptions::RGB_S3TC_DXT1):
+        case(BuildOptions::RGBA_S3TC_DXT1):
+        case(BuildOptions::COMPRESSED_TEXTURE): return 0.5;
+        case(BuildOptions::RGBA_S3TC_DXT3):
+        case(BuildOptions::RGBA_S3TC_DXT5):
+        case(BuildOptions::ARB_COMPRESSED):
+        case(BuildOptions::COMPRESSED_RGBA_TEXTURE): return 1.0;
+        case(BuildOptions::RGB32F): return 12.0;
+        case(BuildOptions::RGBA32F): return 16.0;
+        default: return 3.0;
+    }
+}
+
+static double computeGeometryBytesPerSample(BuildOptions::GeometryType geometryType)
+{
+    switch(geometryType)
+    {
+        // vertex, normal and texture coordinate, plus two triangles of indices.
+        case(BuildOptions::POLYGONAL): return 12.0+12.0+8.0+24.0;
+        // 16 bit position and octahedral normal, plus indices.
+        case(BuildOptions::QUANTIZED_POLYGONAL): return 6.0+4.0+24.0;
+        // the height field's floats.
+        default: return 4.0;
+    }
+}
+
+struct TileRectangle
+{
+    TileRectangle(int minX, int minY, int maxX, int maxY):
+        _minX(minX), _minY(minY), _maxX(maxX), _maxY(maxY) {}
+
+    int _minX, _minY, _maxX, _maxY;
+};
+
+typedef std::vector<TileRectangle> TileRectangles;
+
+// count the tiles covered by any of the rectangles, a strip at a time between the rectangles' y bounds, so the
+// deepest levels needn't be enumerated tile by tile.
+static double computeNumTilesCovered(const TileRectangles& rectangles)
+{
+    std::vector<int> yBounds;
+    for(TileRectangles::const_iterator itr = rectangles.begin(); itr != rectangles.end(); ++itr)
+    {
+        yBounds.push_back(itr->_minY);
+        yBounds.push_back(itr->_maxY);
+    }
+    std::sort(yBounds.begin(), yBounds.end());
+    yBounds.erase(std::unique(yBounds.begin(), yBounds.end()), yBounds.end());
+
+    double numTiles = 0.0;
+    for(unsigned int i=0; i+1<yBounds.size(); ++i)
+    {
+        int y0 = yBounds[i];
+        int y1 = yBounds[i+1];
+
+        std::vector< std::pair<int,int> > spans;
+        for(TileRectangles::const_iterator itr = rectangles.begin(); itr != rectangles.end(); ++itr)
+        {
+            if (itr->_minY<=y0 && itr->_maxY>=y1) spans.push_back(std::pair<int,int>(itr->_minX, itr->_maxX));
+        }
+        std::sort(spans.begin(), spans.end());
+
+        double width = 0.0;
+        int spanEnd = 0;
+        bool first = true;
+        for(std::vector< std::pair<int,int> >::iterator sitr = spans.begin(); sitr != spans.end(); ++sitr)
+        {
+            int spanStart = first ? sitr->first : std::max(sitr->first, spanEnd);
+            if (sitr->second>spanStart) width += double(sitr->second-spanStart);
+            spanEnd = first ? sitr->second : std::max(spanEnd, sitr->second);
+            first = false;
+        }
+
+        numTiles += width * double(y1-y0);
+    }
+
+    return numTiles;
+}
+
+// tiles are built a row at a time, with the rows either side kept for equalizing edges, so a task's memory use peaks
+// on the widest row of the deepest level it builds.
+static double estimateTaskMemory(unsigned int level, unsigned int bottomLevel, int C1, double tileMemoryBytes)
+{
+    double rowWidth = 1.0;
+    if (level==0) rowWidth = bottomLevel==0 ? 1.0 : double(C1) * pow(2.0, double(bottomLevel-1));
+    else if (bottomLevel>level) rowWidth = pow(2.0, double(bottomLevel-level));
+
+    return 3.0 * rowWidth * tileMemoryBytes;
+}
+
+bool DataSet::estimateBuild(BuildEstimate& estimate)
+{
+    estimate = BuildEstimate();
+
+    loadSources();
+
+    if (!prepareForDestinationGraphCreation()) return false;
+
+    selectAppropriateSplitLevels();
+
+    osg::CoordinateSystemNode* cs = _intermediateCoordinateSystem.get();
+    unsigned int maxNumLevels = getMaximumNumOfLevels();
+    int maxLevel = computeMaximumLevel(maxNumLevels);
+
+    estimate._maxLevel = maxLevel;
+    estimate._splitLevel = getDistributedBuildSplitLevel();
+    estimate._secondarySplitLevel = getDistributedBuildSecondarySplitLevel();
+
+    // the bytes each tile writes out, and holds in memory while it is built, for each image layer and the terrain.
+    std::set<unsigned int> imageLayers;
+    for(CompositeSource::source_iterator itr(_sourceGraph.get());itr.valid();++itr)
+    {
+        if ((*itr)->getType()==Source::IMAGE && (*itr)->getSourceData()) imageLayers.insert((*itr)->getLayer());
+    }
+
+    double tileOutputBytes = 0.0;
+    double tileMemoryBytes = 0.0;
+    for(std::set<unsigned int>::iterator litr = imageLayers.begin();
+        litr != imageLayers.end();
+        ++litr)
+    {
+        const ImageOptions* imageOptions = getValidLayerImageOptions(*litr);
+        double tileSize = getLayerMaximumTileImageSize(*litr);
+        double numPixels = tileSize * tileSize;
+        double mipMapFactor = imageOptions->getMipMappingMode()==NO_MIP_MAPPING ? 1.0 : 4.0/3.0;
+
+        tileOutputBytes += numPixels * computeTextureBytesPerPixel(imageOptions->getTextureType()) * mipMapFactor;
+
+        // images are held uncompressed until they are written.
+        tileMemoryBytes += numPixels * 4.0 * mipMapFactor;
+    }
+
+    double numSamples = double(_maximumTileTerrainSize) * double(_maximumTileTerrainSize);
+    double geometryBytesPerSample = computeGeometryBytesPerSample(getGeometryType());
+    tileOutputBytes += numSamples * geometryBytesPerSample;
+    tileMemoryBytes += numSamples * (geometryBytesPerSample + (getGeometryType()==HEIGHT_FIELD ? 0.0 : 4.0));
+
+    double destination_xRange = _destinationExtents.xMax()-_destinationExtents.xMin();
+    double destination_yRange = _destinationExtents.yMax()-_destinationExtents.yMin();
+
+    for(int l=0; l<=maxLevel; ++l)
+    {
+        LevelEstimate levelEstimate;
+        TileRectangles rectangles;
+
+        double numTilesAtL = l==0 ? 1.0 : pow(2.0, 2.0*double(l-1)) * double(_C1) * double(_R1);
+        double tile_area = (destination_xRange*destination_yRange) / numTilesAtL;
+
+        for(CompositeSource::source_iterator itr(_sourceGraph.get());itr.valid();++itr)
+        {
+            Source* source = (*itr).get();
+            if (source->getPatchStatus()==Source::UNCHANGED) continue;
+
+            SourceData* sd = source->getSourceData();
+            if (!sd) continue;
+
+            // as the destination graph, a source contributes tiles to each level down to its optimum level.
+            int k = 0;
+            if (!computeOptimumLevel(source, maxNumLevels-1, k) || k<l) continue;
+
+            const SpatialProperties& sp = sd->computeSpatialProperties(cs);
+
+            int i_min, i_max, j_min, j_max;
+            if (!computeCoverage(sp._extents, l, i_min, j_min, i_max, j_max)) continue;
+
+            rectangles.push_back(TileRectangle(i_min, j_min, i_max, j_max));
+
+            double overlap_x = std::min(_destinationExtents.xMax(), sp._extents.xMax()) - std::max(_destinationExtents.xMin(), sp._extents.xMin());
+            double overlap_y = std::min(_destinationExtents.yMax(), sp._extents.yMax()) - std::max(_destinationExtents.yMin(), sp._extents.yMin());
+            double source_area = (sp._extents.xMax()-sp._extents.xMin()) * (sp._extents.yMax()-sp._extents.yMin());
+            if (overlap_x<=0.0 || overlap_y<=0.0 || source_area<=0.0) continue;
+
+            // as estimateTaskCost(), the overviews mean no more source pixels are read than the level needs.
+            double sourcePixels = (overlap_x*overlap_y/source_area) * double(sp._numValuesX) * double(sp._numValuesY);
+            double tileSize = source->getType()==Source::IMAGE ? getLayerMaximumTileImageSize(source->getLayer()) : _maximumTileTerrainSize;
+            double outputPixels = (overlap_x*overlap_y/tile_area) * tileSize * tileSize;
+
+            levelEstimate._sourceBytesRead += std::min(sourcePixels, outputPixels) * double(osg::maximum(sp._numValuesZ, 1u));
+        }
+
+        levelEstimate._numTiles = computeNumTilesCovered(rectangles);
+        levelEstimate._outputBytes = levelEstimate._numTiles * tileOutputBytes;
+
+        estimate._levels.push_back(levelEstimate);
+    }
+
+    // the tasks, as generateTasksImplementation() creates them.
+    unsigned int bottomLevel = osg::minimum(static_cast<unsigned int>(maxLevel), maxNumLevels-1);
+
+    TaskEstimate task;
+    task._type = "root";
+    task._bottomLevel = getDistributedBuildSplitLevel()==0 ? bottomLevel : getDistributedBuildSplitLevel()-1;
+    task._cost = estimateTaskCost(0, 0, 0, task._bottomLevel);
+    task._peakMemory = estimateTaskMemory(0, task._bottomLevel, _C1, tileMemoryBytes);
+    estimate._tasks.push_back(task);
+
+    if (getDistributedBuildSplitLevel()==0) return true;
+
+    unsigned int bottomDistributedBuildLevel = getDistributedBuildSecondarySplitLevel()==0 ?
+                                                getDistributedBuildSplitLevel() :
+                                                getDistributedBuildSecondarySplitLevel();
+
+    unsigned int deltaLevels = 0;
+    TileSet unsplitTiles;
+
+    if (getDistributedBuildSecondarySplitLevel()!=0)
+    {
+        unsigned int level = getDistributedBuildSplitLevel()-1;
+
+        TilePairMap intermediateTileMap;
+        createTileMap(level, intermediateTileMap);
+
+        for(TilePairMap::iterator itr = intermediateTileMap.begin();
+            itr != intermediateTileMap.end();
+            ++itr)
+        {
+            task._level = level;
+            task._tileX = itr->first.first;
+            task._tileY = itr->first.second;
+
+            double bottomCost = _targetTaskCost>0.0 ? estimateTaskCost(level, task._tileX, task._tileY, maxNumLevels-1) : 0.0;
+            if (_targetTaskCost>0.0 && bottomCost<=_targetTaskCost)
+            {
+                unsplitTiles.insert(itr->first);
+
+                task._type = "subtile";
+                task._bottomLevel = bottomLevel;
+                task._cost = bottomCost;
+            }
+            else
+            {
+                task._type = "intermediate";
+                task._bottomLevel = getDistributedBuildSecondarySplitLevel()-1;
+                task._cost = estimateTaskCost(level, task._tileX, task._tileY, task._bottomLevel);
+            }
+
+            task._peakMemory = estimateTaskMemory(level, task._bottomLevel, _C1, tileMemoryBytes);
+            estimate._tasks.push_back(task);
+        }
+
+        deltaLevels = getDistributedBuildSecondarySplitLevel()-getDistributedBuildSplitLevel();
+    }
+
+    {
+        unsigned int level = bottomDistributedBuildLevel-1;
+
+        TilePairMap bottomTileMap;
+        createTileMap(level, bottomTileMap);
+
+        for(TilePairMap::iterator itr = bottomTileMap.begin();
+            itr != bottomTileMap.end();
+            ++itr)
+        {
+            // already built by the task for its intermediate tile.
+            if (deltaLevels && unsplitTiles.count(TilePair(itr->first.first >> deltaLevels, itr->first.second >> deltaLevels))!=0) continue;
+
+            task._type = "subtile";
+            task._level = level;
+            task._tileX = itr->first.first;
+            task._tileY = itr->first.second;
+            task._bottomLevel = bottomLevel;
+            task._cost = estimateTaskCost(level, task._tileX, task._tileY, maxNumLevels-1);
+            task._peakMemory = estimateTaskMemory(level, task._bottomLevel, _C1, tileMemoryBytes);
+            estimate._tasks.push_back(task);
+        }
+    }
+
+    return true;
+}
+
+// compute the extents of a patched source in the given coordinate system, falling back to the extents recorded by the
+// previous revision for sources, removed ones in particular, that have no data loaded.
+static bool computePatchedSourceExtents(Source* source, osg::CoordinateSystemNode* cs, GeospatialExtents& extents)
+{
+    SourceData* sd = source->getSourceData();
+    if (sd)
+    {
+        extents = sd->computeSpatialProperties(cs)._extents;
+        return extents.valid();
+    }
+
+    const GeospatialExtents& recordedExtents = source->getRecordedExtents();
+    if (!recordedExtents.valid()) return false;
+
+    const std::string& recordedWKT = source->getRecordedCoordinateSystem();
+    osg::ref_ptr<osg::CoordinateSystemNode> recordedCS = new osg::CoordinateSystemNode("WKT", recordedWKT);
+    if (!cs || recordedWKT.empty() || areCoordinateSystemEquivalent(recordedCS.get(), cs))
+    {
+        extents = recordedExtents;
+        return true;
+    }
+
+    OGRCoordinateTransformation* ct = System::instance()->acquireCoordinateTransformation(recordedWKT, cs->getCoordinateSystem());
+    if (!ct) return false;
+
+    // sample along each edge as the edges needn't stay straight in the new coordinate system.
+    const unsigned int numSamplesPerEdge = 9;
+    std::vector<double> x, y, z;
+    for(unsigned int i=0; i<numSamplesPerEdge; ++i)
+    {
+        double t = double(i)/double(numSamplesPerEdge-1);
+        double sx = recordedExtents.xMin() + t*(recordedExtents.xMax()-recordedExtents.xMin());
+        double sy = recordedExtents.yMin() + t*(recordedExtents.yMax()-recordedExtents.yMin());
+
+        x.push_back(sx); y.push_back(recordedExtents.yMin());
+        x.push_back(sx); y.push_back(recordedExtents.yMax());
+        x.push_back(recordedExtents.xMin()); y.push_back(sy);
+        x.push_back(recordedExtents.xMax()); y.push_back(sy);
+    }
+    z.resize(x.size(), 0.0);
+
+    bool success = ct->Transform(x.size(), &x[0], &y[0], &z[0])!=0;
+
+    System::instance()->releaseCoordinateTransformation(recordedWKT, cs->getCoordinateSystem(), ct);
+
+    if (!success) return false;
+
+    extents.init();
+    extents._isGeographic = (getCoordinateSystemType(cs)==GEOGRAPHIC);
+    for(unsigned int i=0; i<x.size(); ++i)
+    {
+        extents.xMin() = osg::minimum(extents.xMin(), x[i]);
+        extents.yMin() = osg::minimum(extents.yMin(), y[i]);
+        extents.xMax() = osg::maximum(extents.xMax(), x[i]);
+        extents.yMax() = osg::maximum(extents.yMax(), y[i]);
+    }
+
+    return extents.valid();
+}
+
+bool DataSet::computeDirtyTiles(DirtyTileMap& dirtyTiles)
+{
+    osg::CoordinateSystemNode* cs = _intermediateCoordinateSystem.get();
+    int maxNumLevels = getMaximumNumOfLevels();
+
+    typedef std::vector<Source*> Sources;
+    Sources patchedSources;
+    for(CompositeSource::source_iterator itr(_sourceGraph.get());itr.valid();++itr)
+    {
+        Source* source = (*itr).get();
+        if (source->getPatchStatus()==Source::ADDED ||
+            source->getPatchStatus()==Source::MODIFIED ||
+            source->getPatchStatus()==Source::REMOVED)
+        {
+            patchedSources.push_back(source);
+        }
+    }
+
+    if (patchedSources.empty()) return false;
+
+    for(Sources::iterator pitr = patchedSources.begin();
+        pitr != patchedSources.end();
+        ++pitr)
+    {
+        Source* source = *pitr;
+
+        GeospatialExtents extents;
+        if (!computePatchedSourceExtents(source, cs, extents))
+        {
+            // without its extents the tiles the source affects can't be known, so rebuilding only some tiles would
+            // leave stale data behind.
+            log(osg::FATAL,"Error: unable to determine the extents of patched source %s, neither its data nor extents recorded by the previous revision are available. Rebuilding all tiles.",source->getFileName().c_str());
+            dirtyTiles.clear();
+            return false;
+        }
+
+        // the region is rebuilt down to the finest level that any source covering it contributes to,
+        // as that is the deepest level at which the blend of sources in the region changes. Models and
+        // shapefiles have no resolution of their own, they are read into every tile over them that the
+        // imagery and DEMs create, within the source's own level range.
+        int maxLevel = -1;
+        for(CompositeSource::source_iterator itr(_sourceGraph.get());itr.valid();++itr)
+        {
+            SourceData* other_sd = (*itr)->getSourceData();
+            if (!other_sd || !other_sd->computeSpatialProperties(cs)._extents.intersects(extents)) continue;
+
+            int k = 0;
+            if (computeOptimumLevel((*itr).get(), maxNumLevels-1, k) && k>maxLevel) maxLevel = k;
+        }
+
+        int minLevel = 0;
+        if (source->getType()!=Source::IMAGE && source->getType()!=Source::HEIGHT_FIELD)
+        {
+            minLevel = source->getMinLevel();
+            maxLevel = std::min(maxLevel, int(source->getMaxLevel()));
+        }
+
+        if (minLevel>maxLevel)
+        {
+            log(osg::INFO,"Patched source %s contributes to no tiles",source->getFileName().c_str());
+            continue;
+        }
+
+        log(osg::INFO,"Patched source %s dirties levels %d to %d",source->getFileName().c_str(),minLevel,maxLevel);
+
+        // the root tile covers everything, a source only contributing to it dirties no deeper level.
+        dirtyTiles[0].insert(TilePair(0,0));
+
+        for(int l=std::max(minLevel,1); l<=maxLevel; ++l)
+        {
+            int i_min, i_max, j_min, j_max;
+            if (!computeCoverage(extents, l, i_min, j_min, i_max, j_max)) continue;
+
+            int Ck = int(pow(2.0, double(l-1))) * _C1;
+            int Rk = int(pow(2.0, double(l-1))) * _R1;
+
+            // include the ring of neighbouring tiles as their shared edges are re-equalized.
+            i_min = std::max(i_min-1, 0);
+            j_min = std::max(j_min-1, 0);
+            i_max = std::min(i_max+1, Ck);
+            j_max = std::min(j_max+1, Rk);
+
+            TileSet& tiles = dirtyTiles[l];
+            for(int j=j_min; j<j_max; ++j)
+            {
+                for(int i=i_min; i<i_max; ++i)
+                {
+                    tiles.insert(TilePair(i,j));
+                }
+            }
+        }
+    }
+
+    // every ancestor of a dirty tile has to be rebuilt as well.
+    for(DirtyTileMap::reverse_iterator ritr = dirtyTiles.rbegin();
+        ritr != dirtyTiles.rend();
+        ++ritr)
+    {
+        unsigned int level = ritr->first;
+        if (level==0) continue;
+
+        TileSet& parentTiles = dirtyTiles[level-1];
+        for(TileSet::iterator titr = ritr->second.begin();
+            titr != ritr->second.end();
+            ++titr)
+        {
+            if (level==1) parentTiles.insert(TilePair(0,0));
+            else parentTiles.insert(TilePair(titr->first/2, titr->second/2));
+        }
+    }
+
+    return true;
+}
+
+bool DataSet::readDirtyTiles(const std::string& filename, DirtyTileMap& dirtyTiles)
+{
+    std::ifstream fin(filename.c_str());
+    if (!fin)
+    {
+        log(osg::WARN,"Error: unable to read dirty tiles file %s",filename.c_str());
+        return false;
+    }
+
+    unsigned int level, x, y;
+    while (fin >> level >> x >> y)
+    {
+        dirtyTiles[level].insert(TilePair(x,y));
+    }
+
+    return true;
+}
+
+bool DataSet::writeDirtyTiles(const std::string& filename, const DirtyTileMap& dirtyTiles)
+{
+    std::ofstream fout(filename.c_str());
+    if (!fout)
+    {
+        log(osg::WARN,"Error: unable to write dirty tiles file %s",filename.c_str());
+        return false;
+    }
+
+    for(DirtyTileMap::const_iterator ditr = dirtyTiles.begin();
+        ditr != dirtyTiles.end();
+        ++ditr)
+    {
+        for(TileSet::const_iterator titr = ditr->second.begin();
+            titr != ditr->second.end();
+            ++titr)
+        {
+            fout<<ditr->first<<" "<<titr->first<<" "<<titr->second<<std::endl;
+        }
+    }
+
+    return true;
+}
+
+void DataSet::reportDirtyTiles(const DirtyTileMap& dirtyTiles)
+{
+    unsigned int totalDirty = 0;
+    double totalTiles = 0.0;
+    for(DirtyTileMap::const_iterator ditr = dirtyTiles.begin();
+        ditr != dirtyTiles.end();
+        ++ditr)
+    {
+        double numTiles = ditr->first==0 ? 1.0 : pow(2.0, 2.0*double(ditr->first-1)) * double(_C1) * double(_R1);
+        log(osg::NOTICE,"Level %u : %u of %.0f tiles to rebuild",ditr->first,(unsigned int)ditr->second.size(),numTiles);
+
+        totalDirty += ditr->second.size();
+        totalTiles += numTiles;
+    }
+
+    log(osg::NOTICE,"Incremental build : %u of %.0f tiles to rebuild",totalDirty,totalTiles);
+}
+
+void DataSet::_selectDirtyTiles(unsigned int levelNum, Level& level, Level& buildLevel, Level& readLevel)
+{
+    DirtyTileMap::iterator ditr = _dirtyTiles.find(levelNum);
+    if (ditr==_dirtyTiles.end()) return;
+
+    // subtiles are written out a whole family at a time so the siblings of each dirty tile are built too.
+    TileSet buildTiles;
+    for(TileSet::iterator titr = ditr->second.begin();
+        titr != ditr->second.end();
+        ++titr)
+    {
+        if (levelNum<=1)
+        {
+            for(Level::iterator litr = level.begin(); litr != level.end(); ++litr)
+            {
+                for(Row::iterator ritr = litr->second.begin(); ritr != litr->second.end(); ++ritr)
+                {
+                    buildTiles.insert(TilePair(ritr->first, litr->first));
+                }
+            }
+            break;
+        }
+
+        unsigned int x = (titr->first/2)*2;
+        unsigned int y = (titr->second/2)*2;
+        buildTiles.insert(TilePair(x,y));
+        buildTiles.insert(TilePair(x+1,y));
+        buildTiles.insert(TilePair(x,y+1));
+        buildTiles.insert(TilePair(x+1,y+1));
+    }
+
+    for(TileSet::iterator titr = buildTiles.begin();
+        titr != buildTiles.end();
+        ++titr)
+    {
+        int x = titr->first;
+        int y = titr->second;
+
+        Level::iterator litr = level.find(y);
+        if (litr==level.end()) continue;
+
+        Row::iterator ritr = litr->second.find(x);
+        if (ritr==litr->second.end()) continue;
+
+        buildLevel[y][x] = ritr->second;
+
+        // the neighbours are read so that the edges of the built tiles can be equalized against them.
+        for(int j=y-1; j<=y+1; ++j)
+        {
+            if (j<0) continue;
+            Level::iterator nlitr = level.find(j);
+            if (nlitr==level.end()) continue;
+
+            for(int i=x-1; i<=x+1; ++i)
+            {
+                if (i<0) continue;
+                Row::iterator nritr = nlitr->second.find(i);
+                if (nritr!=nlitr->second.end()) readLevel[j][i] = nritr->second;
+            }
+        }
+    }
+}
+
+bool DataSet::generateTasks(TaskManager* taskManager)
+{
+    if (!getLogFileName().empty() && !getBuildLog())
     {
         setBuildLog(new BuildLog(getLogFileName()));
     }
@@ -2691,12 +3853,18 @@ void DataSet::selectAppropriateSplitLevels()
     unsigned int maxLevel = computeMaximumLevel(getMaximumNumOfLevels());
     log(osg::NOTICE,"Computed maximum source level = %i", maxLevel);
 
+    _targetTaskCost = 0.0;
+
     if (getDistributedBuildSplitLevel()==0)
     {
         if (getDistributedBuildSecondarySplitLevel()==0)
         {
             // need to compute both primary and secodary split levels
-            if (maxLevel<10)
+            if (selectSplitLevelsFromCostModel(maxLevel))
+            {
+                // split levels chosen to give tasks of roughly equal cost.
+            }
+            else if (maxLevel<10)
             {
                 // just use primary split level
                 setDistributedBuildSplitLevel( maxLevel / 2 );
@@ -2762,6 +3930,84 @@ void DataSet::selectAppropriateSplitLevels()
 
 }
 
+bool DataSet::selectSplitLevelsFromCostModel(unsigned int maxLevel)
+{
+    if (maxLevel<2 || !_destinationExtents.valid() || _C1==0 || _R1==0) return false;
+
+    double totalCost = estimateTaskCost(0, 0, 0, maxLevel);
+    if (totalCost<=0.0) return false;
+
+    // aim for several tasks per thread so the scheduler has room to balance the load.
+    const unsigned int numTasksPerThread = 4;
+    unsigned int numThreads = System::instance()->getMachinePool() ? System::instance()->getMachinePool()->getNumThreads() : 0;
+    if (numThreads==0) numThreads = OpenThreads::GetNumberOfProcessors();
+
+    double targetTaskCost = totalCost / double(osg::maximum(numThreads, 1u) * numTasksPerThread);
+
+    // the root task runs before all the others, so go as deep as possible while its cost stays within a single task.
+    // A split level of n builds the root task with -l n, down to level n-1, so estimate it to that depth.
+    unsigned int primaryLevel = 1;
+    while (primaryLevel+1<maxLevel)
+    {
+        unsigned int nextPrimaryLevel = primaryLevel+1;
+        if (estimateTaskCost(0, 0, 0, nextPrimaryLevel-1)>targetTaskCost) break;
+
+        primaryLevel = nextPrimaryLevel;
+    }
+
+    double rootCost = estimateTaskCost(0, 0, 0, primaryLevel-1);
+
+    // tiles that would cost more than a task to build to the bottom are dense enough to split again.
+    TilePairMap primaryTileMap;
+    createTileMap(primaryLevel-1, primaryTileMap);
+
+    typedef std::vector<TilePair> TilePairs;
+    TilePairs denseTiles;
+    double maxPrimaryCost = 0.0;
+    for(TilePairMap::iterator itr = primaryTileMap.begin();
+        itr != primaryTileMap.end();
+        ++itr)
+    {
+        double cost = estimateTaskCost(primaryLevel-1, itr->first.first, itr->first.second, maxLevel);
+        if (cost>targetTaskCost) denseTiles.push_back(itr->first);
+        maxPrimaryCost = osg::maximum(maxPrimaryCost, cost);
+    }
+
+    unsigned int secondaryLevel = 0;
+    if (!denseTiles.empty() && primaryLevel+1<maxLevel)
+    {
+        // split the dense tiles as deep as possible while the intermediate tasks stay within a single task, like the
+        // root task an intermediate task built with -l n only goes down to level n-1.
+        secondaryLevel = primaryLevel+1;
+        while (secondaryLevel+1<maxLevel)
+        {
+            unsigned int nextSecondaryLevel = secondaryLevel+1;
+
+            double maxIntermediateCost = 0.0;
+            for(TilePairs::iterator itr = denseTiles.begin();
+                itr != denseTiles.end();
+                ++itr)
+            {
+                maxIntermediateCost = osg::maximum(maxIntermediateCost, estimateTaskCost(primaryLevel-1, itr->first, itr->second, nextSecondaryLevel-1));
+            }
+
+            if (maxIntermediateCost>targetTaskCost) break;
+
+            secondaryLevel = nextSecondaryLevel;
+        }
+    }
+
+    setDistributedBuildSplitLevel(primaryLevel);
+    setDistributedBuildSecondarySplitLevel(secondaryLevel);
+
+    _targetTaskCost = targetTaskCost;
+
+    log(osg::NOTICE,"Cost model: total cost %g, target task cost %g for %d threads, root task cost %g, largest primary tile cost %g, %d of %d primary tiles dense enough to split again.",
+        totalCost, targetTaskCost, numThreads, rootCost, maxPrimaryCost, int(denseTiles.size()), int(primaryTileMap.size()));
+
+    return true;
+}
+
 std::string DataSet::getTaskName(unsigned int level, unsigned int X, unsigned int Y) const
 {
     if (level==0 && X==0 && Y==0)
@@ -2886,6 +4132,36 @@ bool DataSet::generateTasksImplementation(TaskManager* taskManager)
 
     bool logging = getNotifyLevel() > ALWAYS;
 
+    bool profiling = Profiler::instance()->getEnabled();
+
+    bool metrics = Metrics::instance()->getEnabled();
+    std::ostringstream metricsOptionStream;
+    metricsOptionStream<<" --metrics-interval "<<Metrics::instance()->getInterval()<<" --metrics ";
+    std::string metricsOption = metricsOptionStream.str();
+
+    // when patching, work out exactly which tiles need rebuilding and pass them on to each of the tasks.
+    DirtyTileMap dirtyTiles;
+    std::string taskJournalOption = std::string(" --task-journal ")+taskManager->getTaskJournalFileName();
+
+    std::string dirtyTilesOption;
+    if (computeDirtyTiles(dirtyTiles))
+    {
+        reportDirtyTiles(dirtyTiles);
+
+        if (taskManager->getDryRun()) return false;
+
+        std::string dirtyTilesFileName = taskDirectory+basename+".dirty";
+        if (writeDirtyTiles(dirtyTilesFileName, dirtyTiles))
+        {
+            dirtyTilesOption = std::string(" --dirty-tiles ")+dirtyTilesFileName;
+        }
+    }
+    else if (taskManager->getDryRun())
+    {
+        log(osg::NOTICE,"No patched sources, all tiles would be built.");
+        return false;
+    }
+
 
     // create root task
     {
@@ -2893,7 +4169,10 @@ bool DataSet::generateTasksImplementation(TaskManager* taskManager)
         taskfile<<taskDirectory<<basename<<"_root_L0_X0_Y0.task";
 
         std::ostringstream app;
-        app<<"osgdem --run-path "<<taskManager->getRunPath()<<" -s "<<sourceFile<<" --record-subtile-on-leaf-tiles -l "<<getDistributedBuildSplitLevel()<<" --task "<<taskfile.str();
+        app<<"osgdem --run-path "<<taskManager->getRunPath()<<" -s "<<sourceFile<<" --record-subtile-on-leaf-tiles -l "<<getDistributedBuildSplitLevel()<<" --task "<<taskfile.str()<<taskJournalOption<<dirtyTilesOption;
+
+        if (profiling) app<<" --profile "<<taskfile.str()<<".trace.json";
+        if (metrics) app<<metricsOption<<taskfile.str()<<".metrics";
 
         if (!fileCacheName.empty())
         {
@@ -2907,7 +4186,9 @@ bool DataSet::generateTasksImplementation(TaskManager* taskManager)
             app<<" --log "<<logfile.str();
         }
 
-        taskManager->addTask(taskfile.str(), app.str(), sourceFile, getDatabaseRevisionBaseFileName(0,0,0));
+        taskManager->addTask(taskfile.str(), app.str(), sourceFile, getDatabaseRevisionBaseFileName(0,0,0),
+                             "root", 0, 0, 0, estimateTaskCost(0, 0, 0, getDistributedBuildSplitLevel()-1),
+                             getTaskSourceFiles(0, 0, 0, getDistributedBuildSplitLevel()-1));
     }
 
     // create the tilemaps for the required split levels
@@ -2920,6 +4201,24 @@ bool DataSet::generateTasksImplementation(TaskManager* taskManager)
     TilePairMap bottomTileMap;
     createTileMap(bottomDistributedBuildLevel-1, bottomTileMap);
 
+    // neighbouring tiles dirtied by edge equalization need tasks too, even if no patched source overlaps them.
+    if (getDistributedBuildSecondarySplitLevel()!=0)
+    {
+        TileSet& tiles = dirtyTiles[getDistributedBuildSplitLevel()-1];
+        for(TileSet::iterator itr = tiles.begin(); itr != tiles.end(); ++itr)
+        {
+            if (intermediateTileMap.count(*itr)==0) intermediateTileMap[*itr] = getDistributedBuildSplitLevel()-1;
+        }
+    }
+
+    {
+        TileSet& tiles = dirtyTiles[bottomDistributedBuildLevel-1];
+        for(TileSet::iterator itr = tiles.begin(); itr != tiles.end(); ++itr)
+        {
+            if (bottomTileMap.count(*itr)==0) bottomTileMap[*itr] = bottomDistributedBuildLevel-1;
+        }
+    }
+
     unsigned int totalNumOfTasksSansRoot = intermediateTileMap.size() + bottomTileMap.size();
     unsigned int taskCount = 0;
     // unsigned int numTasksPerDirectory = getMaxNumberOfFilesPerDirectory();
@@ -2933,6 +4232,9 @@ bool DataSet::generateTasksImplementation(TaskManager* taskManager)
     unsigned int divisor = 1;
     unsigned int nestedLevel = getDistributedBuildSplitLevel()-1;
 
+    // intermediate tiles that the cost model finds too sparse to split again, built all the way down by one task.
+    TileSet unsplitTiles;
+
     // need to create an intermediate level if required.
     if (getDistributedBuildSecondarySplitLevel()!=0)
     {
@@ -2952,8 +4254,17 @@ bool DataSet::generateTasksImplementation(TaskManager* taskManager)
             taskfile<<basename<<"_subtile_L"<<level<<"_X"<<tileX<<"_Y"<<tileY<<".task";
 
 
+            double bottomCost = _targetTaskCost>0.0 ? estimateTaskCost(level, tileX, tileY, getMaximumNumOfLevels()-1) : 0.0;
+            bool buildToBottom = _targetTaskCost>0.0 && bottomCost<=_targetTaskCost;
+            if (buildToBottom) unsplitTiles.insert(itr->first);
+
             std::ostringstream app;
-            app<<"osgdem --run-path "<<taskManager->getRunPath()<<" -s "<<sourceFile<<" --record-subtile-on-leaf-tiles -l "<<getDistributedBuildSecondarySplitLevel()<<" --subtile "<<level<<" "<<tileX<<" "<<tileY<<" --task "<<taskfile.str();
+            app<<"osgdem --run-path "<<taskManager->getRunPath()<<" -s "<<sourceFile;
+            if (!buildToBottom) app<<" --record-subtile-on-leaf-tiles -l "<<getDistributedBuildSecondarySplitLevel();
+            app<<" --subtile "<<level<<" "<<tileX<<" "<<tileY<<" --task "<<taskfile.str()<<taskJournalOption<<dirtyTilesOption;
+
+            if (profiling) app<<" --profile "<<taskfile.str()<<".trace.json";
+            if (metrics) app<<metricsOption<<taskfile.str()<<".metrics";
 
 
             if (!fileCacheName.empty())
@@ -2970,7 +4281,18 @@ bool DataSet::generateTasksImplementation(TaskManager* taskManager)
                 app<<" --log "<<logfile.str();
             }
 
-            taskManager->addTask(taskfile.str(), app.str(), sourceFile, getDatabaseRevisionBaseFileName(level,tileX,tileY));
+            if (buildToBottom)
+            {
+                taskManager->addTask(taskfile.str(), app.str(), sourceFile, getDatabaseRevisionBaseFileName(level,tileX,tileY),
+                                     "subtile", level, tileX, tileY, bottomCost,
+                                     getTaskSourceFiles(level, tileX, tileY, getMaximumNumOfLevels()-1));
+            }
+            else
+            {
+                taskManager->addTask(taskfile.str(), app.str(), sourceFile, getDatabaseRevisionBaseFileName(level,tileX,tileY),
+                                     "intermediate", level, tileX, tileY, estimateTaskCost(level, tileX, tileY, getDistributedBuildSecondarySplitLevel()-1),
+                                     getTaskSourceFiles(level, tileX, tileY, getDistributedBuildSecondarySplitLevel()-1));
+            }
 
             ++taskCount;
         }
@@ -2979,6 +4301,11 @@ bool DataSet::generateTasksImplementation(TaskManager* taskManager)
         // the deltaLevels and divisor for use in below.
         deltaLevels = getDistributedBuildSecondarySplitLevel()-getDistributedBuildSplitLevel();
         divisor = 1 << deltaLevels;
+
+        if (!unsplitTiles.empty())
+        {
+            log(osg::NOTICE,"%d of %d intermediate tiles built to the bottom without splitting again.",int(unsplitTiles.size()),int(intermediateTileMap.size()));
+        }
     }
 
 
@@ -2993,6 +4320,9 @@ bool DataSet::generateTasksImplementation(TaskManager* taskManager)
             unsigned int tileX = itr->first.first;
             unsigned int tileY = itr->first.second;
 
+            // already built by the task for its intermediate tile.
+            if (deltaLevels && unsplitTiles.count(TilePair(tileX / divisor, tileY / divisor))!=0) continue;
+
             // unsigned int taskSet = taskCount / numTasksPerDirectory;
 
             std::ostringstream taskfile;
@@ -3010,7 +4340,10 @@ bool DataSet::generateTasksImplementation(TaskManager* taskManager)
 
 
             std::ostringstream app;
-            app<<"osgdem --run-path "<<taskManager->getRunPath()<<" -s "<<sourceFile<<" --subtile "<<level<<" "<<tileX<<" "<<tileY<<" --task "<<taskfile.str();
+            app<<"osgdem --run-path "<<taskManager->getRunPath()<<" -s "<<sourceFile<<" --subtile "<<level<<" "<<tileX<<" "<<tileY<<" --task "<<taskfile.str()<<taskJournalOption<<dirtyTilesOption;
+
+            if (profiling) app<<" --profile "<<taskfile.str()<<".trace.json";
+            if (metrics) app<<metricsOption<<taskfile.str()<<".metrics";
 
             if (!fileCacheName.empty())
             {
@@ -3035,7 +4368,9 @@ bool DataSet::generateTasksImplementation(TaskManager* taskManager)
                 app<<" --log "<<logfile.str();
             }
 
-            taskManager->addTask(taskfile.str(), app.str(), sourceFile, getDatabaseRevisionBaseFileName(level,tileX,tileY));
+            taskManager->addTask(taskfile.str(), app.str(), sourceFile, getDatabaseRevisionBaseFileName(level,tileX,tileY),
+                                 "subtile", level, tileX, tileY, estimateTaskCost(level, tileX, tileY, getMaximumNumOfLevels()-1),
+                                 getTaskSourceFiles(level, tileX, tileY, getMaximumNumOfLevels()-1));
 
             ++taskCount;
         }
@@ -3067,6 +4402,341 @@ const std::string DataSet::getDatabaseRevisionBaseFileName(unsigned int level, u
     return sstr.str();
 }
 
+osg::Program* DataSet::getQuantizedGeometryProgram(bool implicitTexCoords)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_quantizedGeometryProgramMutex);
+
+    osg::ref_ptr<osg::Program>& program = _quantizedGeometryProgram[implicitTexCoords ? 1 : 0];
+    if (program.valid()) return program.get();
+
+    std::ostringstream vertexShader;
+    vertexShader << "uniform vec3 vpb_positionOffset;\n"
+                 << "uniform vec3 vpb_positionScale;\n"
+                 << "attribute vec2 vpb_octNormal;\n";
+
+    if (implicitTexCoords) vertexShader << "uniform vec4 vpb_texCoordTransform;\n";
+    else vertexShader << "attribute vec2 vpb_texCoord;\n";
+
+    vertexShader << "\n"
+                 << "vec3 decodeOctahedralNormal(vec2 e)\n"
+                 << "{\n"
+                 << "    vec3 n = vec3(e.x, e.y, 1.0 - abs(e.x) - abs(e.y));\n"
+                 << "    if (n.z < 0.0)\n"
+                 << "    {\n"
+                 << "        n.x = (1.0 - abs(e.y)) * (e.x >= 0.0 ? 1.0 : -1.0);\n"
+                 << "        n.y = (1.0 - abs(e.x)) * (e.y >= 0.0 ? 1.0 : -1.0);\n"
+                 << "    }\n"
+                 << "    return normalize(n);\n"
+                 << "}\n"
+                 << "\n"
+                 << "void main()\n"
+                 << "{\n"
+                 << "    vec4 position = vec4(vpb_positionOffset + gl_Vertex.xyz * vpb_positionScale, 1.0);\n"
+                 << "    vec3 normal = normalize(gl_NormalMatrix * decodeOctahedralNormal(vpb_octNormal));\n"
+                 << "    vec3 lightDir = normalize(gl_LightSource[0].position.xyz);\n"
+                 << "    float diffuse = max(dot(normal, lightDir), 0.0);\n"
+                 << "    vec4 lighting = gl_LightModel.ambient + gl_LightSource[0].ambient + gl_LightSource[0].diffuse * diffuse;\n"
+                 << "    gl_FrontColor = vec4(gl_Color.rgb * min(lighting.rgb, vec3(1.0)), gl_Color.a);\n";
+
+    if (implicitTexCoords) vertexShader << "    vec4 texCoord = vec4(position.xy * vpb_texCoordTransform.xy + vpb_texCoordTransform.zw, 0.0, 1.0);\n";
+    else vertexShader << "    vec4 texCoord = vec4(vpb_texCoord, 0.0, 1.0);\n";
+
+    for(unsigned int unit=0; unit<getNumOfTextureLevels(); ++unit)
+    {
+        vertexShader << "    gl_TexCoord["<<unit<<"] = texCoord;\n";
+    }
+
+    vertexShader << "    gl_Position = gl_ModelViewProjectionMatrix * position;\n"
+                 << "}\n";
+
+    program = new osg::Program;
+    program->setName("vpb_QuantizedGeometry");
+    program->addShader(new osg::Shader(osg::Shader::VERTEX, vertexShader.str()));
+    program->addBindAttribLocation("vpb_octNormal", QUANTIZED_NORMAL_ATTRIBUTE);
+    if (!implicitTexCoords) program->addBindAttribLocation("vpb_texCoord", QUANTIZED_TEXCOORD_ATTRIBUTE);
+
+    return program.get();
+}
+
+osg::DrawElements* DataSet::getSharedIndexBuffer(osg::DrawElements* drawElements)
+{
+    if (!drawElements) return 0;
+
+    // only keep a handful of candidates per size so the cache can't grow without bound.
+    const unsigned int maximumNumCandidates = 8;
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_sharedIndexBufferMutex);
+
+    IndexBufferList& candidates = _sharedIndexBufferMap[std::make_pair(drawElements->getNumIndices(), (unsigned int)drawElements->getType())];
+    for(IndexBufferList::iterator itr = candidates.begin();
+        itr != candidates.end();
+        ++itr)
+    {
+        osg::DrawElements* candidate = itr->get();
+        if (candidate->getMode()!=drawElements->getMode()) continue;
+
+        bool identical = true;
+        for(unsigned int i=0; i<drawElements->getNumIndices() && identical; ++i)
+        {
+            identical = (candidate->index(i)==drawElements->index(i));
+        }
+
+        if (identical) return candidate;
+    }
+
+    candidates.push_back(drawElements);
+    if (candidates.size()>maximumNumCandidates) candidates.pop_front();
+
+    return drawElements;
+}
+
+void DataSet::recordVertexCacheOptimization(unsigned int numTriangles, unsigned int missesBefore, unsigned int missesAfter)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_vertexCacheStatsMutex);
+
+    _vertexCacheNumTriangles += double(numTriangles);
+    _vertexCacheMissesBefore += double(missesBefore);
+    _vertexCacheMissesAfter += double(missesAfter);
+}
+
+void DataSet::reportVertexCacheOptimization()
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_vertexCacheStatsMutex);
+
+    if (_vertexCacheNumTriangles==0.0) return;
+
+    log(osg::NOTICE, "Vertex cache optimization : %.0f triangles, ACMR before %f, after %f",
+        _vertexCacheNumTriangles,
+        _vertexCacheMissesBefore/_vertexCacheNumTriangles,
+        _vertexCacheMissesAfter/_vertexCacheNumTriangles);
+}
+
+void DataSet::recordTerrainResolutionReduction(unsigned int level, unsigned int originalSize, unsigned int reducedSize)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_terrainReductionStatsMutex);
+
+    TerrainReductionStats& stats = _terrainReductionStatsMap[level];
+    ++stats._numTiles;
+    if (reducedSize<originalSize) ++stats._numTilesReduced;
+    stats._originalSize += double(originalSize);
+    stats._reducedSize += double(reducedSize);
+}
+
+void DataSet::reportTerrainResolutionReductions()
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_terrainReductionStatsMutex);
+
+    if (_terrainReductionStatsMap.empty()) return;
+
+    double totalOriginalSize = 0.0;
+    double totalReducedSize = 0.0;
+    for(TerrainReductionStatsMap::iterator itr = _terrainReductionStatsMap.begin();
+        itr != _terrainReductionStatsMap.end();
+        ++itr)
+    {
+        const TerrainReductionStats& stats = itr->second;
+        log(osg::NOTICE, "Terrain resolution reduction level %d : %d of %d tiles reduced, %.0f bytes saved (%.0f -> %.0f)",
+            itr->first, stats._numTilesReduced, stats._numTiles,
+            stats._originalSize-stats._reducedSize, stats._originalSize, stats._reducedSize);
+
+        totalOriginalSize += stats._originalSize;
+        totalReducedSize += stats._reducedSize;
+    }
+
+    log(osg::NOTICE, "Terrain resolution reduction total : %.0f bytes saved (%.0f -> %.0f)",
+        totalOriginalSize-totalReducedSize, totalOriginalSize, totalReducedSize);
+}
+
+static DataSet::ContentHash computeImageHash(const osg::Image& image)
+{
+    // two independent 64 bit FNV-1a hashes, seeded with the image layout so equal bytes in different layouts differ.
+    unsigned long long hash1 = 14695981039346656037ULL;
+    unsigned long long hash2 = 0x84222325cbf29ce4ULL;
+
+    unsigned int header[] = { image.s(), image.t(), image.r(), image.getPixelFormat(), image.getDataType(),
+                              (unsigned int)image.getInternalTextureFormat(), image.getNumMipmapLevels() };
+
+    const unsigned char* ptr = reinterpret_cast<const unsigned char*>(header);
+    const unsigned char* end = ptr + sizeof(header);
+    for(; ptr<end; ++ptr)
+    {
+        hash1 = (hash1 ^ *ptr) * 1099511628211ULL;
+        hash2 = (hash2 ^ *ptr) * 0x100000001b3ULL + 0x9e3779b97f4a7c15ULL;
+    }
+
+    ptr = image.data();
+    end = ptr + image.getTotalSizeInBytesIncludingMipmaps();
+    for(; ptr<end; ++ptr)
+    {
+        hash1 = (hash1 ^ *ptr) * 1099511628211ULL;
+        hash2 = (hash2 ^ *ptr) * 0x100000001b3ULL + 0x9e3779b97f4a7c15ULL;
+    }
+
+    return DataSet::ContentHash(hash1, hash2);
+}
+
+std::string DataSet::_deduplicateImage(const osg::Image& image, const std::string& directory, const std::string& imageFileName, unsigned int level)
+{
+    if (!image.data()) return std::string();
+
+    ContentHash hash = computeImageHash(image);
+    double size = double(image.getTotalSizeInBytesIncludingMipmaps());
+
+    std::string sharedFileName;
+    bool writeSharedCopy = false;
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_deduplicationMutex);
+
+        DeduplicationStats& stats = _deduplicationStatsMap[level];
+        ++stats._numImages;
+        stats._totalSize += size;
+
+        SharedImage& sharedImage = _sharedImageMap[hash];
+        if (sharedImage._count++ == 0)
+        {
+            // first sighting, an externally written image becomes the shared copy, an inline one stays inline.
+            sharedImage._filename = imageFileName;
+            return std::string();
+        }
+
+        ++stats._numImagesShared;
+        stats._sharedSize += size;
+
+        if (sharedImage._filename.empty())
+        {
+            std::ostringstream str;
+            str<<getDirectory()<<_tileBasename<<"_shared/"<<std::hex<<std::setfill('0')<<std::setw(16)<<hash.first<<std::setw(16)<<hash.second<<osgDB::getFileExtensionIncludingDot(image.getFileName());
+            sharedImage._filename = str.str();
+            writeSharedCopy = true;
+        }
+
+        sharedFileName = sharedImage._filename;
+    }
+
+    if (writeSharedCopy)
+    {
+        _writeSharedImageFile(image, sharedFileName);
+    }
+
+    std::string referenceFileName = directory.empty() ? sharedFileName : osgDB::getPathRelative(directory, sharedFileName);
+
+    if (writeSharedCopy && _archive.valid() && !getDisableWrites())
+    {
+        // check the reference resolves inside the archive the way a tile in directory will look it up.
+        std::string lookupFileName = directory.empty() ? referenceFileName : osgDB::concatPaths(directory, referenceFileName);
+        if (!_archive->fileExists(lookupFileName))
+        {
+            log(getAbortTaskOnError() ? osg::FATAL : osg::WARN, "Error: shared image %s can not be read back from the archive as %s", sharedFileName.c_str(), lookupFileName.c_str());
+        }
+    }
+
+    return referenceFileName;
+}
+
+void DataSet::_writeSharedImageFile(const osg::Image& image, const std::string& filename)
+{
+    if (getDisableWrites()) return;
+
+    // archives serialise their own writes, it's only files on disk that other tasks can race on.
+    if (_archive.valid())
+    {
+        _writeImageFile(const_cast<osg::Image&>(image), filename);
+        return;
+    }
+
+    std::string simpliedFileName = vpb::simplifyFileName(filename);
+
+    // the name is the hash of the contents, so an existing file already holds this image.
+    if (osgDB::fileExists(simpliedFileName)) return;
+
+    Metrics::instance()->count("vpb_images_written_total");
+
+    osg::NotifySeverity notifylevel = getAbortTaskOnError() ? osg::FATAL : osg::WARN;
+
+    if (!FilePathManager::instance()->checkWritePermissionAndEnsurePathAvailability(simpliedFileName))
+    {
+        log(notifylevel, "Error: do not have write permission to write out file %s",simpliedFileName.c_str());
+        return;
+    }
+
+    osgDB::ReaderWriter* rw = osgDB::Registry::instance()->getReaderWriterForExtension(osgDB::getLowerCaseFileExtension(simpliedFileName));
+    if (!rw)
+    {
+        log(notifylevel, "Error, write support for data type not available for image file %s",simpliedFileName.c_str());
+        return;
+    }
+
+    std::ostringstream out(std::ios::out | std::ios::binary);
+    osgDB::ReaderWriter::WriteResult result = rw->writeImage(image, out, createImageWriteOptions(simpliedFileName).get());
+    if (!result.success())
+    {
+        log(notifylevel, "Error, in writing image file %s",simpliedFileName.c_str());
+        return;
+    }
+
+    // write to a name unique to this host and process then rename it into place, so a task that produces the same
+    // image concurrently never sees a partially written file.
+    std::ostringstream tempFileName;
+    tempFileName<<simpliedFileName<<"."<<vpb::getLocalHostName()<<"."<<vpb::getProcessID()<<".tmp";
+
+    bool success = false;
+    {
+        std::string data = out.str();
+        std::ofstream fout(tempFileName.str().c_str(), std::ios::out | std::ios::binary);
+        fout.write(data.c_str(), data.size());
+        fout.close();
+        success = !fout.fail();
+    }
+
+    if (success)
+    {
+        success = rename(tempFileName.str().c_str(), simpliedFileName.c_str())==0;
+
+        // where rename won't replace an existing file, losing the race to another task still leaves the right image.
+        if (!success && osgDB::fileExists(simpliedFileName))
+        {
+            remove(tempFileName.str().c_str());
+            return;
+        }
+    }
+
+    if (!success)
+    {
+        remove(tempFileName.str().c_str());
+        log(notifylevel, "Error, in writing image file %s",simpliedFileName.c_str());
+        return;
+    }
+
+    bool fileExistedBeforeWrite = FilePathManager::instance()->registerFileWrite(simpliedFileName);
+    recordFileWritten(simpliedFileName, fileExistedBeforeWrite);
+}
+
+void DataSet::reportDeduplication()
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_deduplicationMutex);
+
+    if (_deduplicationStatsMap.empty()) return;
+
+    double totalSize = 0.0;
+    double sharedSize = 0.0;
+    for(DeduplicationStatsMap::iterator itr = _deduplicationStatsMap.begin();
+        itr != _deduplicationStatsMap.end();
+        ++itr)
+    {
+        const DeduplicationStats& stats = itr->second;
+        log(osg::NOTICE, "Output deduplication level %d : %d of %d images shared, dedup ratio %.3f, %.0f bytes saved",
+            itr->first, stats._numImagesShared, stats._numImages,
+            stats._totalSize>0.0 ? stats._totalSize/(stats._totalSize-stats._sharedSize) : 1.0,
+            stats._sharedSize);
+
+        totalSize += stats._totalSize;
+        sharedSize += stats._sharedSize;
+    }
+
+    log(osg::NOTICE, "Output deduplication total : dedup ratio %.3f, %.0f bytes saved (%.0f -> %.0f)",
+        totalSize>0.0 ? totalSize/(totalSize-sharedSize) : 1.0, sharedSize, totalSize, totalSize-sharedSize);
+}
+
 int DataSet::run()
 {
     if (!getLogFileName().empty() && !getBuildLog())
@@ -3168,6 +4838,7 @@ int DataSet::_run()
         {
             log(osg::NOTICE,"Starting %i read threads.",numReadThreads);
             _readThreadPool = new ThreadPool(numReadThreads, false);
+            _readThreadPool->setName("read");
             _readThreadPool->startThreads();
         }
 
@@ -3176,6 +4847,7 @@ int DataSet::_run()
         {
             log(osg::NOTICE,"Starting %i write threads.",numWriteThreads);
             _writeThreadPool = new ThreadPool(numWriteThreads, requiresGraphicsContextInWritingThread);
+            _writeThreadPool->setName("write");
             _writeThreadPool->startThreads();
 
             //requiresGraphicsContextInMainThread = false;
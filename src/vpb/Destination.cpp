@@ -16,6 +16,8 @@
 #include <vpb/Destination>
 #include <vpb/DataSet>
 #include <vpb/TextureUtils>
+#include <vpb/Profiler>
+#include <vpb/Metrics>
 
 #include <osg/Texture2D>
 #include <osg/ShapeDrawable>
@@ -25,6 +27,7 @@
 #include <osg/ImageUtils>
 #include <osg/PagedLOD>
 #include <osg/io_utils>
+#include <osg/Version>
 
 #include <osgDB/ReadFile>
 #include <osgDB/WriteFile>
@@ -32,6 +35,9 @@
 
 #include <osgUtil/SmoothingVisitor>
 #include <osgUtil/Simplifier>
+#include <osgUtil/MeshOptimizers>
+
+#include <algorithm>
 
 using namespace vpb;
 
@@ -84,7 +90,8 @@ DestinationTile::DestinationTile():
     _terrain_maxNumRows(1024),
     _terrain_maxSourceResolutionX(0.0f),
     _terrain_maxSourceResolutionY(0.0f),
-    _complete(false)
+    _complete(false),
+    _derivedFromChildren(false)
 {
     for(int i=0;i<NUMBER_OF_POSITIONS;++i)
     {
@@ -415,7 +422,7 @@ void DestinationTile::allocate()
                 
                 imageName += getImageOptions(layerNum)->getDestinationImageExtension();
 
-                _dataSet->log(osg::NOTICE,"imageName = %s",imageName.c_str());
+                _dataSet->log(osg::INFO,"imageName = %s",imageName.c_str());
 
                 imageData._imageDestination->_image->setFileName(imageName.c_str());
                 imageData._imageDestination->_image->setWriteHint(writeHint);
@@ -766,6 +773,8 @@ void DestinationTile::equalizeEdge(Position position)
     // don't need to equalize if already done.
     if (_equalized[position]) return;
 
+    Profiler::ScopedPhase phase("equalizeEdge");
+
     DestinationTile* tile2 = _neighbour[position];
     Position position2 = (Position)((position+4)%NUMBER_OF_POSITIONS);
 
@@ -1052,7 +1061,8 @@ void DestinationTile::optimizeResolution()
             }
         }
 
-        if (minHeight==maxHeight)
+        // when an error tolerance is set flat tiles are reduced by reduceResolution() after equalization.
+        if (minHeight==maxHeight && _dataSet->getTerrainErrorTolerance()<=0.0f)
         {
             log(osg::INFO,"******* We have a flat tile ******* ");
 
@@ -1082,6 +1092,184 @@ void DestinationTile::optimizeResolution()
     }
 }
 
+static inline float computeInterpolatedHeight(const std::vector<float>& heights, unsigned int numColumns, unsigned int numRows, float c, float r)
+{
+    unsigned int c0 = osg::minimum((unsigned int)c, numColumns-2);
+    unsigned int r0 = osg::minimum((unsigned int)r, numRows-2);
+    float dc = c-(float)c0;
+    float dr = r-(float)r0;
+
+    const float* row0 = &heights[r0*numColumns+c0];
+    const float* row1 = row0+numColumns;
+
+    return (row0[0]*(1.0f-dc) + row0[1]*dc)*(1.0f-dr) +
+           (row1[0]*(1.0f-dc) + row1[1]*dc)*dr;
+}
+
+static void resampleHeightDeltas(DestinationTile::HeightDeltaList& heightDeltas, unsigned int originalNum, unsigned int newNum, const osg::Vec2& scale)
+{
+    if (heightDeltas.empty()) return;
+
+    if (heightDeltas.size()==1)
+    {
+        // corner normal
+        heightDeltas[0].x() *= scale.x();
+        heightDeltas[0].y() *= scale.y();
+        return;
+    }
+
+    // edge lists miss out the corners so hold originalNum-2 entries.
+    if (heightDeltas.size()!=originalNum-2) return;
+
+    DestinationTile::HeightDeltaList newHeightDeltas;
+    newHeightDeltas.reserve(newNum-2);
+    float ratio = (float)(originalNum-1)/(float)(newNum-1);
+    for(unsigned int i=1; i<newNum-1; ++i)
+    {
+        unsigned int original_i = (unsigned int)floorf((float)i*ratio+0.5f);
+        original_i = osg::clampBetween(original_i, 1u, originalNum-2);
+
+        osg::Vec2 heightDelta = heightDeltas[original_i-1];
+        heightDelta.x() *= scale.x();
+        heightDelta.y() *= scale.y();
+        newHeightDeltas.push_back(heightDelta);
+    }
+
+    heightDeltas.swap(newHeightDeltas);
+}
+
+// return the smallest 2^k+1 that is at least num.
+static unsigned int computeNextPowerOfTwoPlusOne(unsigned int num)
+{
+    unsigned int powerOfTwo = 1;
+    while (powerOfTwo+1<num) powerOfTwo *= 2;
+    return powerOfTwo+1;
+}
+
+void DestinationTile::reduceResolution()
+{
+    float tolerance = _dataSet->getTerrainErrorTolerance();
+    if (tolerance<=0.0f || !_terrain.valid() || !_terrain->_heightField.valid()) return;
+
+    osg::HeightField* hf = _terrain->_heightField.get();
+
+    unsigned int numColumns = hf->getNumColumns();
+    unsigned int numRows = hf->getNumRows();
+    unsigned int originalSize = numColumns*numRows*sizeof(float);
+
+    if (numColumns<3 || numRows<3)
+    {
+        _dataSet->recordTerrainResolutionReduction(_level, originalSize, originalSize);
+        return;
+    }
+
+    // keep enough vertices to follow the curvature of the earth on large tiles.
+    unsigned int minimumColumns = 5;
+    unsigned int minimumRows = 5;
+    if (_dataSet->mapLatLongsToXYZ())
+    {
+        float longitude_range = (_extents.xMax()-_extents.xMin());
+        float latitude_range = (_extents.yMax()-_extents.yMin());
+
+        if (longitude_range>45.0) minimumColumns = (unsigned int)ceilf((float)minimumColumns*sqrtf(longitude_range/45.0));
+        if (latitude_range>45.0) minimumRows = (unsigned int)ceilf((float)minimumRows*sqrtf(latitude_range/45.0));
+
+        minimumColumns = computeNextPowerOfTwoPlusOne(minimumColumns);
+        minimumRows = computeNextPowerOfTwoPlusOne(minimumRows);
+    }
+
+    std::vector<float> originalHeights(numColumns*numRows);
+    for(unsigned int r=0;r<numRows;++r)
+    {
+        for(unsigned int c=0;c<numColumns;++c)
+        {
+            originalHeights[r*numColumns+c] = hf->getHeight(c,r);
+        }
+    }
+
+    // try successively finer grids of 2^n+1 samples, so that the reduced edge vertices remain
+    // a subset of the neighbouring tiles' edge vertices, and accept the first that is within tolerance.
+    std::vector<float> reducedHeights;
+    unsigned int reducedColumns = numColumns;
+    unsigned int reducedRows = numRows;
+    for(unsigned int n=2; ; n*=2)
+    {
+        unsigned int newColumns = osg::minimum(osg::maximum(n+1, minimumColumns), numColumns);
+        unsigned int newRows = osg::minimum(osg::maximum(n+1, minimumRows), numRows);
+        if (newColumns==numColumns && newRows==numRows) break;
+
+        // the reduced samples only line up with the original ones when the new grid divides the original exactly,
+        // and no finer 2^n+1 grid will divide it if this one doesn't.
+        if ((numColumns-1)%(newColumns-1)!=0 || (numRows-1)%(newRows-1)!=0) break;
+
+        float columnRatio = (float)(numColumns-1)/(float)(newColumns-1);
+        float rowRatio = (float)(numRows-1)/(float)(newRows-1);
+
+        std::vector<float> heights(newColumns*newRows);
+        for(unsigned int r=0;r<newRows;++r)
+        {
+            for(unsigned int c=0;c<newColumns;++c)
+            {
+                heights[r*newColumns+c] = computeInterpolatedHeight(originalHeights, numColumns, numRows, (float)c*columnRatio, (float)r*rowRatio);
+            }
+        }
+
+        float maxError = 0.0f;
+        for(unsigned int r=0;r<numRows && maxError<=tolerance;++r)
+        {
+            for(unsigned int c=0;c<numColumns;++c)
+            {
+                float h = computeInterpolatedHeight(heights, newColumns, newRows, (float)c/columnRatio, (float)r/rowRatio);
+                float error = fabsf(h-originalHeights[r*numColumns+c]);
+                if (error>maxError) maxError = error;
+            }
+        }
+
+        if (maxError<=tolerance)
+        {
+            reducedHeights.swap(heights);
+            reducedColumns = newColumns;
+            reducedRows = newRows;
+            break;
+        }
+    }
+
+    if (reducedHeights.empty())
+    {
+        _dataSet->recordTerrainResolutionReduction(_level, originalSize, originalSize);
+        return;
+    }
+
+    log(osg::INFO,"DestinationTile::reduceResolution() level %d reduced from %d x %d to %d x %d",_level,numColumns,numRows,reducedColumns,reducedRows);
+
+    float xInterval = hf->getXInterval()*(float)(numColumns-1)/(float)(reducedColumns-1);
+    float yInterval = hf->getYInterval()*(float)(numRows-1)/(float)(reducedRows-1);
+
+    hf->allocate(reducedColumns,reducedRows);
+    hf->setXInterval(xInterval);
+    hf->setYInterval(yInterval);
+    for(unsigned int r=0;r<reducedRows;++r)
+    {
+        for(unsigned int c=0;c<reducedColumns;++c)
+        {
+            hf->setHeight(c,r,reducedHeights[r*reducedColumns+c]);
+        }
+    }
+
+    // height deltas are per sample so need rescaling to the new sample spacing.
+    osg::Vec2 scale((float)(numColumns-1)/(float)(reducedColumns-1), (float)(numRows-1)/(float)(reducedRows-1));
+    for(unsigned int position=0; position<NUMBER_OF_POSITIONS; ++position)
+    {
+        bool alongRows = (position==LEFT || position==RIGHT);
+        resampleHeightDeltas(_heightDeltas[position],
+                             alongRows ? numRows : numColumns,
+                             alongRows ? reducedRows : reducedColumns,
+                             scale);
+    }
+
+    _dataSet->recordTerrainResolutionReduction(_level, originalSize, reducedColumns*reducedRows*sizeof(float));
+}
+
 void DestinationTile::addNodeToScene(osg::Node* node, bool transformIfRequired)
 {
     if (!_createdScene) _createdScene = new osg::Group;
@@ -1108,8 +1296,12 @@ void DestinationTile::addNodeToScene(osg::Node* node, bool transformIfRequired)
 
 osg::Node* DestinationTile::createScene()
 {
+    Profiler::ScopedPhase phase("createScene");
+
     if (_createdScene.valid()) return _createdScene.get();
 
+    reduceResolution();
+
     if (_dataSet->getGeometryType()==DataSet::HEIGHT_FIELD)
     {
         _createdScene = createHeightField();
@@ -1127,12 +1319,7 @@ osg::Node* DestinationTile::createScene()
     {
         if (_dataSet->getModelPlacer())
         {
-            for(ModelList::iterator itr = _models->_models.begin();
-                itr != _models->_models.end();
-                ++itr)
-            {
-                _dataSet->getModelPlacer()->place(*this, itr->get());
-            }
+            _dataSet->getModelPlacer()->placeModels(*this, _models->_models);
         }
         else
         {
@@ -1832,6 +2019,8 @@ static inline osg::Vec3 computeLocalSkirtVector(const osg::EllipsoidModel* et, c
 
 osg::Node* DestinationTile::createPolygonal()
 {
+    Profiler::ScopedPhase phase("createPolygonal");
+
     log(osg::INFO,"--------- DestinationTile::createDrawableGeometry() ------------- ");
 
     const osg::EllipsoidModel* et = _dataSet->getEllipsoidModel();
@@ -2310,17 +2499,16 @@ osg::Node* DestinationTile::createPolygonal()
 
     if (numVerticesInSkirt>0)
     {
-        osg::DrawElementsUInt& skirtDrawElements = *(new osg::DrawElementsUInt(GL_QUAD_STRIP,2*numVerticesInSkirt+2));
-        geometry->addPrimitiveSet(&skirtDrawElements);
-        int ei=0;
+        std::vector<unsigned int> skirtStrip;
+        skirtStrip.reserve(2*numVerticesInSkirt+2);
         int firstSkirtVertexIndex = vi;
         // create bottom skirt vertices
         r=0;
         for(c=0;c<numColumns-1;++c)
         {
             // assign indices to primitive set
-            skirtDrawElements[ei++] = (r)*numColumns+c;
-            skirtDrawElements[ei++] = vi;
+            skirtStrip.push_back((r)*numColumns+c);
+            skirtStrip.push_back(vi);
             
             // mark these points as protected to prevent them from being removed during simplification
             pointsToProtectDuringSimplification.push_back((r)*numColumns+c);
@@ -2340,8 +2528,8 @@ osg::Node* DestinationTile::createPolygonal()
         for(r=0;r<numRows-1;++r)
         {
             // assign indices to primitive set
-            skirtDrawElements[ei++] = (r)*numColumns+c;
-            skirtDrawElements[ei++] = vi;
+            skirtStrip.push_back((r)*numColumns+c);
+            skirtStrip.push_back(vi);
             
             // mark these points as protected to prevent them from being removed during simplification
             pointsToProtectDuringSimplification.push_back((r)*numColumns+c);
@@ -2361,8 +2549,8 @@ osg::Node* DestinationTile::createPolygonal()
         for(c=numColumns-1;c>0;--c)
         {
             // assign indices to primitive set
-            skirtDrawElements[ei++] = (r)*numColumns+c;
-            skirtDrawElements[ei++] = vi;
+            skirtStrip.push_back((r)*numColumns+c);
+            skirtStrip.push_back(vi);
             
             // mark these points as protected to prevent them from being removed during simplification
             pointsToProtectDuringSimplification.push_back((r)*numColumns+c);
@@ -2382,8 +2570,8 @@ osg::Node* DestinationTile::createPolygonal()
         for(r=numRows-1;r>0;--r)
         {
             // assign indices to primitive set
-            skirtDrawElements[ei++] = (r)*numColumns+c;
-            skirtDrawElements[ei++] = vi;
+            skirtStrip.push_back((r)*numColumns+c);
+            skirtStrip.push_back(vi);
             
             // mark these points as protected to prevent them from being removed during simplification
             pointsToProtectDuringSimplification.push_back((r)*numColumns+c);
@@ -2398,8 +2586,29 @@ osg::Node* DestinationTile::createPolygonal()
             if (n.valid()) (*n)[vi] = (*n)[(r)*numColumns+c];
             t[vi++] = t[(r)*numColumns+c];
         }
-        skirtDrawElements[ei++] = 0;
-        skirtDrawElements[ei++] = firstSkirtVertexIndex;
+        skirtStrip.push_back(0);
+        skirtStrip.push_back(firstSkirtVertexIndex);
+
+        // convert the top/bottom pairs of the skirt strip into a triangle list.
+        unsigned int numQuads = skirtStrip.size()/2-1;
+        osg::DrawElementsUInt& skirtDrawElements = *(new osg::DrawElementsUInt(GL_TRIANGLES,numQuads*6));
+        geometry->addPrimitiveSet(&skirtDrawElements);
+        int ei=0;
+        for(unsigned int q=0; q<numQuads; ++q)
+        {
+            unsigned int top0 = skirtStrip[q*2];
+            unsigned int bottom0 = skirtStrip[q*2+1];
+            unsigned int top1 = skirtStrip[q*2+2];
+            unsigned int bottom1 = skirtStrip[q*2+3];
+
+            skirtDrawElements[ei++] = top0;
+            skirtDrawElements[ei++] = bottom0;
+            skirtDrawElements[ei++] = bottom1;
+
+            skirtDrawElements[ei++] = top0;
+            skirtDrawElements[ei++] = bottom1;
+            skirtDrawElements[ei++] = top1;
+        }
     }
 
     if (n.valid())
@@ -2447,6 +2656,17 @@ osg::Node* DestinationTile::createPolygonal()
         simplifier.simplify(*geometry, pointsToProtectDuringSimplification);  // this will replace the normal vector with a new one
     }
 
+    if (_dataSet->getOptimizeVertexCache())
+    {
+        optimizeVertexCache(*geometry);
+    }
+
+    if (_dataSet->getGeometryType()==DataSet::QUANTIZED_POLYGONAL)
+    {
+        // texture coordinates are linear in x,y only when we aren't mapping lat/longs onto the ellipsoid.
+        quantizeGeometry(*geometry, !mapLatLongsToXYZ);
+    }
+
     if (useLocalToTileTransform)
     {
         osg::MatrixTransform* mt = new osg::MatrixTransform;
@@ -2471,12 +2691,186 @@ osg::Node* DestinationTile::createPolygonal()
     }
 }
 
+void DestinationTile::optimizeVertexCache(osg::Geometry& geometry)
+{
+    if (!geometry.getVertexArray()) return;
+
+    osgUtil::VertexCacheMissVisitor missesBefore;
+    missesBefore.doGeometry(geometry);
+
+    // merges the body and skirt into a single triangle list ordered for the post transform vertex cache.
+    osgUtil::VertexCacheVisitor vertexCacheVisitor;
+    vertexCacheVisitor.optimizeVertices(geometry);
+
+    // use the smallest index type that can address all the vertices.
+    unsigned int numVertices = geometry.getVertexArray()->getNumElements();
+    for(unsigned int i=0; i<geometry.getNumPrimitiveSets(); ++i)
+    {
+        osg::DrawElementsUInt* elements = dynamic_cast<osg::DrawElementsUInt*>(geometry.getPrimitiveSet(i));
+        if (!elements) continue;
+
+        osg::ref_ptr<osg::DrawElements> smallestElements;
+        if (numVertices<=256) smallestElements = new osg::DrawElementsUByte(elements->getMode(), elements->begin(), elements->end());
+        else if (numVertices<=65536) smallestElements = new osg::DrawElementsUShort(elements->getMode(), elements->begin(), elements->end());
+        else smallestElements = elements;
+
+        // simplified tiles are never identical so there is nothing to gain from looking for a match.
+        if (!_dataSet->getSimplifyTerrain())
+        {
+            smallestElements = _dataSet->getSharedIndexBuffer(smallestElements.get());
+        }
+
+        geometry.setPrimitiveSet(i, smallestElements.get());
+    }
+
+    osgUtil::VertexCacheMissVisitor missesAfter;
+    missesAfter.doGeometry(geometry);
+
+    if (missesBefore.triangles>0)
+    {
+        log(osg::INFO,"DestinationTile::optimizeVertexCache() %d triangles, ACMR before %f, after %f",
+            missesBefore.triangles,
+            (float)missesBefore.misses/(float)missesBefore.triangles,
+            (float)missesAfter.misses/(float)missesBefore.triangles);
+    }
+
+    _dataSet->recordVertexCacheOptimization(missesBefore.triangles, missesBefore.misses, missesAfter.misses);
+}
+
+static inline short quantizeToShort(float value)
+{
+    return static_cast<short>(osg::round(osg::clampBetween(value,-1.0f,1.0f)*32767.0f));
+}
+
+static inline osg::Vec2s encodeOctahedralNormal(const osg::Vec3& normal)
+{
+    float l1 = fabsf(normal.x())+fabsf(normal.y())+fabsf(normal.z());
+    if (l1==0.0f) return osg::Vec2s(0,0);
+
+    float u = normal.x()/l1;
+    float v = normal.y()/l1;
+    if (normal.z()<0.0f)
+    {
+        // fold the lower hemisphere over the diagonals of the octahedron.
+        float folded_u = (1.0f-fabsf(v)) * (u>=0.0f ? 1.0f : -1.0f);
+        float folded_v = (1.0f-fabsf(u)) * (v>=0.0f ? 1.0f : -1.0f);
+        u = folded_u;
+        v = folded_v;
+    }
+
+    return osg::Vec2s(quantizeToShort(u), quantizeToShort(v));
+}
+
+static void setNormalizedVertexAttribArray(osg::Geometry& geometry, unsigned int index, osg::Array* array)
+{
+#if OSG_MIN_VERSION_REQUIRED(3,1,8)
+    array->setNormalize(true);
+    array->setBinding(osg::Array::BIND_PER_VERTEX);
+    geometry.setVertexAttribArray(index, array);
+#else
+    geometry.setVertexAttribArray(index, array);
+    geometry.setVertexAttribBinding(index, osg::Geometry::BIND_PER_VERTEX);
+    geometry.setVertexAttribNormalize(index, GL_TRUE);
+#endif
+}
+
+void DestinationTile::quantizeGeometry(osg::Geometry& geometry, bool implicitTexCoords)
+{
+    osg::Vec3Array* vertices = dynamic_cast<osg::Vec3Array*>(geometry.getVertexArray());
+    if (!vertices || vertices->empty()) return;
+
+    unsigned int numVertices = vertices->size();
+
+    osg::BoundingBox bb;
+    for(osg::Vec3Array::iterator itr = vertices->begin();
+        itr != vertices->end();
+        ++itr)
+    {
+        bb.expandBy(*itr);
+    }
+
+    osg::Vec3 center = bb.center();
+    osg::Vec3 halfExtents = (bb._max-bb._min)*0.5f;
+    for(unsigned int i=0;i<3;++i)
+    {
+        if (halfExtents[i]<=0.0f) halfExtents[i] = 1.0f;
+    }
+
+    // positions as signed shorts relative to the tile bounds, passed as gl_Vertex.
+    osg::ref_ptr<osg::Vec3sArray> positions = new osg::Vec3sArray(numVertices);
+    for(unsigned int i=0;i<numVertices;++i)
+    {
+        const osg::Vec3& v = (*vertices)[i];
+        (*positions)[i].set(quantizeToShort((v.x()-center.x())/halfExtents.x()),
+                            quantizeToShort((v.y()-center.y())/halfExtents.y()),
+                            quantizeToShort((v.z()-center.z())/halfExtents.z()));
+    }
+
+    osg::Vec3Array* normals = dynamic_cast<osg::Vec3Array*>(geometry.getNormalArray());
+    osg::ref_ptr<osg::Vec2sArray> octNormals;
+    if (normals && normals->size()==numVertices)
+    {
+        octNormals = new osg::Vec2sArray(numVertices);
+        for(unsigned int i=0;i<numVertices;++i)
+        {
+            (*octNormals)[i] = encodeOctahedralNormal((*normals)[i]);
+        }
+    }
+
+    osg::Vec2Array* texcoords = dynamic_cast<osg::Vec2Array*>(geometry.getTexCoordArray(0));
+    osg::ref_ptr<osg::Vec2usArray> quantizedTexCoords;
+    if (!implicitTexCoords && texcoords && texcoords->size()==numVertices)
+    {
+        quantizedTexCoords = new osg::Vec2usArray(numVertices);
+        for(unsigned int i=0;i<numVertices;++i)
+        {
+            const osg::Vec2& t = (*texcoords)[i];
+            (*quantizedTexCoords)[i].set(static_cast<unsigned short>(osg::round(osg::clampBetween(t.x(),0.0f,1.0f)*65535.0f)),
+                                         static_cast<unsigned short>(osg::round(osg::clampBetween(t.y(),0.0f,1.0f)*65535.0f)));
+        }
+    }
+
+    log(osg::INFO,"DestinationTile::quantizeGeometry() %d vertices, %d bytes reduced to %d bytes", numVertices,
+        numVertices*(sizeof(osg::Vec3)+(normals?sizeof(osg::Vec3):0)+(texcoords?sizeof(osg::Vec2):0)),
+        numVertices*(sizeof(osg::Vec3s)+(octNormals.valid()?sizeof(osg::Vec2s):0)+(quantizedTexCoords.valid()?sizeof(osg::Vec2us):0)));
+
+    geometry.setVertexArray(positions.get());
+    geometry.setNormalArray(0);
+    for(unsigned int unit=0; unit<geometry.getNumTexCoordArrays(); ++unit)
+    {
+        geometry.setTexCoordArray(unit, 0);
+    }
+
+    if (octNormals.valid()) setNormalizedVertexAttribArray(geometry, DataSet::QUANTIZED_NORMAL_ATTRIBUTE, octNormals.get());
+    if (quantizedTexCoords.valid()) setNormalizedVertexAttribArray(geometry, DataSet::QUANTIZED_TEXCOORD_ATTRIBUTE, quantizedTexCoords.get());
+
+    // the bound can't be computed from short vertices so provide it directly.
+    geometry.setInitialBound(bb);
+
+    osg::StateSet* stateset = geometry.getOrCreateStateSet();
+    stateset->setAttributeAndModes(_dataSet->getQuantizedGeometryProgram(implicitTexCoords), osg::StateAttribute::ON);
+    stateset->addUniform(new osg::Uniform("vpb_positionOffset", center));
+    stateset->addUniform(new osg::Uniform("vpb_positionScale", osg::Vec3(halfExtents.x()/32767.0f, halfExtents.y()/32767.0f, halfExtents.z()/32767.0f)));
+    if (implicitTexCoords)
+    {
+        float sx = (bb.xMax()>bb.xMin()) ? 1.0f/(bb.xMax()-bb.xMin()) : 1.0f;
+        float sy = (bb.yMax()>bb.yMin()) ? 1.0f/(bb.yMax()-bb.yMin()) : 1.0f;
+        stateset->addUniform(new osg::Uniform("vpb_texCoordTransform", osg::Vec4(sx, sy, -bb.xMin()*sx, -bb.yMin()*sy)));
+    }
+}
+
 void DestinationTile::readFrom(Source* source)
 {
+    Profiler::ScopedPhase phase("composite");
+
     bool optionalLayerSet = _dataSet->isOptionalLayerSet(source->getSetName());
-    log(osg::NOTICE,"DestinationTile::readFrom(SetName=%s, FileName=%s)",source->getSetName().c_str(), source->getFileName().c_str());
+    log(osg::INFO,"DestinationTile::readFrom(SetName=%s, FileName=%s)",source->getSetName().c_str(), source->getFileName().c_str());
     if (optionalLayerSet) log(osg::NOTICE,"  is an optional layer set");
 
+    // imagery and height fields have already been filtered down from the children.
+    if (_derivedFromChildren && source &&
+        (source->getType()==Source::IMAGE || source->getType()==Source::HEIGHT_FIELD)) return;
+
     if (source && 
         source->intersects(*this) &&
         _level>=source->getMinLevel() && _level<=source->getMaxLevel() && 
@@ -2586,10 +2980,14 @@ void DestinationTile::readFrom(Source* source)
 
 void DestinationTile::readFrom(CompositeSource* sourceGraph)
 {
+    Profiler::ScopedPhase phase("readFrom");
+
+    Metrics::instance()->count("vpb_tiles_read_total");
+
     if (sourceGraph)
     {
 
-        allocate();
+        if (!_derivedFromChildren) allocate();
 
         unsigned int numChecked = 0;
         for(CompositeSource::source_iterator itr(sourceGraph);itr.valid();++itr)
@@ -2611,7 +3009,7 @@ void DestinationTile::readFrom(CompositeSource* sourceGraph)
 
 void DestinationTile::readFrom()
 {
-    allocate();
+    if (!_derivedFromChildren) allocate();
 
     log(osg::INFO,"DestinationTile::readFrom() %i",_sources.size());
     for(Sources::iterator itr = _sources.begin();
@@ -2627,6 +3025,155 @@ void DestinationTile::readFrom()
 
 
 
+template<typename T>
+static void downsampleImageData(const osg::Image& source, const GeospatialExtents& sourceExtents,
+                         osg::Image& destination, const GeospatialExtents& destinationExtents)
+{
+    unsigned int numComponents = osg::Image::computeNumComponents(destination.getPixelFormat());
+
+    double destination_dx = (destinationExtents.xMax()-destinationExtents.xMin())/(double)destination.s();
+    double destination_dy = (destinationExtents.yMax()-destinationExtents.yMin())/(double)destination.t();
+    double source_dx = (sourceExtents.xMax()-sourceExtents.xMin())/(double)source.s();
+    double source_dy = (sourceExtents.yMax()-sourceExtents.yMin())/(double)source.t();
+
+    // destination pixels whose centres lie within the source extents.
+    int s_begin = osg::maximum((int)ceil((sourceExtents.xMin()-destinationExtents.xMin())/destination_dx-0.5), 0);
+    int s_end = osg::minimum((int)ceil((sourceExtents.xMax()-destinationExtents.xMin())/destination_dx-0.5), destination.s());
+    int t_begin = osg::maximum((int)ceil((sourceExtents.yMin()-destinationExtents.yMin())/destination_dy-0.5), 0);
+    int t_end = osg::minimum((int)ceil((sourceExtents.yMax()-destinationExtents.yMin())/destination_dy-0.5), destination.t());
+
+    std::vector<double> sum(numComponents);
+    for(int t=t_begin; t<t_end; ++t)
+    {
+        // box filter over the source pixels within the destination pixel's footprint.
+        double y0 = destinationExtents.yMin() + destination_dy*(double)t - sourceExtents.yMin();
+        int j_begin = osg::clampBetween((int)floor(y0/source_dy), 0, source.t()-1);
+        int j_end = osg::clampBetween((int)ceil((y0+destination_dy)/source_dy), j_begin+1, source.t());
+
+        for(int s=s_begin; s<s_end; ++s)
+        {
+            double x0 = destinationExtents.xMin() + destination_dx*(double)s - sourceExtents.xMin();
+            int i_begin = osg::clampBetween((int)floor(x0/source_dx), 0, source.s()-1);
+            int i_end = osg::clampBetween((int)ceil((x0+destination_dx)/source_dx), i_begin+1, source.s());
+
+            std::fill(sum.begin(), sum.end(), 0.0);
+            for(int j=j_begin; j<j_end; ++j)
+            {
+                for(int i=i_begin; i<i_end; ++i)
+                {
+                    const T* pixel = reinterpret_cast<const T*>(source.data(i,j));
+                    for(unsigned int c=0; c<numComponents; ++c) sum[c] += (double)pixel[c];
+                }
+            }
+
+            double numPixels = (double)((j_end-j_begin)*(i_end-i_begin));
+            T* pixel = reinterpret_cast<T*>(destination.data(s,t));
+            for(unsigned int c=0; c<numComponents; ++c) pixel[c] = (T)(sum[c]/numPixels);
+        }
+    }
+}
+
+void DestinationTile::downsampleFrom(DestinationTile* child)
+{
+    if (!child) return;
+
+    if (!_derivedFromChildren)
+    {
+        allocate();
+        _derivedFromChildren = true;
+    }
+
+    // height fields are bilinearly interpolated from the child's samples. Where the parent's samples coincide with the
+    // child's, as they do along the shared edges already equalized at the finer level, this returns the child's heights.
+    if (_terrain.valid() && _terrain->_heightField.valid() &&
+        child->_terrain.valid() && child->_terrain->_heightField.valid())
+    {
+        osg::HeightField* hf = _terrain->_heightField.get();
+        osg::HeightField* child_hf = child->_terrain->_heightField.get();
+
+        unsigned int child_numColumns = child_hf->getNumColumns();
+        unsigned int child_numRows = child_hf->getNumRows();
+
+        std::vector<float> childHeights(child_numColumns*child_numRows);
+        for(unsigned int r=0;r<child_numRows;++r)
+        {
+            for(unsigned int c=0;c<child_numColumns;++c)
+            {
+                childHeights[r*child_numColumns+c] = child_hf->getHeight(c,r);
+            }
+        }
+
+        double child_xMin = child_hf->getOrigin().x();
+        double child_yMin = child_hf->getOrigin().y();
+        double child_xMax = child_xMin + child_hf->getXInterval()*(double)(child_numColumns-1);
+        double child_yMax = child_yMin + child_hf->getYInterval()*(double)(child_numRows-1);
+        double epsilon = 1e-6*osg::maximum(child_xMax-child_xMin, child_yMax-child_yMin);
+
+        for(unsigned int r=0;r<hf->getNumRows();++r)
+        {
+            double y = hf->getOrigin().y() + hf->getYInterval()*(double)r;
+            if (y<child_yMin-epsilon || y>child_yMax+epsilon) continue;
+
+            for(unsigned int c=0;c<hf->getNumColumns();++c)
+            {
+                double x = hf->getOrigin().x() + hf->getXInterval()*(double)c;
+                if (x<child_xMin-epsilon || x>child_xMax+epsilon) continue;
+
+                float fc = osg::clampBetween((float)((x-child_xMin)/child_hf->getXInterval()), 0.0f, (float)(child_numColumns-1));
+                float fr = osg::clampBetween((float)((y-child_yMin)/child_hf->getYInterval()), 0.0f, (float)(child_numRows-1));
+
+                if (child_numColumns>1 && child_numRows>1)
+                {
+                    hf->setHeight(c,r,computeInterpolatedHeight(childHeights, child_numColumns, child_numRows, fc, fr));
+                }
+                else
+                {
+                    hf->setHeight(c,r,childHeights[(unsigned int)fr*child_numColumns+(unsigned int)fc]);
+                }
+            }
+        }
+    }
+
+    // imagery is box filtered.
+    for(unsigned int layerNum=0;
+        layerNum<getNumLayers() && layerNum<child->getNumLayers();
+        ++layerNum)
+    {
+        ImageSet& imageSet = getImageSet(layerNum);
+        ImageSet& childImageSet = child->getImageSet(layerNum);
+        for(ImageSet::LayerSetImageDataMap::iterator itr = imageSet._layerSetImageDataMap.begin();
+            itr != imageSet._layerSetImageDataMap.end();
+            ++itr)
+        {
+            ImageSet::LayerSetImageDataMap::iterator citr = childImageSet._layerSetImageDataMap.find(itr->first);
+            if (citr == childImageSet._layerSetImageDataMap.end()) continue;
+
+            DestinationData* destination = itr->second._imageDestination.get();
+            DestinationData* source = citr->second._imageDestination.get();
+            if (!destination || !destination->_image || !source || !source->_image) continue;
+
+            osg::Image* image = destination->_image.get();
+            osg::Image* childImage = source->_image.get();
+            if (image->getPixelFormat()!=childImage->getPixelFormat() ||
+                image->getDataType()!=childImage->getDataType())
+            {
+                log(osg::NOTICE,"DestinationTile::downsampleFrom() image formats of level %d and %d do not match, skipping layer %d",_level,child->_level,layerNum);
+                continue;
+            }
+
+            switch(image->getDataType())
+            {
+                case(GL_UNSIGNED_BYTE): downsampleImageData<unsigned char>(*childImage, child->_extents, *image, _extents); break;
+                case(GL_UNSIGNED_SHORT): downsampleImageData<unsigned short>(*childImage, child->_extents, *image, _extents); break;
+                case(GL_FLOAT): downsampleImageData<float>(*childImage, child->_extents, *image, _extents); break;
+                default:
+                    log(osg::NOTICE,"DestinationTile::downsampleFrom() image data type not supported, skipping layer %d",layerNum);
+                    break;
+            }
+        }
+    }
+}
+
 void DestinationTile::unrefData()
 {
     _imageLayerSet.clear();
@@ -3398,6 +3945,24 @@ void CompositeDestination::unrefLocalData()
     }
 }
 
+bool CompositeDestination::childrenCoverExtents()
+{
+    if (_children.empty()) return false;
+
+    double area = (_extents.xMax()-_extents.xMin())*(_extents.yMax()-_extents.yMin());
+    double childrenArea = 0.0;
+    for(ChildList::iterator citr=_children.begin();
+        citr!=_children.end();
+        ++citr)
+    {
+        const GeospatialExtents& extents = (*citr)->_extents;
+        if ((*citr)->_tiles.empty()) continue;
+        childrenArea += (extents.xMax()-extents.xMin())*(extents.yMax()-extents.yMin());
+    }
+
+    return childrenArea >= area*0.999;
+}
+
 DestinationTile::Sources CompositeDestination::getAllContributingSources()
 {
     typedef std::set<Source*> SourceSet;
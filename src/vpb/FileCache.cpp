@@ -15,15 +15,20 @@
 #include <vpb/System>
 #include <vpb/BuildLog>
 #include <vpb/DataSet>
+#include <vpb/ThreadPool>
+#include <vpb/FileUtils>
 
 #include <osg/io_utils>
 #include <osgDB/FileNameUtils>
 
+#include <sstream>
+
 using namespace vpb;
 
 FileCache::FileCache()
 {
     _requiresWrite = false;
+    _numCopyThreads = 4;
 }
 
 
@@ -31,6 +36,7 @@ FileCache::FileCache(const FileCache& fc,const osg::CopyOp& copyop):
     osg::Object(fc, copyop)
 {
     _requiresWrite = false;
+    _numCopyThreads = fc._numCopyThreads;
 }
 
 FileCache::~FileCache()
@@ -168,16 +174,39 @@ bool FileCache::open(const std::string& filename)
     return read(foundFile);
 }
 
+bool FileCache::sync()
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_writeMutex);
+
+    if (!_requiresWrite) return false;
+
+    return writeImplementation(_filename);
+}
+
 bool FileCache::write(const std::string& filename)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_writeMutex);
+
+    return writeImplementation(filename);
+}
+
+bool FileCache::writeImplementation(const std::string& filename)
 {
     log(osg::NOTICE,"FileCache::write(%s)",filename.c_str());
 
     OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_variantMapMutex);
 
-    _filename = filename;
-    _requiresWrite = false;
+    // write to a temporary file alongside the cache and rename it into place, so that a build reading the cache
+    // never sees it half written.
+    std::ostringstream tempFileName;
+    tempFileName<<filename<<"."<<vpb::getLocalHostName()<<"."<<vpb::getProcessID()<<".tmp";
 
-    osgDB::Output fout(filename.c_str());
+    osgDB::Output fout(tempFileName.str().c_str());
+    if (!fout)
+    {
+        log(osg::NOTICE,"Error: unable to open '%s' to write the file cache.",tempFileName.str().c_str());
+        return false;
+    }
 
     fout.precision(15);
 
@@ -244,7 +273,27 @@ bool FileCache::write(const std::string& filename)
         }
     }
 
-    return false;
+    fout.close();
+
+    bool success = !fout.fail();
+    if (success && rename(tempFileName.str().c_str(), filename.c_str())!=0)
+    {
+        // platforms that won't rename over an existing file need it removed first.
+        remove(filename.c_str());
+        success = rename(tempFileName.str().c_str(), filename.c_str())==0;
+    }
+
+    if (!success)
+    {
+        log(osg::NOTICE,"Error: unable to write the file cache '%s'.",filename.c_str());
+        remove(tempFileName.str().c_str());
+        return false;
+    }
+
+    _filename = filename;
+    _requiresWrite = false;
+
+    return true;
 }
 
 void FileCache::addFileDetails(FileDetails* fd)
@@ -639,6 +688,26 @@ void FileCache::buildOverviews(osgTerrain::TerrainTile* source)
 
 }
 
+class CopyFileOperation : public BuildOperation
+{
+    public:
+
+        CopyFileOperation(ThreadPool* threadPool, FileCache* fileCache, FileDetails* fd, Machine* machine):
+            BuildOperation(threadPool, 0, "CopyFileOperation", false),
+            _fileCache(fileCache),
+            _fd(fd),
+            _machine(machine) {}
+
+        virtual void build()
+        {
+            _fileCache->copyFileToMachine(_fd.get(), _machine.get());
+        }
+
+        FileCache*                  _fileCache;
+        osg::ref_ptr<FileDetails>   _fd;
+        osg::ref_ptr<Machine>       _machine;
+};
+
 void FileCache::mirror(Machine* machine, osgTerrain::TerrainTile* source)
 {
     log(osg::NOTICE,"FileCache::mirror(%s)",machine->getHostName().c_str());
@@ -665,6 +734,9 @@ void FileCache::mirror(Machine* machine, osgTerrain::TerrainTile* source)
     std::string localHostName = getLocalHostName();
     osg::CoordinateSystemNode* csn = dataset->getIntermediateCoordinateSystem();
 
+    typedef std::vector< osg::ref_ptr<FileDetails> > FileDetailsToCopy;
+    FileDetailsToCopy filesToCopy;
+
     for(CompositeSource::source_iterator itr(dataset->getSourceGraph());itr.valid();++itr)
     {
         Source* source = itr->get();
@@ -709,11 +781,11 @@ void FileCache::mirror(Machine* machine, osgTerrain::TerrainTile* source)
             }
             else if (fileOnLocalMachine)
             {
-                copyFileToMachine(fileOnLocalMachine, machine);
+                filesToCopy.push_back(fileOnLocalMachine);
             }
             else if (!fileDetailsWithRequiredCoordinateSystem.empty())
             {
-                copyFileToMachine(fileDetailsWithRequiredCoordinateSystem.front(), machine);
+                filesToCopy.push_back(fileDetailsWithRequiredCoordinateSystem.front());
             }
             else
             {
@@ -724,30 +796,71 @@ void FileCache::mirror(Machine* machine, osgTerrain::TerrainTile* source)
 
     }
 
+    if (filesToCopy.empty()) return;
+
+    if (_numCopyThreads<=1 || filesToCopy.size()==1)
+    {
+        for(FileDetailsToCopy::iterator itr = filesToCopy.begin();
+            itr != filesToCopy.end();
+            ++itr)
+        {
+            copyFileToMachine(itr->get(), machine);
+        }
+        return;
+    }
+
+    // copies are bound by disk and network rather than cpu, so keep several going at once.
+    osg::ref_ptr<ThreadPool> threadPool = new ThreadPool(osg::minimum(_numCopyThreads, static_cast<unsigned int>(filesToCopy.size())), false);
+    threadPool->setName("copy");
+    threadPool->startThreads();
+
+    for(FileDetailsToCopy::iterator itr = filesToCopy.begin();
+        itr != filesToCopy.end();
+        ++itr)
+    {
+        threadPool->run(new CopyFileOperation(threadPool.get(), this, itr->get(), machine));
+    }
+
+    threadPool->waitForCompletion();
+    threadPool->stopThreads();
 }
 
 bool FileCache::copyFileToMachine(FileDetails* fd, Machine* machine)
 {
     log(osg::NOTICE,"Copying file '%s' to machine '%s'.",fd->getFileName().c_str(), machine->getHostName().c_str());
     
-    std::string filePrefix( machine->getCacheDirectory() + std::string("/") );
-    
-    if (filePrefix.empty())
+    if (machine->getCacheDirectory().empty())
     {
         log(osg::NOTICE,"Error: cannot mirror without a valid cache directory on specified machine.");
         return false;
     }
     
+    std::string filePrefix( machine->getCacheDirectory() + std::string("/") );
     std::string newFileName = filePrefix + osgDB::getSimpleFileName(fd->getFileName());
 
-    std::ostringstream app;
-    app<<"cp "<<fd->getFileName()<<" "<<newFileName;
-    
-    std::string appstr( app.str() );
-    
-    int result = system( appstr.c_str() );
+    // only one copy of a file at a time, anyone else wanting the same file waits for it to arrive.
+    bool alreadyBeingCopied = false;
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_copyMutex);
+        alreadyBeingCopied = !_filesBeingCopied.insert(newFileName).second;
+    }
+
+    if (alreadyBeingCopied)
+    {
+        for(;;)
+        {
+            {
+                OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_copyMutex);
+                if (_filesBeingCopied.count(newFileName)==0) break;
+            }
+            OpenThreads::Thread::microSleep(100000);
+        }
+        return hasFileOnHost(fd->getOriginalSourceFileName(), machine->getHostName());
+    }
+
+    bool result = copyFile(fd->getFileName(), newFileName);
     
-    if (result==0)
+    if (result)
     {
 
         FileDetails* new_fd = new FileDetails;
@@ -756,15 +869,150 @@ bool FileCache::copyFileToMachine(FileDetails* fd, Machine* machine)
         new_fd->setSpatialProperties(fd->getSpatialProperties());
         new_fd->setHostName(machine->getHostName());
         addFileDetails(new_fd);
-        
-        return true;
     }
     else
     {
         log(osg::NOTICE,"Error: cannot copy file '%s' to specified machine '%s'.", fd->getFileName().c_str(), machine->getHostName().c_str());
+    }
+
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_copyMutex);
+        _filesBeingCopied.erase(newFileName);
+    }
+
+    return result;
+}
+
+// FNV-1a hash of the file contents, to check the copy against the original.
+static void updateChecksum(unsigned long long& checksum, const char* data, size_t size)
+{
+    for(size_t i=0; i<size; ++i)
+    {
+        checksum ^= static_cast<unsigned char>(data[i]);
+        checksum *= 1099511628211ULL;
+    }
+}
+
+static bool computeChecksum(const std::string& filename, unsigned long long& checksum, unsigned long long& size)
+{
+    FILE* file = vpb::fopen(filename.c_str(), "rb");
+    if (!file) return false;
+
+    checksum = 14695981039346656037ULL;
+    size = 0;
+
+    std::vector<char> buffer(1024*1024);
+    size_t numRead;
+    while ((numRead = fread(&buffer[0], 1, buffer.size(), file))>0)
+    {
+        updateChecksum(checksum, &buffer[0], numRead);
+        size += numRead;
+    }
+
+    bool success = ferror(file)==0;
+    vpb::fclose(file);
+    return success;
+}
+
+bool FileCache::copyFile(const std::string& sourceFileName, const std::string& destinationFileName)
+{
+    FILE* in = vpb::fopen(sourceFileName.c_str(), "rb");
+    if (!in)
+    {
+        log(osg::NOTICE,"Error: unable to open '%s' to copy.",sourceFileName.c_str());
         return false;
     }
 
+    // copy to a temporary file so a partial copy is never mistaken for the real thing.
+    std::string tempFileName = destinationFileName + std::string(".part");
+    FILE* out = vpb::fopen(tempFileName.c_str(), "wb");
+    if (!out)
+    {
+        log(osg::NOTICE,"Error: unable to open '%s' to copy to.",tempFileName.c_str());
+        vpb::fclose(in);
+        return false;
+    }
+
+    unsigned long long sourceChecksum = 14695981039346656037ULL;
+    unsigned long long sourceSize = 0;
+
+    bool success = true;
+    std::vector<char> buffer(1024*1024);
+    size_t numRead;
+    while (success && (numRead = fread(&buffer[0], 1, buffer.size(), in))>0)
+    {
+        updateChecksum(sourceChecksum, &buffer[0], numRead);
+        sourceSize += numRead;
+        success = fwrite(&buffer[0], 1, numRead, out)==numRead;
+    }
+
+    success = success && ferror(in)==0;
+    vpb::fclose(in);
+    success = (vpb::fclose(out)==0) && success;
+
+    // read the copy back to make sure it arrived intact.
+    unsigned long long copyChecksum = 0;
+    unsigned long long copySize = 0;
+    if (success && (!computeChecksum(tempFileName, copyChecksum, copySize) || copyChecksum!=sourceChecksum || copySize!=sourceSize))
+    {
+        log(osg::NOTICE,"Error: checksum of copy '%s' does not match '%s'.",tempFileName.c_str(),sourceFileName.c_str());
+        success = false;
+    }
+
+    if (success)
+    {
+        remove(destinationFileName.c_str());
+        success = rename(tempFileName.c_str(), destinationFileName.c_str())==0;
+    }
+
+    if (!success) remove(tempFileName.c_str());
+
+    return success;
+}
+
+bool FileCache::hasFileOnHost(const std::string& filename, const std::string& hostname)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_variantMapMutex);
+
+    VariantMap::iterator itr = _variantMap.find(filename);
+    if (itr==_variantMap.end()) return false;
+
+    Variants& variants = itr->second;
+    for(Variants::iterator vitr = variants.begin();
+        vitr != variants.end();
+        ++vitr)
+    {
+        if ((*vitr)->getHostName()==hostname) return true;
+    }
+
+    return false;
+}
+
+bool FileCache::prefetch(const std::string& filename, Machine* machine)
+{
+    if (machine->getCacheDirectory().empty()) return false;
+
+    if (hasFileOnHost(filename, machine->getHostName())) return true;
+
+    // copy the original, or failing that any variant, as vpbmaster builds have all sources in the destination coordinate system.
+    osg::ref_ptr<FileDetails> fd;
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_variantMapMutex);
+
+        VariantMap::iterator itr = _variantMap.find(filename);
+        if (itr==_variantMap.end() || itr->second.empty()) return false;
+
+        Variants& variants = itr->second;
+        fd = variants.front();
+        for(Variants::iterator vitr = variants.begin();
+            vitr != variants.end();
+            ++vitr)
+        {
+            if ((*vitr)->getFileName()==filename) fd = *vitr;
+        }
+    }
+
+    return copyFileToMachine(fd.get(), machine);
 }
 
 void FileCache::report(std::ostream& out)
@@ -80,3 +80,34 @@ bool FilePathManager::checkWritePermissionAndEnsurePathAvailability(const std::s
     _filePathWritePermissionMap[path] = false;
     return false;
 }
+
+bool FilePathManager::registerFileWrite(const std::string& filename)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+
+    std::string path = osgDB::getFilePath(filename);
+    if (path.empty()) path = ".";
+
+    DirectoryContentsMap::iterator itr = _directoryContentsMap.find(path);
+    if (itr == _directoryContentsMap.end())
+    {
+        std::set<std::string>& contents = _directoryContentsMap[path];
+
+        osgDB::DirectoryContents dc = osgDB::getDirectoryContents(path);
+        contents.insert(dc.begin(), dc.end());
+
+        itr = _directoryContentsMap.find(path);
+    }
+
+    std::string simpleFileName = osgDB::getSimpleFileName(filename);
+    return !(itr->second.insert(simpleFileName).second);
+}
+
+void FilePathManager::clear()
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+
+    _filePathTypeMap.clear();
+    _filePathWritePermissionMap.clear();
+    _directoryContentsMap.clear();
+}
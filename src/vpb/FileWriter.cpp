@@ -0,0 +1,174 @@
+/* -*-c++-*- VirtualPlanetBuilder - Copyright (C) 1998-2007 Robert Osfield
+ *
+ * This library is open source and may be redistributed and/or modified under
+ * the terms of the OpenSceneGraph Public License (OSGPL) version 0.0 or
+ * (at your option) any later version.  The full license is in LICENSE file
+ * included with this distribution, and on the openscenegraph.org website.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * OpenSceneGraph Public License for more details.
+*/
+
+#include <vpb/FileWriter>
+#include <vpb/FilePathManager>
+#include <vpb/FileUtils>
+#include <vpb/BuildLog>
+
+#include <OpenThreads/ScopedLock>
+
+#include <map>
+#include <vector>
+
+using namespace vpb;
+
+FileWriter::FileWriter(unsigned int maximumBytesInFlight):
+    _maximumBytesInFlight(maximumBytesInFlight),
+    _bytesInFlight(0),
+    _numFilesInFlight(0),
+    _done(false)
+{
+}
+
+FileWriter::~FileWriter()
+{
+    stop();
+}
+
+void FileWriter::write(const std::string& filename, std::string& data, bool existedBefore)
+{
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+
+        // always let one file through, even if it is larger than the whole budget, so we can't deadlock.
+        while (_bytesInFlight>0 && _bytesInFlight+data.size()>_maximumBytesInFlight)
+        {
+            _completedCondition.wait(&_mutex);
+        }
+
+        _pendingFiles.push_back(PendingFile());
+        PendingFile& file = _pendingFiles.back();
+        file._filename = filename;
+        file._data.swap(data);
+        file._existedBefore = existedBefore;
+
+        _bytesInFlight += file._data.size();
+        ++_numFilesInFlight;
+    }
+
+    _pendingCondition.signal();
+}
+
+void FileWriter::flush()
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+    while (_numFilesInFlight>0)
+    {
+        _completedCondition.wait(&_mutex);
+    }
+}
+
+void FileWriter::stop()
+{
+    if (!isRunning()) return;
+
+    flush();
+
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+        _done = true;
+    }
+
+    _pendingCondition.broadcast();
+
+    join();
+}
+
+void FileWriter::run()
+{
+    while(true)
+    {
+        PendingFiles batch;
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+            while (_pendingFiles.empty() && !_done)
+            {
+                _pendingCondition.wait(&_mutex);
+            }
+
+            if (_pendingFiles.empty()) return;
+
+            batch.swap(_pendingFiles);
+        }
+
+        // group the batch by directory so each directory is checked once and written to in one go.
+        typedef std::vector<PendingFiles::iterator> FileIterators;
+        typedef std::map<std::string, FileIterators> DirectoryFileMap;
+        DirectoryFileMap directoryFileMap;
+        for(PendingFiles::iterator itr = batch.begin();
+            itr != batch.end();
+            ++itr)
+        {
+            directoryFileMap[osgDB::getFilePath(itr->_filename)].push_back(itr);
+        }
+
+        log(osg::INFO,"FileWriter::run() writing %d files to %d directories",batch.size(),directoryFileMap.size());
+
+        for(DirectoryFileMap::iterator ditr = directoryFileMap.begin();
+            ditr != directoryFileMap.end();
+            ++ditr)
+        {
+            FileIterators& files = ditr->second;
+
+            bool writable = FilePathManager::instance()->checkWritePermissionAndEnsurePathAvailability(files.front()->_filename);
+            if (!writable)
+            {
+                log(osg::WARN,"Error: do not have write permission to write out files to %s",ditr->first.c_str());
+            }
+
+            for(FileIterators::iterator fitr = files.begin();
+                fitr != files.end();
+                ++fitr)
+            {
+                PendingFile& file = *(*fitr);
+                bool success = writable && writeFile(file);
+
+                if (_writeCallback.valid()) _writeCallback->fileWritten(file._filename, file._existedBefore, success);
+
+                {
+                    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+                    _bytesInFlight -= file._data.size();
+                    --_numFilesInFlight;
+                }
+
+                // release the memory before telling anyone that waits on the budget.
+                std::string().swap(file._data);
+
+                _completedCondition.broadcast();
+            }
+        }
+    }
+}
+
+bool FileWriter::writeFile(const PendingFile& file)
+{
+    FILE* fp = vpb::fopen(file._filename.c_str(), "wb");
+    if (!fp)
+    {
+        log(osg::WARN,"Error: FileWriter could not open file %s",file._filename.c_str());
+        return false;
+    }
+
+    bool success = file._data.empty() || fwrite(file._data.data(), 1, file._data.size(), fp)==file._data.size();
+    success = (fflush(fp)==0) && success;
+
+    // sync from this background thread so the build threads never wait on it.
+    vpb::fsync(fileno(fp));
+
+    success = (vpb::fclose(fp)==0) && success;
+
+    if (!success) log(osg::WARN,"Error: FileWriter failed writing file %s",file._filename.c_str());
+
+    return success;
+}
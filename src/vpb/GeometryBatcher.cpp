@@ -0,0 +1,238 @@
+/* -*-c++-*- VirtualPlanetBuilder - Copyright (C) 1998-2007 Robert Osfield
+ *
+ * This library is open source and may be redistributed and/or modified under
+ * the terms of the OpenSceneGraph Public License (OSGPL) version 0.0 or
+ * (at your option) any later version.  The full license is in LICENSE file
+ * included with this distribution, and on the openscenegraph.org website.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * OpenSceneGraph Public License for more details.
+*/
+
+#include <vpb/GeometryBatcher>
+
+#include <osg/TriangleIndexFunctor>
+
+using namespace vpb;
+
+enum Layout
+{
+    HAS_NORMALS = 1,
+    HAS_COLOURS = 2
+};
+
+// return whether the geometry can be merged, and the arrays its batch needs.
+static bool computeLayout(const osg::Geometry& geometry, unsigned int& layout)
+{
+    layout = 0;
+
+    const osg::Vec3Array* vertices = dynamic_cast<const osg::Vec3Array*>(geometry.getVertexArray());
+    if (!vertices || vertices->empty()) return false;
+
+    if (geometry.getNumTexCoordArrays()!=0 || geometry.getNumVertexAttribArrays()!=0) return false;
+    if (geometry.getSecondaryColorArray() || geometry.getFogCoordArray()) return false;
+
+    if (geometry.getNormalArray())
+    {
+        const osg::Vec3Array* normals = dynamic_cast<const osg::Vec3Array*>(geometry.getNormalArray());
+        if (!normals || geometry.getNormalBinding()!=osg::Geometry::BIND_PER_VERTEX || normals->size()!=vertices->size()) return false;
+        layout |= HAS_NORMALS;
+    }
+
+    if (geometry.getColorArray())
+    {
+        const osg::Vec4Array* colours = dynamic_cast<const osg::Vec4Array*>(geometry.getColorArray());
+        if (!colours || colours->empty()) return false;
+
+        if (geometry.getColorBinding()==osg::Geometry::BIND_PER_VERTEX)
+        {
+            if (colours->size()!=vertices->size()) return false;
+        }
+        else if (geometry.getColorBinding()!=osg::Geometry::BIND_OVERALL)
+        {
+            return false;
+        }
+        layout |= HAS_COLOURS;
+    }
+
+    for(unsigned int i=0; i<geometry.getNumPrimitiveSets(); ++i)
+    {
+        switch(geometry.getPrimitiveSet(i)->getMode())
+        {
+            case(osg::PrimitiveSet::TRIANGLES):
+            case(osg::PrimitiveSet::TRIANGLE_STRIP):
+            case(osg::PrimitiveSet::TRIANGLE_FAN):
+            case(osg::PrimitiveSet::QUADS):
+            case(osg::PrimitiveSet::QUAD_STRIP):
+            case(osg::PrimitiveSet::POLYGON):
+                break;
+            default:
+                return false;
+        }
+    }
+
+    return true;
+}
+
+struct CollectTriangles
+{
+    CollectTriangles(): _indices(0), _base(0) {}
+
+    void operator() (unsigned int p1, unsigned int p2, unsigned int p3)
+    {
+        // the strips extruded from a footprint are joined with degenerate triangles.
+        if (p1==p2 || p2==p3 || p1==p3) return;
+
+        _indices->push_back(_base+p1);
+        _indices->push_back(_base+p2);
+        _indices->push_back(_base+p3);
+    }
+
+    std::vector<unsigned int>*  _indices;
+    unsigned int                _base;
+};
+
+GeometryBatcher::GeometryBatcher():
+    _featureIDAttribute(-1),
+    _maximumNumVertices(65536)
+{
+}
+
+GeometryBatcher::BatchSet& GeometryBatcher::getBatchSet(osg::StateSet* stateSet, unsigned int layout)
+{
+    // the batch sets are kept in the order they are first used, so the output doesn't depend on pointer values.
+    for(std::vector<BatchSet>::iterator itr = _batchSets.begin();
+        itr != _batchSets.end();
+        ++itr)
+    {
+        if (itr->_stateSet==stateSet && itr->_layout==layout) return *itr;
+    }
+
+    _batchSets.push_back(BatchSet());
+    _batchSets.back()._stateSet = stateSet;
+    _batchSets.back()._layout = layout;
+    return _batchSets.back();
+}
+
+void GeometryBatcher::addGeometry(osg::Geometry* geometry, unsigned int featureID)
+{
+    unsigned int layout = 0;
+    const osg::Vec3Array* vertices = dynamic_cast<const osg::Vec3Array*>(geometry->getVertexArray());
+    if (!computeLayout(*geometry, layout) || vertices->size()>_maximumNumVertices)
+    {
+        _unbatchedGeometries.push_back(geometry);
+        return;
+    }
+
+    BatchSet& batchSet = getBatchSet(geometry->getStateSet(), layout);
+    if (batchSet._batches.empty() || batchSet._batches.back()._numVertices+vertices->size()>_maximumNumVertices)
+    {
+        batchSet._batches.push_back(Batch());
+
+        Batch& batch = batchSet._batches.back();
+        batch._vertices = new osg::Vec3Array;
+        if (layout & HAS_NORMALS) batch._normals = new osg::Vec3Array;
+        if (layout & HAS_COLOURS) batch._colours = new osg::Vec4Array;
+        if (_featureIDAttribute>=0) batch._featureIDs = new osg::FloatArray;
+    }
+
+    Batch& batch = batchSet._batches.back();
+
+    osg::TriangleIndexFunctor<CollectTriangles> triangleIndexFunctor;
+    triangleIndexFunctor._indices = &batch._indices;
+    triangleIndexFunctor._base = batch._numVertices;
+    geometry->accept(triangleIndexFunctor);
+
+    batch._vertices->insert(batch._vertices->end(), vertices->begin(), vertices->end());
+
+    if (batch._normals.valid())
+    {
+        const osg::Vec3Array* normals = static_cast<const osg::Vec3Array*>(geometry->getNormalArray());
+        batch._normals->insert(batch._normals->end(), normals->begin(), normals->end());
+    }
+
+    if (batch._colours.valid())
+    {
+        const osg::Vec4Array* colours = static_cast<const osg::Vec4Array*>(geometry->getColorArray());
+        if (geometry->getColorBinding()==osg::Geometry::BIND_PER_VERTEX) batch._colours->insert(batch._colours->end(), colours->begin(), colours->end());
+        else batch._colours->insert(batch._colours->end(), vertices->size(), colours->front());
+    }
+
+    if (batch._featureIDs.valid())
+    {
+        batch._featureIDs->insert(batch._featureIDs->end(), vertices->size(), float(featureID));
+    }
+
+    batch._numVertices += vertices->size();
+}
+
+unsigned int GeometryBatcher::addBatchesTo(osg::Geode& geode)
+{
+    unsigned int numDrawables = 0;
+
+    for(std::vector<BatchSet>::iterator bsitr = _batchSets.begin();
+        bsitr != _batchSets.end();
+        ++bsitr)
+    {
+        for(std::vector<Batch>::iterator bitr = bsitr->_batches.begin();
+            bitr != bsitr->_batches.end();
+            ++bitr)
+        {
+            Batch& batch = *bitr;
+            if (batch._indices.empty()) continue;
+
+            osg::ref_ptr<osg::Geometry> geometry = new osg::Geometry;
+            geometry->setStateSet(bsitr->_stateSet.get());
+            geometry->setVertexArray(batch._vertices.get());
+
+            if (batch._normals.valid())
+            {
+                geometry->setNormalArray(batch._normals.get());
+                geometry->setNormalBinding(osg::Geometry::BIND_PER_VERTEX);
+            }
+
+            if (batch._colours.valid())
+            {
+                geometry->setColorArray(batch._colours.get());
+                geometry->setColorBinding(osg::Geometry::BIND_PER_VERTEX);
+            }
+
+            if (batch._featureIDs.valid())
+            {
+                geometry->setVertexAttribArray(_featureIDAttribute, batch._featureIDs.get());
+                geometry->setVertexAttribBinding(_featureIDAttribute, osg::Geometry::BIND_PER_VERTEX);
+            }
+
+            if (batch._numVertices<=65536)
+            {
+                osg::DrawElementsUShort* elements = new osg::DrawElementsUShort(osg::PrimitiveSet::TRIANGLES);
+                elements->insert(elements->end(), batch._indices.begin(), batch._indices.end());
+                geometry->addPrimitiveSet(elements);
+            }
+            else
+            {
+                osg::DrawElementsUInt* elements = new osg::DrawElementsUInt(osg::PrimitiveSet::TRIANGLES);
+                elements->insert(elements->end(), batch._indices.begin(), batch._indices.end());
+                geometry->addPrimitiveSet(elements);
+            }
+
+            geode.addDrawable(geometry.get());
+            ++numDrawables;
+        }
+    }
+
+    for(std::vector< osg::ref_ptr<osg::Geometry> >::iterator itr = _unbatchedGeometries.begin();
+        itr != _unbatchedGeometries.end();
+        ++itr)
+    {
+        geode.addDrawable(itr->get());
+        ++numDrawables;
+    }
+
+    _batchSets.clear();
+    _unbatchedGeometries.clear();
+
+    return numDrawables;
+}
@@ -193,40 +193,58 @@ struct IsConvexPolygonVisitor : public osg::ArrayVisitor
 };
 
 
-// ** This operator map each vertex and add them only if they overlap the HeightField
+// number of vertices draped per call of the batched getZfromXY().
+static const unsigned int s_drapeBlockSize = 256;
+
+// ** map each vertex a block at a time, keeping only those that overlap the HeightField
+template <typename ArrayType>
+static unsigned int drapeVertices(const HeightFieldMapper & hfm, ArrayType & array)
+{
+    double x[s_drapeBlockSize];
+    double y[s_drapeBlockSize];
+    double z[s_drapeBlockSize];
+
+    unsigned int size = array.size();
+    unsigned int numKept = 0;
+
+    for (unsigned int start=0; start<size; start+=s_drapeBlockSize)
+    {
+        unsigned int count = osg::minimum(s_drapeBlockSize, size-start);
+        for (unsigned int i=0; i<count; ++i)
+        {
+            x[i] = array[start+i].x();
+            y[i] = array[start+i].y();
+        }
+
+        hfm.getZfromXY(count, x, y, z);
+
+        // compact the array in place as the vertices off the HeightField are dropped.
+        for (unsigned int i=0; i<count; ++i)
+        {
+            if (z[i] == DBL_MAX) continue;
+
+            typename ArrayType::ElementDataType & vec = array[numKept++];
+            vec = array[start+i];
+            vec.z() = z[i];
+        }
+    }
+
+    array.resize(numKept);
+    return numKept;
+}
+
 class HeightFieldMapperArrayVisitor : public osg::ArrayVisitor
 {
 public:
     
     HeightFieldMapperArrayVisitor(const HeightFieldMapper & hfm) : _hfm(hfm) {}
     
-    virtual void apply(osg::Vec3Array& array) { process<osg::Vec3Array>(array); }
-    virtual void apply(osg::Vec4Array& array) { process<osg::Vec4Array>(array); }
+    virtual void apply(osg::Vec3Array& array) { drapeVertices<osg::Vec3Array>(_hfm, array); }
+    virtual void apply(osg::Vec4Array& array) { drapeVertices<osg::Vec4Array>(_hfm, array); }
 
 
-    virtual void apply(osg::Vec3dArray& array) { process<osg::Vec3dArray>(array); }
-    virtual void apply(osg::Vec4dArray& array) { process<osg::Vec4dArray>(array); }
-    
-    template <typename ArrayType>
-    void process(ArrayType & array)
-    {
-        unsigned int size = array.size();
-        osg::ref_ptr<ArrayType> newArray(new ArrayType);
-        newArray->reserve(size);
-        
-        ArrayType & refNewArray = *newArray.get();
-        
-        
-        for (unsigned int i=0; i<size; ++i)
-        {
-            typename ArrayType::ElementDataType & vec = array[i];
-            vec.z() = _hfm.getZfromXY(vec.x(), vec.y());
-            
-            if (vec.z() != DBL_MAX) refNewArray.push_back(vec);
-        }
-        
-        array = refNewArray;
-    }
+    virtual void apply(osg::Vec3dArray& array) { drapeVertices<osg::Vec3dArray>(_hfm, array); }
+    virtual void apply(osg::Vec4dArray& array) { drapeVertices<osg::Vec4dArray>(_hfm, array); }
     
     const HeightFieldMapper & _hfm;
 };
@@ -677,7 +695,8 @@ bool HeightFieldMapper::map(osg::Geometry & geometry) const
         if (getCentroid(geometry, centroid) == false) return false;
         
         // ** get z value to add to Z coordinates
-        double zHeightField = getZfromXY(centroid.x(), centroid.y());
+        double zHeightField = DBL_MAX;
+        getZfromXY(1, &centroid.x(), &centroid.y(), &zHeightField);
         if (zHeightField == DBL_MAX) return false;
         
         double z = zHeightField - centroid.z();
@@ -699,7 +718,8 @@ bool HeightFieldMapper::map(osg::Geometry & geometry) const
 
 double HeightFieldMapper::getZfromXY(double x, double y) const
 {
-    if ((x > _xMax) || (x < _xMin) || (y > _yMax) || (y < _yMin)) return DBL_MAX;
+    // written so that NaN coordinates fail the test too.
+    if (!((x >= _xMin) && (x <= _xMax) && (y >= _yMin) && (y <= _yMax))) return DBL_MAX;
 
     double dx_origin = x-_hf.getOrigin().x();
     double dy_origin = y-_hf.getOrigin().y();
@@ -711,9 +731,7 @@ double HeightFieldMapper::getZfromXY(double x, double y) const
     // compute the cell by taking the floor
     double fx = floor(cx);
     double fy = floor(cy);
-    int c = static_cast<int>(fx);
-    int r = static_cast<int>(fy);
-    
+
     // compute the local cell ratio.
     double rx = cx-fx;
     double ry = cy-fy;
@@ -724,6 +742,11 @@ double HeightFieldMapper::getZfromXY(double x, double y) const
     int numColumns = static_cast<int>(_hf.getNumColumns());
     int numRows = static_cast<int>(_hf.getNumRows());
 
+    // the extents can be wider than the HeightField, so clamp to just off the grid before converting to int,
+    // as converting a double out of int's range is undefined.
+    int c = static_cast<int>(osg::clampBetween(fx, -1.0, double(numColumns)));
+    int r = static_cast<int>(osg::clampBetween(fy, -1.0, double(numRows)));
+
     if ((c>=0 && c<numColumns) && (r>=0 && r<numRows))
     {   double local_ratio = (1.0-rx)*(1.0-ry);
         total_ratio += local_ratio;
@@ -755,6 +778,94 @@ double HeightFieldMapper::getZfromXY(double x, double y) const
     else return _hf.getOrigin().z();
 }
 
+void HeightFieldMapper::getZfromXY(unsigned int count, const double* x, const double* y, double* z) const
+{
+    double originX = _hf.getOrigin().x();
+    double originY = _hf.getOrigin().y();
+    double originZ = _hf.getOrigin().z();
+    double inverseXInterval = 1.0 / double(_hf.getXInterval());
+    double inverseYInterval = 1.0 / double(_hf.getYInterval());
+
+    int numColumns = static_cast<int>(_hf.getNumColumns());
+    int numRows = static_cast<int>(_hf.getNumRows());
+    if (numColumns<2 || numRows<2)
+    {
+        for (unsigned int i=0; i<count; ++i) z[i] = getZfromXY(x[i], y[i]);
+        return;
+    }
+
+    const float* heights = &_hf.getHeight(0,0);
+
+    int cellIndex[s_drapeBlockSize];
+    double rx[s_drapeBlockSize];
+    double ry[s_drapeBlockSize];
+
+    for (unsigned int start=0; start<count; start+=s_drapeBlockSize)
+    {
+        unsigned int blockSize = osg::minimum(s_drapeBlockSize, count-start);
+        const double* bx = x+start;
+        const double* by = y+start;
+        double* bz = z+start;
+
+        // first pass computes the cell and the ratios within it of each coordinate, flagging with -1
+        // those off the grid's interior cells, with no branches so the loop can be vectorized.
+        for (unsigned int i=0; i<blockSize; ++i)
+        {
+            double cx = (bx[i]-originX) * inverseXInterval;
+            double cy = (by[i]-originY) * inverseYInterval;
+            double fx = floor(cx);
+            double fy = floor(cy);
+
+            rx[i] = cx-fx;
+            ry[i] = cy-fy;
+
+            // clamp to just off the grid before converting, as converting a double out of int's range, or NaN,
+            // is undefined. Written so NaN takes the lower bound, the coordinate then failing the extents test.
+            double cfx = (fx>=-1.0) ? fx : -1.0;
+            double cfy = (fy>=-1.0) ? fy : -1.0;
+            cfx = (cfx<=double(numColumns)) ? cfx : double(numColumns);
+            cfy = (cfy<=double(numRows)) ? cfy : double(numRows);
+            int c = static_cast<int>(cfx);
+            int r = static_cast<int>(cfy);
+
+            bool interior = (c>=0) & (c<numColumns-1) & (r>=0) & (r<numRows-1) &
+                            (bx[i]>=_xMin) & (bx[i]<=_xMax) & (by[i]>=_yMin) & (by[i]<=_yMax);
+            cellIndex[i] = interior ? c + r*numColumns : -1;
+        }
+
+        // second pass interpolates the four corners of each cell, the flagged coordinates reading cell 0
+        // so this loop too has no branches.
+        for (unsigned int i=0; i<blockSize; ++i)
+        {
+            int index = cellIndex[i]<0 ? 0 : cellIndex[i];
+
+            double h00 = heights[index];
+            double h10 = heights[index+1];
+            double h01 = heights[index+numColumns];
+            double h11 = heights[index+numColumns+1];
+
+            double h0 = h00 + (h10-h00)*rx[i];
+            double h1 = h01 + (h11-h01)*rx[i];
+            bz[i] = originZ + h0 + (h1-h0)*ry[i];
+        }
+
+        // finally the coordinates on the outer cells, or off the HeightField, take the slow path.
+        for (unsigned int i=0; i<blockSize; ++i)
+        {
+            if (cellIndex[i]<0) bz[i] = getZfromXY(bx[i], by[i]);
+        }
+    }
+}
+
+unsigned int HeightFieldMapper::mapVertices(osg::Vec3Array& vertices) const
+{
+    return drapeVertices(*this, vertices);
+}
+
+unsigned int HeightFieldMapper::mapVertices(osg::Vec3dArray& vertices) const
+{
+    return drapeVertices(*this, vertices);
+}
 
 void HeightFieldMapperVisitor::apply(osg::Geode& node)
 {
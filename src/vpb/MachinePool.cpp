@@ -15,6 +15,10 @@
 #include <vpb/Task>
 #include <vpb/TaskManager>
 #include <vpb/System>
+#include <vpb/Worker>
+#include <vpb/FileCache>
+#include <vpb/Profiler>
+#include <vpb/Metrics>
 
 #include <osg/GraphicsThread>
 #include <osg/Timer>
@@ -24,8 +28,10 @@
 #include <osgDB/FileUtils>
 
 #include <signal.h>
+#include <sys/stat.h>
 
 #include <iostream>
+#include <algorithm>
 
 using namespace vpb;
 
@@ -41,11 +47,27 @@ MachineOperation::MachineOperation(Task* task):
     _task->write();
 }
 
+MachineOperation::MachineOperation():
+    osg::Operation("PlacedTask", false)
+{
+}
+
 void MachineOperation::operator () (osg::Object* object)
 {
     Machine* machine = dynamic_cast<Machine*>(object);
     if (machine)
     {
+        if (!_task && machine->getMachinePool())
+        {
+            _task = machine->getMachinePool()->takeTask(machine);
+        }
+
+        if (!_task) return;
+
+        Profiler::ScopedPhase phase("task");
+
+        if (machine->getMachinePool()) machine->getMachinePool()->prefetchTaskSources(_task.get(), machine);
+
         std::string application;
         if (_task->getProperty("application",application))
         {
@@ -60,12 +82,17 @@ void MachineOperation::operator () (osg::Object* object)
 
             machine->startedTask(_task.get());
 
+            bool metrics = Metrics::instance()->getEnabled();
+            if (metrics) Metrics::instance()->count("vpb_tasks_started_total", 1.0, "machine=\""+machine->getHostName()+"\"");
+
             int result = machine->exec(application);
             
             machine->endedTask(_task.get());
 
-            // read any updates to the task written to file by the application.
-            _task->read();
+            // read any updates to the task written to file, or appended to the journal, by the application.
+            TaskManager* taskManager = machine->getMachinePool() ? machine->getMachinePool()->getTaskManager() : 0;
+            if (taskManager) taskManager->updateTaskFromJournal(_task.get());
+            else _task->read();
             
             double duration;
             if (!_task->getProperty("duration",duration))
@@ -76,9 +103,18 @@ void MachineOperation::operator () (osg::Object* object)
             if (result==0)
             {
                 // success
+                _task->setProperty("duration",duration);
                 _task->setStatus(Task::COMPLETED);
                 _task->write();
 
+                if (machine->getMachinePool()) machine->getMachinePool()->recordTaskDuration(_task.get(), duration);
+
+                if (metrics)
+                {
+                    Metrics::instance()->count("vpb_tasks_completed_total", 1.0, "machine=\""+machine->getHostName()+"\"");
+                    Metrics::instance()->observe("vpb_task_duration_seconds", duration, "machine=\""+machine->getHostName()+"\"");
+                }
+
                 // need to update taskmanger with any new file lists
                 if (machine->getMachinePool() && machine->getMachinePool()->getTaskManager())
                 {
@@ -96,6 +132,8 @@ void MachineOperation::operator () (osg::Object* object)
                 // failure
                 _task->setStatus(Task::FAILED);
                 _task->write();
+
+                if (metrics) Metrics::instance()->count("vpb_tasks_failed_total", 1.0, "machine=\""+machine->getHostName()+"\"");
                 
                 // tell the machine about this task failure.
                 machine->taskFailed(_task.get(), result);
@@ -140,7 +178,8 @@ Machine::Machine(const Machine& m, const osg::CopyOp& copyop):
     _machinePool(m._machinePool),
     _hostname(m._hostname),
     _commandPrefix(m._commandPrefix),
-    _commandPostfix(m._commandPostfix)
+    _commandPostfix(m._commandPostfix),
+    _workerSocket(m._workerSocket)
 {
 }
 
@@ -170,12 +209,58 @@ Machine::~Machine()
     log(osg::INFO,"Machine::~Machine()");
 }
 
+// quote an argument for the shell so that it is passed on verbatim, whatever characters it contains.
+static std::string quoteShellArgument(const std::string& argument)
+{
+    std::string quoted("'");
+    for(std::string::const_iterator itr = argument.begin();
+        itr != argument.end();
+        ++itr)
+    {
+        if (*itr=='\'') quoted += "'\\''";
+        else quoted.push_back(*itr);
+    }
+    quoted.push_back('\'');
+    return quoted;
+}
+
 int Machine::exec(const std::string& application)
 {
     bool runningRemotely = getHostName()!=getLocalHostName() && getHostName()!="localhost";
 
     std::string executionString;
 
+    if (!getWorkerSocket().empty() && getCommandPrefix().empty() && getCommandPostfix().empty())
+    {
+        if (!runningRemotely)
+        {
+            log(osg::INFO,"%s : sending to worker %s : %s",getHostName().c_str(),getWorkerSocket().c_str(),application.c_str());
+
+            int result = Worker::execute(getWorkerSocket(), application);
+            if (result>=0) return result;
+
+            log(osg::NOTICE,"%s : no worker listening on %s, running task as a new process.",getHostName().c_str(),getWorkerSocket().c_str());
+        }
+        else
+        {
+            // vpbworker --submit runs the task itself if the remote worker isn't running.  The remote shell
+            // unquotes the command once more, so quote the application for it as a single argument.
+            std::string remoteCommand = std::string("vpbworker --socket ") +
+                                        quoteShellArgument(getWorkerSocket()) +
+                                        std::string(" --submit ") +
+                                        quoteShellArgument(application);
+
+            executionString = std::string("ssh ") +
+                              quoteShellArgument(getHostName()) +
+                              std::string(" ") +
+                              quoteShellArgument(remoteCommand);
+
+            log(osg::INFO,"%s : running %s",getHostName().c_str(),executionString.c_str());
+
+            return system(executionString.c_str());
+        }
+    }
+
     if (!getCommandPrefix().empty())
     {
         executionString = getCommandPrefix() + std::string(" ") + application;
@@ -183,10 +268,9 @@ int Machine::exec(const std::string& application)
     else if (runningRemotely)
     {
         executionString = std::string("ssh ") +
-                          getHostName() +
-                          std::string(" \"") +
-                          application +
-                          std::string("\"");
+                          quoteShellArgument(getHostName()) +
+                          std::string(" ") +
+                          quoteShellArgument(application);
     }
     else
     {
@@ -405,7 +489,9 @@ void Machine::signal(int signal)
         ++itr)
     {
         Task* task = itr->first;
-        task->read();
+        TaskManager* taskManager = _machinePool ? _machinePool->getTaskManager() : 0;
+        if (taskManager) taskManager->updateTaskFromJournal(task);
+        else task->read();
         std::string pid;
         if (task->getProperty("pid", pid))
         {
@@ -434,7 +520,12 @@ void Machine::setDone(bool done)
 MachinePool::MachinePool():
     _done(false),
     _taskFailureOperation(IGNORE_FAILED_TASK),
-    _taskManager(0)
+    _taskManager(0),
+    _totalEstimatedCost(0.0),
+    _totalCostedDuration(0.0),
+    _totalSourceBytes(0.0),
+    _localSourceBytes(0.0),
+    _numPrefetchedFiles(0)
 {
     //_taskFailureOperation = IGNORE_FAILED_TASK;
     _taskFailureOperation = BLACKLIST_MACHINE_AND_RESUBMIT_TASK;
@@ -507,6 +598,277 @@ void MachinePool::run(Task* task)
     _operationQueue->add(new MachineOperation(task));
 }
 
+struct ScheduledTask
+{
+    ScheduledTask(): _duration(0.0), _cost(0.0) {}
+
+    bool operator < (const ScheduledTask& rhs) const
+    {
+        // longest first, falling back to the estimated cost when there is no history to go on.
+        if (_duration != rhs._duration) return _duration > rhs._duration;
+        return _cost > rhs._cost;
+    }
+
+    double              _duration;
+    double              _cost;
+    osg::ref_ptr<Task>  _task;
+};
+
+double MachinePool::run(Tasks& tasks)
+{
+    std::vector<ScheduledTask> scheduledTasks(tasks.size());
+    for(unsigned int i=0; i<tasks.size(); ++i)
+    {
+        scheduledTasks[i]._task = tasks[i];
+        scheduledTasks[i]._duration = estimateTaskDuration(tasks[i].get());
+        tasks[i]->getProperty("estimated_cost",scheduledTasks[i]._cost);
+    }
+
+    std::stable_sort(scheduledTasks.begin(), scheduledTasks.end());
+
+    // predict the makespan by assigning each task in turn to the thread that frees up first.
+    unsigned int numThreads = std::max(getNumThreads(), 1u);
+    std::vector<double> threadEndTimes(numThreads, 0.0);
+    unsigned int numTasksWithoutEstimate = 0;
+
+    for(std::vector<ScheduledTask>::iterator itr = scheduledTasks.begin();
+        itr != scheduledTasks.end();
+        ++itr)
+    {
+        if (itr->_duration==0.0) ++numTasksWithoutEstimate;
+
+        std::vector<double>::iterator first_free = std::min_element(threadEndTimes.begin(), threadEndTimes.end());
+        *first_free += itr->_duration;
+
+        // the task itself is only chosen once a machine is free to run it, see takeTask().
+        Task* task = itr->_task.get();
+        task->setStatus(Task::PENDING);
+        task->write();
+
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_pendingTasksMutex);
+            _pendingTasks.push_back(task);
+            Metrics::instance()->set("vpb_tasks_pending", _pendingTasks.size());
+        }
+
+        _operationQueue->add(new MachineOperation);
+    }
+
+    double makespan = tasks.empty() ? 0.0 : *std::max_element(threadEndTimes.begin(), threadEndTimes.end());
+
+    log(osg::NOTICE,"Scheduled %d tasks longest first on %d threads, predicted makespan %.1f seconds, %d tasks without an estimate.",
+        int(tasks.size()), numThreads, makespan, numTasksWithoutEstimate);
+
+    return makespan;
+}
+
+double MachinePool::estimateTaskDuration(const Task* task) const
+{
+    double previousDuration = 0.0;
+    if (task->getProperty("previous_duration",previousDuration) && previousDuration>0.0) return previousDuration;
+
+    double estimatedCost = 0.0;
+    if (task->getProperty("estimated_cost",estimatedCost) && estimatedCost>0.0)
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_costMutex);
+        if (_totalEstimatedCost>0.0) return estimatedCost * (_totalCostedDuration / _totalEstimatedCost);
+    }
+
+    std::string taskType;
+    task->getProperty("type",taskType);
+
+    double totalTime = 0.0;
+    unsigned int numTasks = 0;
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_machinesMutex);
+    for(Machines::const_iterator itr = _machines.begin();
+        itr != _machines.end();
+        ++itr)
+    {
+        const Machine* machine = itr->get();
+        OpenThreads::ScopedLock<OpenThreads::Mutex> stats_lock(machine->getRunningTasksMutex());
+
+        TaskStatsMap::const_iterator sitr = machine->getTaskStatsMap().find(taskType);
+        if (sitr != machine->getTaskStatsMap().end())
+        {
+            totalTime += sitr->second.totalTime();
+            numTasks += sitr->second.numTasks();
+        }
+    }
+
+    return numTasks!=0 ? totalTime/double(numTasks) : 0.0;
+}
+
+void MachinePool::recordTaskDuration(const Task* task, double duration)
+{
+    double estimatedCost = 0.0;
+    if (!task->getProperty("estimated_cost",estimatedCost) || estimatedCost<=0.0) return;
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_costMutex);
+    _totalEstimatedCost += estimatedCost;
+    _totalCostedDuration += duration;
+}
+
+bool MachinePool::addTaskHistory(const Task* task)
+{
+    double duration = 0.0;
+    if (task->getStatus()!=Task::COMPLETED || !task->getProperty("duration",duration) || duration<=0.0) return false;
+
+    recordTaskDuration(task, duration);
+
+    std::string hostname;
+    task->getProperty("hostname",hostname);
+
+    std::string taskType;
+    task->getProperty("type",taskType);
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_machinesMutex);
+    if (_machines.empty()) return true;
+
+    // log the time against the machine that ran the task, or the first machine if it's no longer in the pool.
+    Machine* machine = _machines.front().get();
+    for(Machines::iterator itr = _machines.begin();
+        itr != _machines.end();
+        ++itr)
+    {
+        if ((*itr)->getHostName()==hostname)
+        {
+            machine = itr->get();
+            break;
+        }
+    }
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> stats_lock(machine->getRunningTasksMutex());
+    machine->getTaskStatsMap()[taskType].logTime(duration);
+
+    return true;
+}
+
+static void getRequiredSources(const Task* task, std::vector<std::string>& sources)
+{
+    std::string requiredSources;
+    if (!task->getProperty("required_sources",requiredSources)) return;
+
+    std::string::size_type start = 0;
+    while (start<requiredSources.size())
+    {
+        std::string::size_type end = requiredSources.find(';', start);
+        if (end==std::string::npos) end = requiredSources.size();
+        if (end>start) sources.push_back(requiredSources.substr(start, end-start));
+        start = end+1;
+    }
+}
+
+void MachinePool::computeTaskSourceBytes(const Task* task, const Machine* machine, double& totalBytes, double& localBytes)
+{
+    totalBytes = 0.0;
+    localBytes = 0.0;
+
+    std::vector<std::string> sources;
+    getRequiredSources(task, sources);
+    if (sources.empty()) return;
+
+    FileCache* fileCache = System::instance()->getFileCache();
+
+    for(std::vector<std::string>::iterator itr = sources.begin();
+        itr != sources.end();
+        ++itr)
+    {
+        double size = 0.0;
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_localityMutex);
+            SourceFileSizes::iterator sitr = _sourceFileSizes.find(*itr);
+            if (sitr != _sourceFileSizes.end())
+            {
+                size = sitr->second;
+            }
+            else
+            {
+                struct stat fileStats;
+                if (stat(itr->c_str(), &fileStats)==0) size = double(fileStats.st_size);
+                _sourceFileSizes[*itr] = size;
+            }
+        }
+
+        totalBytes += size;
+        if (fileCache && fileCache->hasFileOnHost(*itr, machine->getHostName())) localBytes += size;
+    }
+}
+
+osg::ref_ptr<Task> MachinePool::takeTask(Machine* machine)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_pendingTasksMutex);
+
+    if (_pendingTasks.empty()) return 0;
+
+    // only look a thread's worth of tasks ahead so that the longest tasks still go first.
+    unsigned int window = std::max(getNumThreads(), 1u);
+
+    PendingTasks::iterator bestItr = _pendingTasks.begin();
+    double bestLocalBytes = -1.0;
+    double bestTotalBytes = 0.0;
+
+    unsigned int i = 0;
+    for(PendingTasks::iterator itr = _pendingTasks.begin();
+        itr != _pendingTasks.end() && i<window;
+        ++itr, ++i)
+    {
+        double totalBytes, localBytes;
+        computeTaskSourceBytes(itr->get(), machine, totalBytes, localBytes);
+        if (localBytes>bestLocalBytes)
+        {
+            bestItr = itr;
+            bestLocalBytes = localBytes;
+            bestTotalBytes = totalBytes;
+        }
+    }
+
+    osg::ref_ptr<Task> task = *bestItr;
+    _pendingTasks.erase(bestItr);
+
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> locality_lock(_localityMutex);
+        _totalSourceBytes += bestTotalBytes;
+        _localSourceBytes += bestLocalBytes;
+    }
+
+    Metrics::instance()->set("vpb_tasks_pending", _pendingTasks.size());
+    Metrics::instance()->count("vpb_task_source_bytes_total", bestTotalBytes);
+    Metrics::instance()->count("vpb_task_source_cached_bytes_total", bestLocalBytes);
+
+    return task;
+}
+
+void MachinePool::prefetchTaskSources(Task* task, Machine* machine)
+{
+    FileCache* fileCache = System::instance()->getFileCache();
+    if (!fileCache || machine->getCacheDirectory().empty()) return;
+
+    std::vector<std::string> sources;
+    getRequiredSources(task, sources);
+
+    bool cacheModified = false;
+    for(std::vector<std::string>::iterator itr = sources.begin();
+        itr != sources.end();
+        ++itr)
+    {
+        if (fileCache->hasFileOnHost(*itr, machine->getHostName())) continue;
+
+        if (fileCache->prefetch(*itr, machine))
+        {
+            cacheModified = true;
+
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_localityMutex);
+            ++_numPrefetchedFiles;
+
+            Metrics::instance()->count("vpb_files_prefetched_total");
+        }
+    }
+
+    // the task reads the file cache from disk, so it needs to see the new copies.
+    if (cacheModified) fileCache->sync();
+}
+
 void MachinePool::waitForCompletion()
 {
     _blockOp->reset();
@@ -643,6 +1005,7 @@ bool MachinePool::read(const std::string& filename)
                 std::string cacheDirectory;
                 std::string prefix;
                 std::string postfix;
+                std::string workerSocket;
                 int numThreads=-1;
 
                 while (!fr.eof() && fr[0].getNoNestedBrackets()>local_entry)
@@ -653,13 +1016,16 @@ bool MachinePool::read(const std::string& filename)
                     if (fr.read("cache",cacheDirectory)) localAdvanced = true;
                     if (fr.read("prefix",prefix)) localAdvanced = true;
                     if (fr.read("postfix",postfix)) localAdvanced = true;
+                    if (fr.read("worker",workerSocket)) localAdvanced = true;
                     if (fr.read("threads",numThreads)) localAdvanced = true;
                     if (fr.read("processes",numThreads)) localAdvanced = true;
 
                     if (!localAdvanced) ++fr;
                 }
 
-                addMachine(hostname,cacheDirectory,prefix,postfix,numThreads);
+                osg::ref_ptr<Machine> machine = new Machine(hostname,cacheDirectory,prefix,postfix,numThreads);
+                machine->setWorkerSocket(workerSocket);
+                addMachine(machine.get());
 
                 ++fr;
 
@@ -694,6 +1060,7 @@ bool MachinePool::write(const std::string& filename) const
         if (!machine->getCacheDirectory().empty()) fout.indent()<<"cache "<<machine->getCacheDirectory()<<std::endl;
         if (!machine->getCommandPrefix().empty()) fout.indent()<<"prefix "<<machine->getCommandPrefix()<<std::endl;
         if (!machine->getCommandPostfix().empty()) fout.indent()<<"postfix "<<machine->getCommandPostfix()<<std::endl;
+        if (!machine->getWorkerSocket().empty()) fout.indent()<<"worker "<<machine->getWorkerSocket()<<std::endl;
         if (machine->getNumThreads()>0) fout.indent()<<"processes "<<machine->getNumThreads()<<std::endl;
         
         fout.moveOut();
@@ -713,6 +1080,9 @@ bool MachinePool::setUpOnLocalHost()
 void MachinePool::removeAllOperations()
 {
     _operationQueue->removeAllOperations();
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_pendingTasksMutex);
+    _pendingTasks.clear();
 }
 
 void MachinePool::signal(int signal)
@@ -936,3 +1306,13 @@ void MachinePool::reportTimingStats()
         }
     }
 }
+
+void MachinePool::reportLocalityStats()
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_localityMutex);
+
+    if (_totalSourceBytes<=0.0) return;
+
+    log(osg::NOTICE,"MachinePool::reportLocalityStats() %.1f%% of the %.0f bytes of source data read by tasks was already cached on their machine, %d files prefetched.",
+        100.0*_localSourceBytes/_totalSourceBytes, _totalSourceBytes, _numPrefetchedFiles);
+}
@@ -0,0 +1,337 @@
+/* -*-c++-*- VirtualPlanetBuilder - Copyright (C) 1998-2007 Robert Osfield
+ *
+ * This library is open source and may be redistributed and/or modified under
+ * the terms of the OpenSceneGraph Public License (OSGPL) version 0.0 or
+ * (at your option) any later version.  The full license is in LICENSE file
+ * included with this distribution, and on the openscenegraph.org website.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * OpenSceneGraph Public License for more details.
+*/
+
+#include <vpb/Metrics>
+#include <vpb/BuildLog>
+
+#include <osgDB/fstream>
+
+#include <OpenThreads/ScopedLock>
+#include <OpenThreads/Thread>
+
+#include <sstream>
+
+#include <stdio.h>
+
+using namespace vpb;
+
+class Metrics::WriterThread : public OpenThreads::Thread
+{
+    public:
+
+        WriterThread(Metrics* metrics):
+            _metrics(metrics),
+            _done(false) {}
+
+        virtual void run()
+        {
+            osg::Timer_t lastWrite = osg::Timer::instance()->tick();
+            while (!_done)
+            {
+                // sleep in short steps so stopping doesn't wait out a whole interval.
+                OpenThreads::Thread::microSleep(100000);
+
+                if (osg::Timer::instance()->delta_s(lastWrite, osg::Timer::instance()->tick()) >= _metrics->getInterval())
+                {
+                    _metrics->write();
+                    lastWrite = osg::Timer::instance()->tick();
+                }
+            }
+        }
+
+        Metrics*        _metrics;
+        volatile bool   _done;
+};
+
+Metrics* Metrics::instance()
+{
+    static osg::ref_ptr<Metrics> s_metrics = new Metrics;
+    return s_metrics.get();
+}
+
+Metrics::Metrics():
+    _enabled(false),
+    _interval(10.0),
+    _writerThread(0)
+{
+    _startTick = osg::Timer::instance()->tick();
+    _previousWriteTick = _startTick;
+
+    // seconds, spanning a single tile read up to the longest tasks.
+    const double bounds[] = { 0.01, 0.1, 0.5, 1.0, 5.0, 10.0, 30.0, 60.0, 300.0, 900.0, 1800.0, 3600.0, 7200.0 };
+    _bucketBounds.assign(bounds, bounds+sizeof(bounds)/sizeof(double));
+}
+
+Metrics::~Metrics()
+{
+    stop();
+}
+
+Metrics::Series& Metrics::getSeries(const std::string& name, const std::string& labels, Type type)
+{
+    Family& family = _families[name];
+    family.type = type;
+    return family.series[labels];
+}
+
+void Metrics::count(const std::string& name, double value, const std::string& labels)
+{
+    if (!_enabled) return;
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+    getSeries(name, labels, COUNTER).value += value;
+}
+
+void Metrics::set(const std::string& name, double value, const std::string& labels)
+{
+    if (!_enabled) return;
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+    getSeries(name, labels, GAUGE).value = value;
+}
+
+void Metrics::observe(const std::string& name, double value, const std::string& labels)
+{
+    if (!_enabled) return;
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+    Series& series = getSeries(name, labels, HISTOGRAM);
+    if (series.buckets.empty()) series.buckets.resize(_bucketBounds.size(), 0);
+
+    series.value += 1.0;
+    series.sum += value;
+    for(unsigned int i=0; i<_bucketBounds.size(); ++i)
+    {
+        if (value<=_bucketBounds[i]) ++series.buckets[i];
+    }
+}
+
+static const char* getTypeName(Metrics::Type type)
+{
+    switch(type)
+    {
+        case(Metrics::GAUGE): return "gauge";
+        case(Metrics::HISTOGRAM): return "histogram";
+        default: return "counter";
+    }
+}
+
+static void writeSeriesName(std::ostream& out, const std::string& name, const std::string& labels, const std::string& extraLabel=std::string())
+{
+    out<<name;
+    if (labels.empty() && extraLabel.empty()) return;
+
+    out<<"{"<<labels;
+    if (!labels.empty() && !extraLabel.empty()) out<<",";
+    out<<extraLabel<<"}";
+}
+
+void Metrics::writePrometheus(std::ostream& out) const
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+
+    out.precision(15);
+
+    for(Families::const_iterator itr = _families.begin();
+        itr != _families.end();
+        ++itr)
+    {
+        const std::string& name = itr->first;
+        const Family& family = itr->second;
+
+        out<<"# TYPE "<<name<<" "<<getTypeName(family.type)<<"\n";
+
+        for(SeriesMap::const_iterator sitr = family.series.begin();
+            sitr != family.series.end();
+            ++sitr)
+        {
+            const std::string& labels = sitr->first;
+            const Series& series = sitr->second;
+
+            if (family.type==HISTOGRAM)
+            {
+                for(unsigned int i=0; i<_bucketBounds.size(); ++i)
+                {
+                    std::ostringstream le;
+                    le<<"le=\""<<_bucketBounds[i]<<"\"";
+                    writeSeriesName(out, name+"_bucket", labels, le.str());
+                    out<<" "<<series.buckets[i]<<"\n";
+                }
+                writeSeriesName(out, name+"_bucket", labels, "le=\"+Inf\"");
+                out<<" "<<series.value<<"\n";
+
+                writeSeriesName(out, name+"_sum", labels);
+                out<<" "<<series.sum<<"\n";
+
+                writeSeriesName(out, name+"_count", labels);
+                out<<" "<<series.value<<"\n";
+            }
+            else
+            {
+                writeSeriesName(out, name, labels);
+                out<<" "<<series.value<<"\n";
+            }
+        }
+    }
+}
+
+// labels are written as name="value" pairs separated by commas, copy them into a JSON object.
+static void writeJSONLabels(std::ostream& out, const std::string& labels)
+{
+    out<<"{";
+
+    std::string::size_type pos = 0;
+    bool first = true;
+    while (pos<labels.size())
+    {
+        std::string::size_type equals = labels.find("=\"", pos);
+        if (equals==std::string::npos) break;
+
+        std::string::size_type end = labels.find('"', equals+2);
+        if (end==std::string::npos) break;
+
+        if (!first) out<<",";
+        first = false;
+
+        out<<"\""<<labels.substr(pos, equals-pos)<<"\":\""<<labels.substr(equals+2, end-(equals+2))<<"\"";
+
+        pos = end+1;
+        if (pos<labels.size() && labels[pos]==',') ++pos;
+    }
+
+    out<<"}";
+}
+
+void Metrics::writeJSON(std::ostream& out)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+
+    osg::Timer_t currentTick = osg::Timer::instance()->tick();
+    double interval = osg::Timer::instance()->delta_s(_previousWriteTick, currentTick);
+    _previousWriteTick = currentTick;
+
+    out.precision(15);
+
+    out<<"{\"time\":"<<osg::Timer::instance()->delta_s(_startTick, currentTick)
+       <<",\"interval\":"<<interval<<",\"metrics\":{";
+
+    for(Families::iterator itr = _families.begin();
+        itr != _families.end();
+        ++itr)
+    {
+        if (itr != _families.begin()) out<<",";
+
+        Family& family = itr->second;
+        out<<"\n\""<<itr->first<<"\":{\"type\":\""<<getTypeName(family.type)<<"\",\"series\":[";
+
+        for(SeriesMap::iterator sitr = family.series.begin();
+            sitr != family.series.end();
+            ++sitr)
+        {
+            if (sitr != family.series.begin()) out<<",";
+
+            Series& series = sitr->second;
+            out<<"{\"labels\":";
+            writeJSONLabels(out, sitr->first);
+
+            if (family.type==HISTOGRAM)
+            {
+                out<<",\"count\":"<<series.value<<",\"sum\":"<<series.sum
+                   <<",\"average\":"<<(series.value>0.0 ? series.sum/series.value : 0.0);
+            }
+            else
+            {
+                out<<",\"value\":"<<series.value;
+            }
+
+            // the per second rate over the last interval, i.e. tiles written per second.
+            if (family.type!=GAUGE)
+            {
+                out<<",\"rate\":"<<(interval>0.0 ? (series.value-series.previousValue)/interval : 0.0);
+                series.previousValue = series.value;
+            }
+
+            out<<"}";
+        }
+
+        out<<"]}";
+    }
+
+    out<<"\n}}\n";
+}
+
+bool Metrics::writeFile(const std::string& filename, bool json)
+{
+    // write to a temporary file and rename it, so collectors never see a partially written file.
+    std::string tempFileName = filename + ".tmp";
+    {
+        osgDB::ofstream fout(tempFileName.c_str());
+        if (!fout)
+        {
+            log(osg::NOTICE,"Error: unable to write metrics file %s",tempFileName.c_str());
+            return false;
+        }
+
+        if (json) writeJSON(fout);
+        else writePrometheus(fout);
+    }
+
+    if (rename(tempFileName.c_str(), filename.c_str())==0) return true;
+
+    // platforms that won't rename over an existing file need it removed first.
+    remove(filename.c_str());
+    if (rename(tempFileName.c_str(), filename.c_str())==0) return true;
+
+    remove(tempFileName.c_str());
+    return false;
+}
+
+bool Metrics::write()
+{
+    if (!_enabled || _fileName.empty()) return false;
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_writeMutex);
+
+    bool success = writeFile(_fileName+".prom", false);
+    return writeFile(_fileName+".json", true) && success;
+}
+
+void Metrics::start()
+{
+    if (!_enabled || _writerThread) return;
+
+    _writerThread = new WriterThread(this);
+    _writerThread->startThread();
+}
+
+void Metrics::stop()
+{
+    if (_writerThread)
+    {
+        _writerThread->_done = true;
+        _writerThread->join();
+        delete _writerThread;
+        _writerThread = 0;
+    }
+
+    write();
+}
+
+void Metrics::clear()
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+    _families.clear();
+
+    _startTick = osg::Timer::instance()->tick();
+    _previousWriteTick = _startTick;
+}
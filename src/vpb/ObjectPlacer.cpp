@@ -15,9 +15,25 @@
 #include <vpb/ObjectPlacer>
 #include <vpb/Destination>
 #include <vpb/DataSet>
+#include <vpb/Metrics>
+
+#include <osg/Geode>
+#include <osg/Geometry>
+#include <osg/MatrixTransform>
+#include <osg/PositionAttitudeTransform>
+#include <osg/Texture2D>
+
+#include <set>
+#include <sstream>
 
 using namespace vpb;
 
+// the instance table is bound to a unit above those used by the terrain's imagery layers, without enabling texturing on it.
+static const unsigned int s_instanceTableTextureUnit = 7;
+
+// each instance takes one row of the table, so the rows per table is kept within the texture sizes of older hardware.
+static const unsigned int s_maximumNumInstancesPerTable = 4096;
+
 bool ObjectPlacer::place(DestinationTile& destinationTile, osg::Node* model)
 {
     log(osg::NOTICE,"ObjectPlacer::place(%s)",model->getName().c_str());
@@ -26,3 +42,462 @@ bool ObjectPlacer::place(DestinationTile& destinationTile, osg::Node* model)
     
     return true;
 }
+
+struct Placement
+{
+    Placement(osg::Transform* transform, const osg::NodePath& parentPath, const osg::Matrix& matrix):
+        _transform(transform),
+        _parentPath(parentPath)
+    {
+        osg::Quat scaleOrientation;
+        matrix.decompose(_translation, _rotation, _scale, scaleOrientation);
+    }
+
+    // only rigid placements with a uniform scale can be expressed by a row of the instance table.
+    bool isUniform() const
+    {
+        return _scale.x()>0.0 &&
+               fabs(_scale.y()-_scale.x())<=_scale.x()*1e-4 &&
+               fabs(_scale.z()-_scale.x())<=_scale.x()*1e-4;
+    }
+
+    osg::Transform*     _transform;
+    osg::NodePath       _parentPath;
+    osg::Vec3d          _translation;
+    osg::Quat           _rotation;
+    osg::Vec3d          _scale;
+};
+
+typedef std::vector<Placement> PlacementList;
+
+class CollectPlacementsVisitor : public osg::NodeVisitor
+{
+public:
+
+    CollectPlacementsVisitor():
+        osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN) {}
+
+    void apply(osg::Transform& transform)
+    {
+        osg::Matrix matrix = _matrix;
+        transform.computeLocalToWorldMatrix(matrix, this);
+
+        if (isPlacement(transform) && isPlainPath(getNodePath()))
+        {
+            osg::Node* sharedModel = transform.getChild(0);
+
+            PlacementList& placements = _placementMap[sharedModel];
+            if (placements.empty()) _sharedModels.push_back(sharedModel);
+
+            osg::NodePath parentPath(getNodePath().begin(), getNodePath().end()-1);
+            placements.push_back(Placement(&transform, parentPath, matrix));
+            return;
+        }
+
+        osg::Matrix previousMatrix = _matrix;
+        _matrix = matrix;
+        traverse(transform);
+        _matrix = previousMatrix;
+    }
+
+    static bool isPlacement(osg::Transform& transform)
+    {
+        return (transform.asMatrixTransform() || transform.asPositionAttitudeTransform()) &&
+               transform.getNumChildren()==1 &&
+               transform.getReferenceFrame()==osg::Transform::RELATIVE_RF &&
+               !transform.getStateSet() &&
+               !transform.getUpdateCallback() &&
+               !transform.getCullCallback();
+    }
+
+    // the instances are drawn outside the placement's parents, so any state or callbacks they carry would be lost.
+    static bool isPlainPath(const osg::NodePath& nodePath)
+    {
+        for(osg::NodePath::const_iterator itr = nodePath.begin();
+            itr != nodePath.end();
+            ++itr)
+        {
+            const osg::Node* node = *itr;
+            if (node->getStateSet() || node->getUpdateCallback() || node->getEventCallback() || node->getCullCallback()) return false;
+        }
+        return true;
+    }
+
+    typedef std::map<osg::Node*, PlacementList> PlacementMap;
+
+    osg::Matrix                 _matrix;
+    std::vector<osg::Node*>     _sharedModels;
+    PlacementMap                _placementMap;
+};
+
+// an instanced subgraph is drawn with the instance matrix applied in the vertex program, so it can only contain plain groups
+// and geodes of geometry, without transforms, LODs, billboards or programs of its own.  The program only reproduces the
+// default lighting of OSG, coloured by the vertex colours, and plain texture coordinates on the units below the instance
+// table, so state that needs more than that, or that switches lighting on and off within the subgraph, isn't instanced.
+class InstanceableVisitor : public osg::NodeVisitor
+{
+public:
+
+    InstanceableVisitor():
+        osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN),
+        _instanceable(true),
+        _lightingOn(false),
+        _lightingOff(false),
+        _textureUnitMask(0) {}
+
+    // lighting is inherited from the terrain when the subgraph doesn't set it, and on by default.
+    bool getLighting() const { return !_lightingOff; }
+
+    void apply(osg::Node&)
+    {
+        _instanceable = false;
+    }
+
+    void apply(osg::Group& group)
+    {
+        if (std::string(group.className())!="Group" || !isInstanceable(group, group.getStateSet())) _instanceable = false;
+        else traverse(group);
+    }
+
+    void apply(osg::Geode& geode)
+    {
+        if (std::string(geode.className())!="Geode" || !isInstanceable(geode, geode.getStateSet()))
+        {
+            _instanceable = false;
+            return;
+        }
+
+        for(unsigned int i=0; i<geode.getNumDrawables(); ++i)
+        {
+            osg::Geometry* geometry = geode.getDrawable(i)->asGeometry();
+            if (!geometry || !geometry->getVertexArray() || !isInstanceable(*geometry, geometry->getStateSet()))
+            {
+                _instanceable = false;
+                continue;
+            }
+
+            for(unsigned int unit=0; unit<geometry->getNumTexCoordArrays(); ++unit)
+            {
+                if (!geometry->getTexCoordArray(unit)) continue;
+
+                if (unit<s_instanceTableTextureUnit) _textureUnitMask |= (1u << unit);
+                else _instanceable = false;
+            }
+        }
+    }
+
+    bool isInstanceable(const osg::Object& object, const osg::StateSet* stateset)
+    {
+        const osg::Node* node = dynamic_cast<const osg::Node*>(&object);
+        if (node && (node->getUpdateCallback() || node->getEventCallback() || node->getCullCallback())) return false;
+
+        const osg::Drawable* drawable = dynamic_cast<const osg::Drawable*>(&object);
+        if (drawable && (drawable->getUpdateCallback() || drawable->getEventCallback() || drawable->getCullCallback() || drawable->getDrawCallback())) return false;
+
+        if (!stateset) return true;
+
+        if (stateset->getAttribute(osg::StateAttribute::PROGRAM) ||
+            stateset->getAttribute(osg::StateAttribute::MATERIAL) ||
+            stateset->getAttribute(osg::StateAttribute::LIGHTMODEL)) return false;
+
+        const osg::StateSet::TextureAttributeList& textureAttributes = stateset->getTextureAttributeList();
+        for(unsigned int unit=0; unit<textureAttributes.size(); ++unit)
+        {
+            if (textureAttributes[unit].empty()) continue;
+            if (unit>=s_instanceTableTextureUnit || stateset->getTextureAttribute(unit, osg::StateAttribute::TEXGEN)) return false;
+
+            // textured units without a texture coordinate array still need the current texture coordinate passed on.
+            _textureUnitMask |= (1u << unit);
+        }
+
+        osg::StateAttribute::GLModeValue lighting = stateset->getMode(GL_LIGHTING);
+        if (lighting!=osg::StateAttribute::INHERIT)
+        {
+            if (lighting & osg::StateAttribute::ON) _lightingOn = true;
+            else _lightingOff = true;
+        }
+
+        return !(_lightingOn && _lightingOff);
+    }
+
+    bool            _instanceable;
+    bool            _lightingOn;
+    bool            _lightingOff;
+    unsigned int    _textureUnitMask;
+};
+
+class SetNumInstancesVisitor : public osg::NodeVisitor
+{
+public:
+
+    SetNumInstancesVisitor(unsigned int numInstances, const osg::BoundingBox& bound):
+        osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN),
+        _numInstances(numInstances),
+        _bound(bound) {}
+
+    void apply(osg::Geode& geode)
+    {
+        for(unsigned int i=0; i<geode.getNumDrawables(); ++i)
+        {
+            osg::Geometry* geometry = geode.getDrawable(i)->asGeometry();
+            if (!geometry) continue;
+
+            for(unsigned int p=0; p<geometry->getNumPrimitiveSets(); ++p)
+            {
+                geometry->getPrimitiveSet(p)->setNumInstances(_numInstances);
+            }
+
+            // instanced primitives can't be compiled into display lists, and the bound has to cover every instance.
+            geometry->setUseDisplayList(false);
+            geometry->setUseVertexBufferObjects(true);
+            geometry->setInitialBound(_bound);
+            geometry->dirtyBound();
+        }
+    }
+
+    unsigned int        _numInstances;
+    osg::BoundingBox    _bound;
+};
+
+osg::Program* ObjectPlacer::getInstancingProgram(bool lighting, unsigned int textureUnitMask)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_instancingProgramMutex);
+
+    osg::ref_ptr<osg::Program>& program = _instancingPrograms[std::make_pair(lighting, textureUnitMask)];
+    if (program.valid()) return program.get();
+
+    std::ostringstream vertexShader;
+    vertexShader << "#version 120\n"
+                 << "#extension GL_EXT_gpu_shader4 : enable\n"
+                 << "\n"
+                 << "uniform sampler2D vpb_instanceTable;\n"
+                 << "\n"
+                 << "vec3 rotate(vec4 q, vec3 v)\n"
+                 << "{\n"
+                 << "    return v + 2.0 * cross(q.xyz, cross(q.xyz, v) + q.w * v);\n"
+                 << "}\n"
+                 << "\n"
+                 << "void main()\n"
+                 << "{\n"
+                 << "    vec4 positionScale = texelFetch2D(vpb_instanceTable, ivec2(0, gl_InstanceID), 0);\n"
+                 << "    vec4 rotation = texelFetch2D(vpb_instanceTable, ivec2(1, gl_InstanceID), 0);\n"
+                 << "    vec4 position = vec4(rotate(rotation, gl_Vertex.xyz) * positionScale.w + positionScale.xyz * gl_Vertex.w, gl_Vertex.w);\n"
+                 << "    vec4 eyePosition = gl_ModelViewMatrix * position;\n";
+
+    if (lighting)
+    {
+        // the vertex colours track the ambient and diffuse material, as with the Material that osgViewer sets by default.
+        vertexShader << "    vec3 normal = normalize(gl_NormalMatrix * rotate(rotation, gl_Normal));\n"
+                     << "    vec3 lightDir = normalize(gl_LightSource[0].position.xyz - eyePosition.xyz * gl_LightSource[0].position.w);\n"
+                     << "    float diffuse = max(dot(normal, lightDir), 0.0);\n"
+                     << "    vec4 lighting = gl_LightModel.ambient + gl_LightSource[0].ambient + gl_LightSource[0].diffuse * diffuse;\n"
+                     << "    gl_FrontColor = vec4(gl_Color.rgb * min(lighting.rgb, vec3(1.0)), gl_Color.a);\n";
+    }
+    else
+    {
+        vertexShader << "    gl_FrontColor = gl_Color;\n";
+    }
+
+    vertexShader << "    gl_BackColor = gl_FrontColor;\n";
+
+    for(unsigned int unit=0; unit<s_instanceTableTextureUnit; ++unit)
+    {
+        if (textureUnitMask & (1u << unit))
+        {
+            vertexShader << "    gl_TexCoord["<<unit<<"] = gl_TextureMatrix["<<unit<<"] * gl_MultiTexCoord"<<unit<<";\n";
+        }
+    }
+
+    vertexShader << "    gl_FogFragCoord = abs(eyePosition.z);\n"
+                 << "    gl_Position = gl_ProjectionMatrix * eyePosition;\n"
+                 << "}\n";
+
+    program = new osg::Program;
+    program->setName(lighting ? "vpb_Instancing_Lit" : "vpb_Instancing");
+    program->addShader(new osg::Shader(osg::Shader::VERTEX, vertexShader.str()));
+
+    return program.get();
+}
+
+static osg::ref_ptr<osg::Node> createInstances(osg::Node* sharedModel, const PlacementList& placements, osg::Program* program)
+{
+    // the table holds positions relative to the centre of the instances so that they keep their precision as floats.
+    osg::Vec3d origin;
+    for(PlacementList::const_iterator itr = placements.begin();
+        itr != placements.end();
+        ++itr)
+    {
+        origin += itr->_translation;
+    }
+    origin /= double(placements.size());
+
+    osg::ref_ptr<osg::Image> table = new osg::Image;
+    table->allocateImage(2, placements.size(), 1, GL_RGBA, GL_FLOAT);
+    table->setInternalTextureFormat(GL_RGBA32F_ARB);
+
+    const osg::BoundingSphere& modelBound = sharedModel->getBound();
+    osg::BoundingBox bound;
+
+    for(unsigned int i=0; i<placements.size(); ++i)
+    {
+        const Placement& placement = placements[i];
+        osg::Vec3d position = placement._translation - origin;
+        double scale = placement._scale.x();
+
+        float* row = reinterpret_cast<float*>(table->data(0, i));
+        row[0] = position.x();
+        row[1] = position.y();
+        row[2] = position.z();
+        row[3] = scale;
+        row[4] = placement._rotation.x();
+        row[5] = placement._rotation.y();
+        row[6] = placement._rotation.z();
+        row[7] = placement._rotation.w();
+
+        if (modelBound.valid())
+        {
+            bound.expandBy(osg::BoundingSphere(placement._rotation * osg::Vec3d(modelBound.center()) * scale + position, modelBound.radius() * scale));
+        }
+    }
+
+    osg::ref_ptr<osg::Texture2D> texture = new osg::Texture2D(table.get());
+    texture->setFilter(osg::Texture::MIN_FILTER, osg::Texture::NEAREST);
+    texture->setFilter(osg::Texture::MAG_FILTER, osg::Texture::NEAREST);
+    texture->setResizeNonPowerOfTwoHint(false);
+
+    // copy the nodes and primitive sets of the shared model, while sharing its arrays and statesets.
+    osg::ref_ptr<osg::Node> instancedModel = osg::clone(sharedModel, osg::CopyOp::DEEP_COPY_NODES | osg::CopyOp::DEEP_COPY_DRAWABLES | osg::CopyOp::DEEP_COPY_PRIMITIVES);
+
+    SetNumInstancesVisitor setNumInstances(placements.size(), bound);
+    instancedModel->accept(setNumInstances);
+
+    osg::ref_ptr<osg::MatrixTransform> instances = new osg::MatrixTransform(osg::Matrixd::translate(origin));
+    instances->setName("instances");
+    instances->addChild(instancedModel.get());
+
+    osg::StateSet* stateset = instances->getOrCreateStateSet();
+    stateset->setAttributeAndModes(program, osg::StateAttribute::ON);
+    stateset->setTextureAttribute(s_instanceTableTextureUnit, texture.get());
+    stateset->addUniform(new osg::Uniform("vpb_instanceTable", int(s_instanceTableTextureUnit)));
+
+    return instances;
+}
+
+typedef std::set<osg::Node*> NodeSet;
+
+// copy the groups on the paths to the instanced placements, leaving the placements out, and share everything else.
+static osg::ref_ptr<osg::Node> cloneWithoutPlacements(osg::Node* node, const NodeSet& placed, const NodeSet& ancestors)
+{
+    if (ancestors.count(node)==0 || !node->asGroup()) return node;
+
+    osg::ref_ptr<osg::Group> group = osg::clone(node->asGroup(), osg::CopyOp::SHALLOW_COPY);
+    group->removeChildren(0, group->getNumChildren());
+
+    for(unsigned int i=0; i<node->asGroup()->getNumChildren(); ++i)
+    {
+        osg::Node* child = node->asGroup()->getChild(i);
+        if (placed.count(child)==0) group->addChild(cloneWithoutPlacements(child, placed, ancestors).get());
+    }
+
+    return group;
+}
+
+bool ObjectPlacer::placeModels(DestinationTile& destinationTile, const ModelList& models)
+{
+    if (!destinationTile._dataSet->getInstanceRepeatedModels())
+    {
+        for(ModelList::const_iterator itr = models.begin();
+            itr != models.end();
+            ++itr)
+        {
+            place(destinationTile, itr->get());
+        }
+        return true;
+    }
+
+    CollectPlacementsVisitor collectPlacements;
+    for(ModelList::const_iterator itr = models.begin();
+        itr != models.end();
+        ++itr)
+    {
+        collectPlacements._matrix.makeIdentity();
+        (*itr)->accept(collectPlacements);
+    }
+
+    NodeSet placed;
+    NodeSet ancestors;
+    std::vector< osg::ref_ptr<osg::Node> > instancedNodes;
+    unsigned int numInstances = 0;
+
+    for(std::vector<osg::Node*>::iterator itr = collectPlacements._sharedModels.begin();
+        itr != collectPlacements._sharedModels.end();
+        ++itr)
+    {
+        osg::Node* sharedModel = *itr;
+        PlacementList uniformPlacements;
+
+        const PlacementList& placements = collectPlacements._placementMap[sharedModel];
+        for(PlacementList::const_iterator pitr = placements.begin();
+            pitr != placements.end();
+            ++pitr)
+        {
+            if (pitr->isUniform()) uniformPlacements.push_back(*pitr);
+        }
+
+        if (uniformPlacements.size()<_minimumNumInstances) continue;
+
+        InstanceableVisitor instanceable;
+        sharedModel->accept(instanceable);
+        if (!instanceable._instanceable)
+        {
+            log(osg::INFO,"ObjectPlacer: model %s placed %d times can't be instanced",sharedModel->getName().c_str(),int(uniformPlacements.size()));
+            continue;
+        }
+
+        for(unsigned int first=0; first<uniformPlacements.size(); first+=s_maximumNumInstancesPerTable)
+        {
+            unsigned int last = osg::minimum(first+s_maximumNumInstancesPerTable, (unsigned int)uniformPlacements.size());
+            PlacementList tablePlacements(uniformPlacements.begin()+first, uniformPlacements.begin()+last);
+            instancedNodes.push_back(createInstances(sharedModel, tablePlacements,
+                                                     getInstancingProgram(instanceable.getLighting(), instanceable._textureUnitMask)));
+        }
+
+        for(PlacementList::iterator pitr = uniformPlacements.begin();
+            pitr != uniformPlacements.end();
+            ++pitr)
+        {
+            placed.insert(pitr->_transform);
+            ancestors.insert(pitr->_parentPath.begin(), pitr->_parentPath.end());
+        }
+
+        numInstances += uniformPlacements.size();
+    }
+
+    for(ModelList::const_iterator itr = models.begin();
+        itr != models.end();
+        ++itr)
+    {
+        if (placed.count(itr->get())!=0) continue;
+
+        osg::ref_ptr<osg::Node> model = cloneWithoutPlacements(itr->get(), placed, ancestors);
+        place(destinationTile, model.get());
+    }
+
+    for(std::vector< osg::ref_ptr<osg::Node> >::iterator itr = instancedNodes.begin();
+        itr != instancedNodes.end();
+        ++itr)
+    {
+        destinationTile.addNodeToScene(itr->get(), true);
+    }
+
+    if (numInstances!=0)
+    {
+        log(osg::NOTICE,"ObjectPlacer replaced %d placements with %d instance tables on tile level=%u X=%u Y=%u",
+            numInstances, int(instancedNodes.size()), destinationTile._level, destinationTile._tileX, destinationTile._tileY);
+
+        Metrics::instance()->count("vpb_model_instances_total", numInstances);
+        Metrics::instance()->count("vpb_model_instance_tables_total", instancedNodes.size());
+    }
+
+    return true;
+}
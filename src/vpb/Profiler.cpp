@@ -0,0 +1,248 @@
+/* -*-c++-*- VirtualPlanetBuilder - Copyright (C) 1998-2007 Robert Osfield
+ *
+ * This library is open source and may be redistributed and/or modified under
+ * the terms of the OpenSceneGraph Public License (OSGPL) version 0.0 or
+ * (at your option) any later version.  The full license is in LICENSE file
+ * included with this distribution, and on the openscenegraph.org website.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * OpenSceneGraph Public License for more details.
+*/
+
+#include <vpb/Profiler>
+#include <vpb/BuildLog>
+#include <vpb/System>
+
+#include <osgDB/fstream>
+
+#include <OpenThreads/ScopedLock>
+
+#include <algorithm>
+#include <iomanip>
+#include <map>
+#include <sstream>
+
+using namespace vpb;
+
+// each thread's buffer, so recording a phase needn't look the thread up.
+static VPB_THREAD_LOCAL Profiler::ThreadBuffer* s_threadBuffer = 0;
+
+Profiler* Profiler::instance()
+{
+    static osg::ref_ptr<Profiler> s_profiler = new Profiler;
+    return s_profiler.get();
+}
+
+Profiler::Profiler():
+    _enabled(false)
+{
+    _startTick = osg::Timer::instance()->tick();
+}
+
+Profiler::~Profiler()
+{
+}
+
+Profiler::ThreadBuffer* Profiler::getThreadBuffer()
+{
+    if (!s_threadBuffer)
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_threadBuffersMutex);
+        _threadBuffers.push_back(new ThreadBuffer(_threadBuffers.size()));
+        s_threadBuffer = _threadBuffers.back().get();
+    }
+    return s_threadBuffer;
+}
+
+void Profiler::begin(const char* name)
+{
+    ThreadBuffer* buffer = getThreadBuffer();
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(buffer->mutex);
+
+    Phase phase;
+    phase.name = name;
+    phase.start = osg::Timer::instance()->tick();
+    phase.end = 0;
+    phase.childTime = 0.0;
+    phase.depth = buffer->openPhases.size();
+
+    buffer->openPhases.push_back(buffer->phases.size());
+    buffer->phases.push_back(phase);
+}
+
+void Profiler::end()
+{
+    ThreadBuffer* buffer = getThreadBuffer();
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(buffer->mutex);
+
+    // the phases were cleared while this one was open.
+    if (buffer->openPhases.empty()) return;
+
+    Phase& phase = buffer->phases[buffer->openPhases.back()];
+    phase.end = osg::Timer::instance()->tick();
+    buffer->openPhases.pop_back();
+
+    if (!buffer->openPhases.empty())
+    {
+        buffer->phases[buffer->openPhases.back()].childTime += osg::Timer::instance()->delta_s(phase.start, phase.end);
+    }
+}
+
+void Profiler::clear()
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_threadBuffersMutex);
+    for(ThreadBuffers::iterator itr = _threadBuffers.begin();
+        itr != _threadBuffers.end();
+        ++itr)
+    {
+        ThreadBuffer* buffer = itr->get();
+        OpenThreads::ScopedLock<OpenThreads::Mutex> buffer_lock(buffer->mutex);
+        buffer->phases.clear();
+        buffer->openPhases.clear();
+    }
+
+    _startTick = osg::Timer::instance()->tick();
+}
+
+static void writeJSONString(std::ostream& out, const char* str)
+{
+    out<<'"';
+    for(const char* c = str; *c; ++c)
+    {
+        if (*c=='"' || *c=='\\') out<<'\\';
+        out<<*c;
+    }
+    out<<'"';
+}
+
+bool Profiler::writeChromeTrace(const std::string& filename) const
+{
+    osgDB::ofstream fout(filename.c_str());
+    if (!fout)
+    {
+        log(osg::NOTICE,"Error: unable to write profile trace %s",filename.c_str());
+        return false;
+    }
+
+    int pid = getProcessID();
+
+    fout<<"{\"traceEvents\":["<<std::endl;
+
+    bool first = true;
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_threadBuffersMutex);
+    for(ThreadBuffers::const_iterator itr = _threadBuffers.begin();
+        itr != _threadBuffers.end();
+        ++itr)
+    {
+        const ThreadBuffer* buffer = itr->get();
+        OpenThreads::ScopedLock<OpenThreads::Mutex> buffer_lock(buffer->mutex);
+
+        for(std::vector<Phase>::const_iterator pitr = buffer->phases.begin();
+            pitr != buffer->phases.end();
+            ++pitr)
+        {
+            // phases still open, such as the run itself, end now.
+            osg::Timer_t endTick = pitr->end!=0 ? pitr->end : osg::Timer::instance()->tick();
+
+            if (!first) fout<<","<<std::endl;
+            first = false;
+
+            fout<<"{\"name\":";
+            writeJSONString(fout, pitr->name);
+            fout<<",\"cat\":\"vpb\",\"ph\":\"X\",\"ts\":"<<osg::Timer::instance()->delta_u(_startTick, pitr->start)
+                <<",\"dur\":"<<osg::Timer::instance()->delta_u(pitr->start, endTick)
+                <<",\"pid\":"<<pid<<",\"tid\":"<<buffer->threadID<<"}";
+        }
+    }
+
+    fout<<std::endl<<"],\"displayTimeUnit\":\"ms\"}"<<std::endl;
+
+    return true;
+}
+
+void Profiler::computeSummaries(PhaseSummaries& summaries) const
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_threadBuffersMutex);
+    for(ThreadBuffers::const_iterator itr = _threadBuffers.begin();
+        itr != _threadBuffers.end();
+        ++itr)
+    {
+        const ThreadBuffer* buffer = itr->get();
+        OpenThreads::ScopedLock<OpenThreads::Mutex> buffer_lock(buffer->mutex);
+
+        for(std::vector<Phase>::const_iterator pitr = buffer->phases.begin();
+            pitr != buffer->phases.end();
+            ++pitr)
+        {
+            if (pitr->end==0) continue;
+
+            double duration = osg::Timer::instance()->delta_s(pitr->start, pitr->end);
+
+            PhaseSummary& summary = summaries[pitr->name];
+            ++summary.count;
+            summary.totalTime += duration;
+            summary.selfTime += duration - pitr->childTime;
+            summary.maxTime = osg::maximum(summary.maxTime, duration);
+        }
+    }
+}
+
+void Profiler::reportSummary(std::ostream& out) const
+{
+    PhaseSummaries summaries;
+    computeSummaries(summaries);
+
+    if (summaries.empty()) return;
+
+    // most expensive phases first.
+    typedef std::vector< std::pair<double, std::string> > PhaseOrder;
+    PhaseOrder order;
+    for(PhaseSummaries::iterator itr = summaries.begin();
+        itr != summaries.end();
+        ++itr)
+    {
+        order.push_back(PhaseOrder::value_type(itr->second.selfTime, itr->first));
+    }
+    std::sort(order.begin(), order.end());
+    std::reverse(order.begin(), order.end());
+
+    out<<"Profile summary, times in seconds summed over all threads:"<<std::endl;
+    out<<"    "<<std::left<<std::setw(20)<<"phase"<<std::right
+       <<std::setw(9)<<"count"<<std::setw(13)<<"total"<<std::setw(13)<<"self"
+       <<std::setw(13)<<"average"<<std::setw(13)<<"longest"<<std::endl;
+
+    out<<std::fixed<<std::setprecision(3);
+    for(PhaseOrder::iterator itr = order.begin();
+        itr != order.end();
+        ++itr)
+    {
+        const PhaseSummary& summary = summaries[itr->second];
+        out<<"    "<<std::left<<std::setw(20)<<itr->second<<std::right
+           <<std::setw(9)<<summary.count<<std::setw(13)<<summary.totalTime<<std::setw(13)<<summary.selfTime
+           <<std::setw(13)<<summary.totalTime/double(summary.count)<<std::setw(13)<<summary.maxTime<<std::endl;
+    }
+}
+
+void Profiler::write()
+{
+    if (!_enabled) return;
+
+    if (!_traceFileName.empty()) writeChromeTrace(_traceFileName);
+
+    std::ostringstream summary;
+    reportSummary(summary);
+
+    std::istringstream lines(summary.str());
+    std::string line;
+    while (std::getline(lines, line))
+    {
+        log(osg::NOTICE,"%s",line.c_str());
+    }
+
+    clear();
+}
@@ -14,6 +14,8 @@
 #include <vpb/PropertyFile>
 #include <vpb/FileUtils>
 
+#include <OpenThreads/ScopedLock>
+
 #include <string.h>
 
 #include <iostream>
@@ -163,6 +165,7 @@ bool vpb::Parameter::getString(std::string& str)
 
 
 PropertyFile::PropertyFile(const std::string& filename):
+    _fileOutOfDate(false),
     _fileName(filename),
     _syncCount(0),
     _propertiesModified(false),
@@ -184,14 +187,22 @@ PropertyFile::~PropertyFile()
     
 void PropertyFile::setProperty(const std::string& property, Parameter value)
 {
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+
     std::string originalValue = _propertyMap[property];
     value.getString(_propertyMap[property]);
     
-    if (_propertyMap[property] != originalValue) _propertiesModified=true;
+    if (_propertyMap[property] != originalValue)
+    {
+        _propertiesModified=true;
+        _modifiedProperties.insert(property);
+    }
 }
 
 bool PropertyFile::getProperty(const std::string& property, Parameter value) const
 {
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+
     PropertyMap::const_iterator itr = _propertyMap.find(property);
     if (itr != _propertyMap.end())
     {
@@ -205,8 +216,35 @@ bool PropertyFile::getProperty(const std::string& property, Parameter value) con
     return false;
 }
 
+void PropertyFile::applyProperty(const std::string& property, const std::string& value)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+
+    _propertyMap[property] = value;
+    _fileOutOfDate = true;
+}
+
+bool PropertyFile::isFileOutOfDate() const
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+
+    return _fileOutOfDate;
+}
+
+PropertyFile::PropertyMap PropertyFile::getPropertyMap() const
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+
+    return _propertyMap;
+}
+
 bool PropertyFile::read()
 {
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+
+    // the journal's reader keeps the properties up to date.
+    if (_journal.valid()) return true;
+
     char* data = 0;
     {
         FileProxy file(_fileName);
@@ -314,11 +352,42 @@ bool PropertyFile::read()
 
 bool PropertyFile::write()
 {
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+
     if (!_propertiesModified)
     {
         return false;
     }
 
+    if (_journal.valid())
+    {
+        TaskJournal::Properties properties;
+        for(PropertyNames::iterator itr = _modifiedProperties.begin();
+            itr != _modifiedProperties.end();
+            ++itr)
+        {
+            properties[*itr] = _propertyMap[*itr];
+        }
+
+        _modifiedProperties.clear();
+        _propertiesModified = false;
+        _fileOutOfDate = true;
+
+        return _journal->append(_fileName, properties);
+    }
+
+    return writeFileImplementation();
+}
+
+bool PropertyFile::writeFile()
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+
+    return writeFileImplementation();
+}
+
+bool PropertyFile::writeFileImplementation()
+{
     FileProxy file(_fileName);
     
 #if 0
@@ -361,12 +430,16 @@ bool PropertyFile::write()
 #endif
     
     _propertiesModified = false;
+    _modifiedProperties.clear();
+    _fileOutOfDate = false;
 
     return true;
 }
 
 void PropertyFile::report(std::ostream& out)
 {
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+
     out<<"Properties:"<<std::endl;
     for(PropertyMap::iterator itr = _propertyMap.begin();
         itr != _propertyMap.end();
@@ -17,6 +17,8 @@
 #include <vpb/DataSet>
 #include <vpb/HeightFieldMapper>
 #include <vpb/ExtrudeVisitor>
+#include <vpb/GeometryBatcher>
+#include <vpb/Metrics>
 #include <vpb/System>
 
 #include <osg/NodeVisitor>
@@ -324,56 +326,96 @@ struct ComputeBoundd : public osg::PrimitiveFunctor
         BoundingBoxd    _bb;
 };
 
-class ShapeFileOverlapingHeightFieldPlacer : public osg::NodeVisitor
+enum ShapeFileType
+{
+    Forest,
+    Building
+};
+
+static bool overlap2D(const BoundingBoxd& lhs, const BoundingBoxd& rhs)
+{
+    return !((lhs.xMin() > rhs.xMax()) || (rhs.xMin() > lhs.xMax()) || (lhs.yMin() > rhs.yMax()) || (rhs.yMin() > lhs.yMax()));
+}
+
+class ShapeFilePlacer::FeatureIndex : public osg::Referenced
 {
     public:
-    
-        enum ShapeFileType
+
+        struct Feature
         {
-            Forest,
-            Building
+            Feature():
+                _order(0),
+                _geode(0),
+                _shapeType(Building),
+                _height(10.0) {}
+
+            BoundingBoxd                _bb;
+            unsigned int                _order;
+            unsigned int                _geode;
+            osg::ref_ptr<osg::Geometry> _geometry;
+            ShapeFileType               _shapeType;
+            double                      _height;
         };
-        
-        ShapeFileOverlapingHeightFieldPlacer(DestinationTile & dt, osg::HeightField & hf) :
-            _hf(hf),
-            _dt(dt),
+
+        struct GeodeEntry
+        {
+            osg::ref_ptr<osg::Geode>    _geode;
+            osg::NodePath               _parentPath;
+        };
+
+        typedef std::vector<Feature> Features;
+        typedef std::vector<GeodeEntry> GeodeEntries;
+        typedef std::vector<const Feature*> FeatureList;
+
+        FeatureIndex(osg::Node* model);
+
+        /** Collect the features whose bounds overlap the extents, in the order they appear in the shapefile.*/
+        void query(const BoundingBoxd& extents, FeatureList& features) const;
+
+        const GeodeEntry& getGeodeEntry(unsigned int i) const { return _geodes[i]; }
+
+        unsigned int getNumFeatures() const { return _features.size(); }
+
+    protected:
+
+        struct TreeNode
+        {
+            TreeNode(): _first(0), _count(0) {}
+
+            BoundingBoxd    _bb;
+            unsigned int    _first;
+            unsigned int    _count;
+        };
+
+        typedef std::vector<TreeNode> TreeLevel;
+
+        void queryLevel(unsigned int level, unsigned int first, unsigned int count, const BoundingBoxd& extents, FeatureList& features) const;
+
+        osg::ref_ptr<osg::Node>     _model;
+        GeodeEntries                _geodes;
+        Features                    _features;
+
+        // _levels[0] groups the features, each level above groups the nodes of the level below, the last holds the root.
+        std::vector<TreeLevel>      _levels;
+};
+
+// gathers the features of a shapefile along with their bounds, type and height, resolving the attribute names
+// given by the descriptions of their geodes.
+class FeatureCollector : public osg::NodeVisitor
+{
+    public:
+
+        FeatureCollector(ShapeFilePlacer::FeatureIndex::Features& features, ShapeFilePlacer::FeatureIndex::GeodeEntries& geodes):
+            osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN),
+            _features(features),
+            _geodes(geodes),
             _TypeAttributeName("TypeAttributeName"),
             _HeightAttributeName("HeightAttributeName")
         {
-            _createdModel = new osg::Group;
-            _nodeStack.push_back(_createdModel.get());
             _typeAttributeNameStack.push_back("NAME");
             _heightAttributeNameStack.push_back("HGT");
-       }
-        
-        virtual void apply(osg::Node& node)
-        {
-            // ** if sub-graph overlap the HeightField
-            if (overlap(node.getBound()))
-            {
-                // ** clone the node
-                osg::ref_ptr<osg::Node> clonedNode = static_cast<osg::Node*>(node.clone(osg::CopyOp::SHALLOW_COPY));
-                
-                // ** if it's osg::Group type, clean children
-                osg::Group * clonedGroup = clonedNode->asGroup();
-                if (clonedGroup) clonedGroup->removeChild(0, clonedGroup->getNumChildren());
-                
-                addAndTraverse(node, clonedNode.get());
-            }
-        }
-        
-        void addAndTraverse(osg::Node& node, osg::Node * clonedNode)
-        {
-            // ** link the child with new scene graph
-            osg::Group * group = _nodeStack.back()->asGroup();
-            if (group) group->addChild(clonedNode);
-            
-            // ** push node, traverse, pop node
-            _nodeStack.push_back(clonedNode);
-            traverse(node);
-            _nodeStack.pop_back();
         }
-        
+
         bool pushAttributeNames(osg::Node& node)
         {
             if (node.getDescriptions().empty()) return false;
@@ -395,222 +437,396 @@ class ShapeFileOverlapingHeightFieldPlacer : public osg::NodeVisitor
             {
                 if (typeAttributeName.empty() && !_typeAttributeNameStack.empty()) typeAttributeName = _typeAttributeNameStack.back();
                 if (heightAttributeName.empty() && !_heightAttributeNameStack.empty()) heightAttributeName = _heightAttributeNameStack.back();
-            
-                // osg::notify(osg::NOTICE)<<"PushingAttributeName("<<typeAttributeName<<","<<heightAttributeName<<")"<<std::endl;
-            
+
                 _typeAttributeNameStack.push_back(typeAttributeName);
                 _heightAttributeNameStack.push_back(heightAttributeName);
 
                 return true;
             }
 
-        
             return false;
         }
-        
+
         void popAttributeNames()
         {
             if (_typeAttributeNameStack.size()>1) _typeAttributeNameStack.pop_back();
             if (_heightAttributeNameStack.size()>1) _heightAttributeNameStack.pop_back();
         }
-        
-        const std::string& getTypeAttributeName() const
-        {
-            return _typeAttributeNameStack.back();
-        }
 
-        const std::string& getHeightAttributeName() const
-        {
-            return _heightAttributeNameStack.back();
-        }
-        
         virtual void apply(osg::Geode& node)
         {
-            const osg::EllipsoidModel* em = _dt._dataSet->getEllipsoidModel();
-            bool mapLatLongsToXYZ = _dt._dataSet->mapLatLongsToXYZ();
-            bool useLocalToTileTransform = _dt._dataSet->getUseLocalTileTransform();
-            double verticalScale = _dt._dataSet->getVerticalScale();
+            bool pushedAttributeNames = pushAttributeNames(node);
 
-            // const osg::Matrixd& localToWorld = _dt._localToWorld;
-            const osg::Matrixd& worldToLocal = _dt._worldToLocal;
-            
-            const osg::BoundingBox & bb = node.getBoundingBox();
-            
-            // ** if sub-graph overlap the HeightField
-            if (overlap(bb.xMin(), bb.yMin(), bb.xMax(), bb.yMax()))
+            const std::string& typeAttributeName = _typeAttributeNameStack.back();
+            const std::string& heightAttributeName = _heightAttributeNameStack.back();
+
+            unsigned int geodeIndex = _geodes.size();
+            bool geodeHasFeatures = false;
+
+            for (unsigned int i = 0; i < node.getNumDrawables(); ++i)
             {
-                // ** clone the geode
-                osg::ref_ptr<osg::Geode> clonedGeode = static_cast<osg::Geode*>(node.clone(osg::CopyOp::SHALLOW_COPY));
-                
-                // ** clean drawable
-                unsigned int numDrawables = clonedGeode->getNumDrawables();
-                clonedGeode->removeDrawables(0, numDrawables);
-            
-                bool pushedAttributeNames = pushAttributeNames(node);
+                osg::Drawable * drawable = node.getDrawable(i);
+                osg::Geometry * geom = drawable ? drawable->asGeometry() : 0;
+                if (geom == NULL) continue;
+
+                ShapeFilePlacer::FeatureIndex::Feature feature;
+                feature._order = _features.size();
+                feature._geode = geodeIndex;
+                feature._geometry = geom;
 
-                for (unsigned int i = 0; i < numDrawables; ++i)
+                osgSim::ShapeAttributeList* sal = dynamic_cast<osgSim::ShapeAttributeList*>(geom->getUserData());
+                if (sal)
                 {
-                    // ** get the geometry
-                    osg::Drawable * drawable = node.getDrawable(i);
-                    if (drawable == NULL) continue;
-                    
-                    osg::Geometry * geom = drawable->asGeometry();
-                    if (geom == NULL) continue;
-
-                    ShapeFileType shapeType = Building;
-                    double height = 10.0;
-                    
-                    osgSim::ShapeAttributeList* sal = dynamic_cast<osgSim::ShapeAttributeList*>(geom->getUserData());
                     for(osgSim::ShapeAttributeList::iterator sitr = sal->begin(); sitr != sal->end(); ++sitr)
                     {
-                        if ((sitr->getName() == getTypeAttributeName()) &&
+                        if ((sitr->getName() == typeAttributeName) &&
                             (sitr->getType() == osgSim::ShapeAttribute::STRING))
                         {
                             if (sitr->getString())
                             {
-                                if (strncmp(sitr->getString(), "Building", 8) == 0) shapeType = Building;
-                                else if (strncmp(sitr->getString(), "Forest", 6) == 0) shapeType = Forest;
+                                if (strncmp(sitr->getString(), "Building", 8) == 0) feature._shapeType = Building;
+                                else if (strncmp(sitr->getString(), "Forest", 6) == 0) feature._shapeType = Forest;
                             }
                         }
-                        
-                        else if (sitr->getName() == getHeightAttributeName())
+
+                        else if (sitr->getName() == heightAttributeName)
                         {
-                            if (sitr->getType() == osgSim::ShapeAttribute::DOUBLE) height = sitr->getDouble();
-                            else if (sitr->getType() == osgSim::ShapeAttribute::INTEGER) height = double(sitr->getInt());
+                            if (sitr->getType() == osgSim::ShapeAttribute::DOUBLE) feature._height = sitr->getDouble();
+                            else if (sitr->getType() == osgSim::ShapeAttribute::INTEGER) feature._height = double(sitr->getInt());
                         }
                     }
-                    
-                    height *= verticalScale;
-
-                    // ** if geometry overlap the HeightField
-                    ComputeBoundd cb;
-                    geom->accept(cb);
-                    
-                    const BoundingBoxd & geoBB = cb._bb;
-                    if (overlap(geoBB.xMin(), geoBB.yMin(), geoBB.xMax(), geoBB.yMax()))
-                    {
-                        osg::ref_ptr<osg::Geometry> clonedGeom = static_cast<osg::Geometry*>(geom->clone(osg::CopyOp::DEEP_COPY_ARRAYS | osg::CopyOp::DEEP_COPY_PRIMITIVES));
-                        
-                        HeightFieldMapper hfm(_hf, _dt._extents.xMin(), _dt._extents.xMax(), _dt._extents.yMin(), _dt._extents.yMax());
-                        hfm.setMode(shapeType == Building ? HeightFieldMapper::PER_GEOMETRY : HeightFieldMapper::PER_VERTEX);
-                        
-                        // ** if the geometry have centroid out of the HeightField,
-                        // **  don't extrude and insert the geometry in scene graph
-                        if (hfm.map(*clonedGeom.get()))
-                        {
-                            osg::Vec3d vec(0.0, 0.0, height);
-                            
-                            // ** Extrude the geometry
-                            ExtrudeVisitor ev(shapeType == Building ? ExtrudeVisitor::PER_GEOMETRY : ExtrudeVisitor::PER_VERTEX, 
-                                              ExtrudeVisitor::Replace,
-                                              vec);
-                            ev.extrude(*clonedGeom.get());
-                                
-                            
-                            if (useLocalToTileTransform || mapLatLongsToXYZ)
-                            {
-                                osg::Vec3dArray * vertexArray = dynamic_cast<osg::Vec3dArray*>(clonedGeom->getVertexArray());
-                                MatrixMultiplyArrayFunctor mmaf(worldToLocal, mapLatLongsToXYZ ? em : 0);
-                                std::for_each(vertexArray->begin(), vertexArray->end(), mmaf);
-                            }
-                            
-                            // ** replace VertexArray type osg::Vec3dArray by osg::Vec3Array
-                            DoubleToFloatVisitor dtfVisitor;
-                            clonedGeom->getVertexArray()->accept(dtfVisitor);
-                            clonedGeom->setVertexArray(dtfVisitor._vertexArray.get());
-                            
-                            // ** replace IndexArray type osg::ArrayUInt by osg::ArrayUShort or osg::ArrayUBytes if possible
-                            osgUtil::DrawElementTypeSimplifier dets;
-                            dets.simplify(*(clonedGeom.get()));
-                            
-                            
-                            osg::Vec4Array* colours = dynamic_cast<osg::Vec4Array*>(clonedGeom->getColorArray());
-                            if (!colours)
-                            {
-                                colours = new osg::Vec4Array(1);
-                                (*colours)[0].set(1.0f,1.0f,1.0f,1.0f);
-                                clonedGeom->setColorArray(colours);
-                                clonedGeom->setColorBinding(osg::Geometry::BIND_OVERALL);
-                            }
-                            
-                            // ** insert the geometry in scnene graph
-                            clonedGeode->addDrawable(clonedGeom.get());
+                }
 
-                            osgUtil::SmoothingVisitor sv;
-                            sv.smooth(*clonedGeom);  // this will replace the normal vector with a new one
+                ComputeBoundd cb;
+                geom->accept(cb);
+                if (!cb._bb.valid()) continue;
 
-                        }
-                    }
-                }
-                
-                osg::notify(osg::WARN) << clonedGeode->getNumDrawables() << " added on " << numDrawables << "." << std::endl;
-                addAndTraverse(node, clonedGeode.get());
-                
-                if (pushedAttributeNames) popAttributeNames();
+                feature._bb = cb._bb;
+                _features.push_back(feature);
+                geodeHasFeatures = true;
+            }
 
+            if (geodeHasFeatures)
+            {
+                ShapeFilePlacer::FeatureIndex::GeodeEntry entry;
+                entry._geode = &node;
+                entry._parentPath.assign(getNodePath().begin(), getNodePath().end()-1);
+                _geodes.push_back(entry);
             }
+
+            if (pushedAttributeNames) popAttributeNames();
         }
-    
-        bool overlap(double xMin, double yMin, double xMax, double yMax)
-        {
-            if ((_dt._extents.xMin() > xMax) || (xMin > _dt._extents.xMax()) || (_dt._extents.yMin() > yMax) || (yMin > _dt._extents.yMax()))
-                return false;
-            else
-                return true;
-        }
-        
-        bool overlap(const osg::BoundingSphere & bs)
-        {
-            double xMin = bs.center().x() - bs.radius();
-            double yMin = bs.center().y() - bs.radius();
-            double xMax = bs.center().x() + bs.radius();
-            double yMax = bs.center().y() + bs.radius();
-            return overlap(xMin, yMin, xMax, yMax);
-        }
-        
-        osg::Node * getCreatedModel() { return _createdModel.get(); }
-        
-    private:
-        
-        osg::HeightField & _hf;
-        DestinationTile & _dt;
+
+    protected:
+
+        ShapeFilePlacer::FeatureIndex::Features&        _features;
+        ShapeFilePlacer::FeatureIndex::GeodeEntries&    _geodes;
 
         std::string _TypeAttributeName;
         std::string _HeightAttributeName;
-        
-        
-        osg::fast_back_stack<osg::Node*> _nodeStack;
-        osg::ref_ptr<osg::Node> _createdModel;
-        
+
         typedef std::list<std::string> StringStack;
         StringStack _typeAttributeNameStack;
         StringStack _heightAttributeNameStack;
 };
 
+template<class T>
+struct LessCentreX
+{
+    bool operator() (const T& lhs, const T& rhs) const { return (lhs._bb.xMin()+lhs._bb.xMax()) < (rhs._bb.xMin()+rhs._bb.xMax()); }
+};
+
+template<class T>
+struct LessCentreY
+{
+    bool operator() (const T& lhs, const T& rhs) const { return (lhs._bb.yMin()+lhs._bb.yMax()) < (rhs._bb.yMin()+rhs._bb.yMax()); }
+};
+
+// Sort-Tile-Recursive packing, sort the items into vertical slices by x, sort each slice by y, then group
+// consecutive runs of the slice into nodes, giving nodes that are compact and barely overlap.
+template<class T, class TreeLevel>
+void packSortTileRecursive(std::vector<T>& items, TreeLevel& nodes, unsigned int maxEntries)
+{
+    unsigned int numItems = items.size();
+    unsigned int numNodes = (numItems+maxEntries-1)/maxEntries;
+    unsigned int numSlices = static_cast<unsigned int>(ceil(sqrt(double(numNodes))));
+    unsigned int sliceSize = osg::maximum(numSlices, 1u)*maxEntries;
+
+    std::sort(items.begin(), items.end(), LessCentreX<T>());
+
+    for(unsigned int start=0; start<numItems; start+=sliceSize)
+    {
+        unsigned int end = osg::minimum(start+sliceSize, numItems);
+        std::sort(items.begin()+start, items.begin()+end, LessCentreY<T>());
+
+        for(unsigned int first=start; first<end; first+=maxEntries)
+        {
+            typename TreeLevel::value_type node;
+            node._first = first;
+            node._count = osg::minimum(maxEntries, end-first);
+            for(unsigned int i=first; i<first+node._count; ++i)
+            {
+                node._bb.expandBy(items[i]._bb._min);
+                node._bb.expandBy(items[i]._bb._max);
+            }
+            nodes.push_back(node);
+        }
+    }
+}
+
+ShapeFilePlacer::FeatureIndex::FeatureIndex(osg::Node* model):
+    _model(model)
+{
+    FeatureCollector collector(_features, _geodes);
+    model->accept(collector);
+
+    const unsigned int maxEntries = 16;
+
+    _levels.push_back(TreeLevel());
+    packSortTileRecursive(_features, _levels.back(), maxEntries);
+
+    while (_levels.back().size()>1)
+    {
+        TreeLevel parents;
+        packSortTileRecursive(_levels.back(), parents, maxEntries);
+        _levels.push_back(parents);
+    }
+}
+
+void ShapeFilePlacer::FeatureIndex::queryLevel(unsigned int level, unsigned int first, unsigned int count, const BoundingBoxd& extents, FeatureList& features) const
+{
+    const TreeLevel& nodes = _levels[level];
+    for(unsigned int i=first; i<first+count; ++i)
+    {
+        const TreeNode& node = nodes[i];
+        if (!overlap2D(node._bb, extents)) continue;
+
+        if (level==0)
+        {
+            for(unsigned int f=node._first; f<node._first+node._count; ++f)
+            {
+                if (overlap2D(_features[f]._bb, extents)) features.push_back(&_features[f]);
+            }
+        }
+        else
+        {
+            queryLevel(level-1, node._first, node._count, extents, features);
+        }
+    }
+}
+
+struct LessFeatureOrder
+{
+    bool operator() (const ShapeFilePlacer::FeatureIndex::Feature* lhs, const ShapeFilePlacer::FeatureIndex::Feature* rhs) const { return lhs->_order < rhs->_order; }
+};
+
+void ShapeFilePlacer::FeatureIndex::query(const BoundingBoxd& extents, FeatureList& features) const
+{
+    queryLevel(_levels.size()-1, 0, _levels.back().size(), extents, features);
+
+    // keep the features in their original order so the tiles are the same however the tree is packed.
+    std::sort(features.begin(), features.end(), LessFeatureOrder());
+}
+
+ShapeFilePlacer::ShapeFilePlacer()
+{
+}
+
+ShapeFilePlacer::~ShapeFilePlacer()
+{
+}
+
+ShapeFilePlacer::FeatureIndex* ShapeFilePlacer::getFeatureIndex(osg::Node* model)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_featureIndexMutex);
+
+    osg::ref_ptr<FeatureIndex>& featureIndex = _featureIndexMap[model];
+    if (!featureIndex)
+    {
+        featureIndex = new FeatureIndex(model);
+        log(osg::NOTICE,"ShapeFilePlacer indexed %d features of %s",featureIndex->getNumFeatures(),model->getName().c_str());
+    }
+
+    return featureIndex.get();
+}
+
+// drape the feature over the height field and extrude it, returning 0 if its centroid is off the tile.
+static osg::ref_ptr<osg::Geometry> placeFeature(DestinationTile& dt, osg::HeightField& hf, const ShapeFilePlacer::FeatureIndex::Feature& feature)
+{
+    const osg::EllipsoidModel* em = dt._dataSet->getEllipsoidModel();
+    bool mapLatLongsToXYZ = dt._dataSet->mapLatLongsToXYZ();
+    bool useLocalToTileTransform = dt._dataSet->getUseLocalTileTransform();
+    double height = feature._height * dt._dataSet->getVerticalScale();
+
+    const osg::Matrixd& worldToLocal = dt._worldToLocal;
+
+    osg::ref_ptr<osg::Geometry> clonedGeom = static_cast<osg::Geometry*>(feature._geometry->clone(osg::CopyOp::DEEP_COPY_ARRAYS | osg::CopyOp::DEEP_COPY_PRIMITIVES));
+
+    HeightFieldMapper hfm(hf, dt._extents.xMin(), dt._extents.xMax(), dt._extents.yMin(), dt._extents.yMax());
+    hfm.setMode(feature._shapeType == Building ? HeightFieldMapper::PER_GEOMETRY : HeightFieldMapper::PER_VERTEX);
+
+    // ** if the geometry have centroid out of the HeightField,
+    // **  don't extrude and insert the geometry in scene graph
+    if (!hfm.map(*clonedGeom.get())) return 0;
+
+    osg::Vec3d vec(0.0, 0.0, height);
+
+    // ** Extrude the geometry
+    ExtrudeVisitor ev(feature._shapeType == Building ? ExtrudeVisitor::PER_GEOMETRY : ExtrudeVisitor::PER_VERTEX,
+                      ExtrudeVisitor::Replace,
+                      vec);
+    ev.extrude(*clonedGeom.get());
+
+    if (useLocalToTileTransform || mapLatLongsToXYZ)
+    {
+        osg::Vec3dArray * vertexArray = dynamic_cast<osg::Vec3dArray*>(clonedGeom->getVertexArray());
+        MatrixMultiplyArrayFunctor mmaf(worldToLocal, mapLatLongsToXYZ ? em : 0);
+        std::for_each(vertexArray->begin(), vertexArray->end(), mmaf);
+    }
+
+    // ** replace VertexArray type osg::Vec3dArray by osg::Vec3Array
+    DoubleToFloatVisitor dtfVisitor;
+    clonedGeom->getVertexArray()->accept(dtfVisitor);
+    clonedGeom->setVertexArray(dtfVisitor._vertexArray.get());
 
+    // ** replace IndexArray type osg::ArrayUInt by osg::ArrayUShort or osg::ArrayUBytes if possible
+    osgUtil::DrawElementTypeSimplifier dets;
+    dets.simplify(*(clonedGeom.get()));
+
+    osg::Vec4Array* colours = dynamic_cast<osg::Vec4Array*>(clonedGeom->getColorArray());
+    if (!colours)
+    {
+        colours = new osg::Vec4Array(1);
+        (*colours)[0].set(1.0f,1.0f,1.0f,1.0f);
+        clonedGeom->setColorArray(colours);
+        clonedGeom->setColorBinding(osg::Geometry::BIND_OVERALL);
+    }
+
+    osgUtil::SmoothingVisitor sv;
+    sv.smooth(*clonedGeom);  // this will replace the normal vector with a new one
+
+    return clonedGeom;
+}
+
+typedef std::map<const osg::Node*, osg::ref_ptr<osg::Node> > ClonedNodeMap;
+
+// return the clone of the geode, shallow cloning it and the groups above it that haven't been cloned yet,
+// so only the branches of the shapefile that lead to features on the tile are copied.
+static osg::Geode* getClonedGeode(const ShapeFilePlacer::FeatureIndex::GeodeEntry& entry, osg::Group* createdModel, ClonedNodeMap& clonedNodes)
+{
+    ClonedNodeMap::iterator gitr = clonedNodes.find(entry._geode.get());
+    if (gitr != clonedNodes.end()) return static_cast<osg::Geode*>(gitr->second.get());
+
+    osg::Group* parent = createdModel;
+    for(osg::NodePath::const_iterator itr = entry._parentPath.begin();
+        itr != entry._parentPath.end() && parent;
+        ++itr)
+    {
+        osg::ref_ptr<osg::Node>& clonedNode = clonedNodes[*itr];
+        if (!clonedNode)
+        {
+            clonedNode = static_cast<osg::Node*>((*itr)->clone(osg::CopyOp::SHALLOW_COPY));
+
+            osg::Group * clonedGroup = clonedNode->asGroup();
+            if (clonedGroup) clonedGroup->removeChild(0, clonedGroup->getNumChildren());
+
+            parent->addChild(clonedNode.get());
+        }
+        parent = clonedNode->asGroup();
+    }
+
+    osg::ref_ptr<osg::Geode> clonedGeode = static_cast<osg::Geode*>(entry._geode->clone(osg::CopyOp::SHALLOW_COPY));
+    clonedGeode->removeDrawables(0, clonedGeode->getNumDrawables());
+
+    if (parent) parent->addChild(clonedGeode.get());
+    clonedNodes[entry._geode.get()] = clonedGeode.get();
+
+    return clonedGeode.get();
+}
 
 bool ShapeFilePlacer::place(DestinationTile& destinationTile, osg::Node* model)
 {
-    log(osg::NOTICE,"ShapeFilePlacer::place(%s)",model->getName().c_str());
+    log(osg::INFO,"ShapeFilePlacer::place(%s)",model->getName().c_str());
 
-    
     osg::HeightField * hf = destinationTile.getSourceHeightField();
     if (hf == NULL) return true;
-      
-        
-    ShapeFileOverlapingHeightFieldPlacer shapePlacer(destinationTile, *hf);
-    model->accept(shapePlacer);
+
+    FeatureIndex* featureIndex = getFeatureIndex(model);
+
+    BoundingBoxd extents(destinationTile._extents.xMin(), destinationTile._extents.yMin(), -DBL_MAX,
+                         destinationTile._extents.xMax(), destinationTile._extents.yMax(), DBL_MAX);
+
+    FeatureIndex::FeatureList features;
+    featureIndex->query(extents, features);
+    if (features.empty()) return true;
+
+    osg::ref_ptr<osg::Group> createdModel = new osg::Group;
+    ClonedNodeMap clonedNodes;
+    unsigned int numPlaced = 0;
+
+    // merge the features placed in each geode into a few large triangle lists rather than one drawable per feature.
+    bool batchGeometry = destinationTile._dataSet->getBatchShapeFileGeometry();
+    GeometryBatcher prototypeBatcher;
+    prototypeBatcher.setFeatureIDAttribute(destinationTile._dataSet->getShapeFileFeatureIDAttribute());
+
+    typedef std::map<osg::Geode*, GeometryBatcher> GeodeBatcherMap;
+    GeodeBatcherMap geodeBatchers;
+
+    for(FeatureIndex::FeatureList::iterator itr = features.begin();
+        itr != features.end();
+        ++itr)
+    {
+        const FeatureIndex::Feature& feature = **itr;
+
+        osg::ref_ptr<osg::Geometry> placedGeom = placeFeature(destinationTile, *hf, feature);
+        if (!placedGeom) continue;
+
+        osg::Geode* geode = getClonedGeode(featureIndex->getGeodeEntry(feature._geode), createdModel.get(), clonedNodes);
+        if (batchGeometry)
+        {
+            GeodeBatcherMap::iterator bitr = geodeBatchers.find(geode);
+            if (bitr == geodeBatchers.end()) bitr = geodeBatchers.insert(GeodeBatcherMap::value_type(geode, prototypeBatcher)).first;
+            bitr->second.addGeometry(placedGeom.get(), feature._order);
+        }
+        else
+        {
+            geode->addDrawable(placedGeom.get());
+        }
+        ++numPlaced;
+    }
+
+    unsigned int numDrawables = numPlaced;
+    if (batchGeometry)
+    {
+        numDrawables = 0;
+        for(GeodeBatcherMap::iterator itr = geodeBatchers.begin();
+            itr != geodeBatchers.end();
+            ++itr)
+        {
+            numDrawables += itr->second.addBatchesTo(*(itr->first));
+        }
+    }
+
+    log(osg::INFO,"ShapeFilePlacer placed %d of %d intersecting features on tile level=%u X=%u Y=%u",
+        numPlaced, int(features.size()), destinationTile._level, destinationTile._tileX, destinationTile._tileY);
+
+    if (numPlaced!=0)
+    {
+        log(osg::INFO,"ShapeFilePlacer batched %d placed features into %d drawables on tile level=%u X=%u Y=%u",
+            numPlaced, numDrawables, destinationTile._level, destinationTile._tileX, destinationTile._tileY);
+
+        Metrics::instance()->count("vpb_shapefile_drawables_total", numPlaced, "stage=\"placed\"");
+        Metrics::instance()->count("vpb_shapefile_drawables_total", numDrawables, "stage=\"batched\"");
+    }
 
 #if 0
     osg::Material * mat = new osg::Material;
     mat->setDiffuse(osg::Material::FRONT, osg::Vec4f(1.0f,1.0f,1.0f,1.0f));
     model->getOrCreateStateSet()->setAttributeAndModes(mat, osg::StateAttribute::ON);
 #endif
-    
-    if (shapePlacer.getCreatedModel())
-        destinationTile.addNodeToScene(shapePlacer.getCreatedModel(), true);
-    
-    return true;
-}
 
+    if (numPlaced!=0)
+        destinationTile.addNodeToScene(createdModel.get(), true);
 
+    return true;
+}
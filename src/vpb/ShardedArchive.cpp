@@ -0,0 +1,919 @@
+/* -*-c++-*- VirtualPlanetBuilder - Copyright (C) 1998-2007 Robert Osfield
+ *
+ * This library is open source and may be redistributed and/or modified under
+ * the terms of the OpenSceneGraph Public License (OSGPL) version 0.0 or
+ * (at your option) any later version.  The full license is in LICENSE file
+ * included with this distribution, and on the openscenegraph.org website.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * OpenSceneGraph Public License for more details.
+*/
+
+#include <vpb/ShardedArchive>
+#include <vpb/FilePathManager>
+#include <vpb/FileUtils>
+#include <vpb/BuildLog>
+
+#include <osgDB/Registry>
+#include <osgDB/FileNameUtils>
+
+#include <OpenThreads/ScopedLock>
+#include <OpenThreads/Thread>
+
+#include <algorithm>
+#include <map>
+#include <sstream>
+#include <streambuf>
+#include <vector>
+#include <string.h>
+#include <stdint.h>
+
+#ifndef WIN32
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+#endif
+
+using namespace vpb;
+
+namespace ShardedArchiveFormat
+{
+    // the index is written in the byte order of the machine that wrote it, the byteOrder field lets readers reject foreign indices.
+    const char magic[8] = { 'V', 'P', 'B', 'A', 'R', 'C', 'H', 0 };
+    const uint32_t byteOrder = 0x01020304;
+    const uint32_t version = 1;
+
+    struct IndexHeader
+    {
+        char        magic[8];
+        uint32_t    byteOrder;
+        uint32_t    version;
+        uint32_t    numShards;
+        uint32_t    numBuckets;
+        uint64_t    numEntries;
+        uint64_t    shardTableOffset;       // uint64_t[numShards], offsets of the shard file names in the string table
+        uint64_t    bucketTableOffset;      // uint64_t[numBuckets+1], index of the first entry in each bucket
+        uint64_t    entryTableOffset;       // IndexEntry[numEntries], sorted by bucket then hash
+        uint64_t    stringTableOffset;      // null terminated strings
+        uint64_t    masterFileNameOffset;   // offset of the master file name in the string table
+    };
+
+    struct IndexEntry
+    {
+        uint64_t    hash;
+        uint64_t    offset;
+        uint64_t    size;
+        uint64_t    nameOffset;
+        uint32_t    shard;
+        uint32_t    padding;
+    };
+
+    inline uint64_t computeHash(const std::string& str)
+    {
+        // 64 bit FNV-1a
+        uint64_t hash = 14695981039346656037ULL;
+        for(std::string::const_iterator itr = str.begin(); itr != str.end(); ++itr)
+        {
+            hash ^= static_cast<unsigned char>(*itr);
+            hash *= 1099511628211ULL;
+        }
+        return hash;
+    }
+
+    inline std::string normalizeFileName(const std::string& filename)
+    {
+        std::string name = osgDB::convertFileNameToUnixStyle(filename);
+
+        // resolve "." and "dir/.." so a subtile's ../<basename>_shared/ reference matches the stored entry.
+        std::vector<std::string> segments;
+        std::string::size_type start = 0;
+        while (start<=name.size())
+        {
+            std::string::size_type end = name.find('/', start);
+            if (end==std::string::npos) end = name.size();
+
+            std::string segment(name, start, end-start);
+            if (segment==".." && !segments.empty() && segments.back()!="..") segments.pop_back();
+            else if (!segment.empty() && segment!=".") segments.push_back(segment);
+
+            start = end+1;
+        }
+
+        std::string result = (!name.empty() && name[0]=='/') ? std::string("/") : std::string();
+        for(std::vector<std::string>::iterator itr = segments.begin(); itr != segments.end(); ++itr)
+        {
+            if (itr != segments.begin()) result += '/';
+            result += *itr;
+        }
+        return result;
+    }
+
+    inline bool mapFile(const std::string& filename, const char*& data, unsigned long long& size, void*& mapping)
+    {
+        data = 0;
+        size = 0;
+        mapping = 0;
+
+#ifdef WIN32
+        FILE* fp = vpb::fopen(filename.c_str(), "rb");
+        if (!fp) return false;
+
+        fseek(fp, 0, SEEK_END);
+        long length = ftell(fp);
+        fseek(fp, 0, SEEK_SET);
+        if (length<=0)
+        {
+            vpb::fclose(fp);
+            return length==0;
+        }
+
+        char* buffer = new char[length];
+        if (fread(buffer, 1, length, fp)!=size_t(length))
+        {
+            delete [] buffer;
+            vpb::fclose(fp);
+            return false;
+        }
+        vpb::fclose(fp);
+
+        data = buffer;
+        size = length;
+        mapping = buffer;
+        return true;
+#else
+        int fd = vpb::open(filename.c_str(), O_RDONLY);
+        if (fd<0) return false;
+
+        struct stat status;
+        if (fstat(fd, &status)!=0)
+        {
+            vpb::close(fd);
+            return false;
+        }
+
+        if (status.st_size==0)
+        {
+            vpb::close(fd);
+            return true;
+        }
+
+        void* ptr = mmap(0, status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        vpb::close(fd);
+
+        if (ptr==MAP_FAILED) return false;
+
+        data = static_cast<const char*>(ptr);
+        size = status.st_size;
+        mapping = ptr;
+        return true;
+#endif
+    }
+
+    inline void unmapFile(const char*& data, unsigned long long& size, void*& mapping)
+    {
+        if (mapping)
+        {
+#ifdef WIN32
+            delete [] static_cast<char*>(mapping);
+#else
+            munmap(mapping, size);
+#endif
+        }
+        data = 0;
+        size = 0;
+        mapping = 0;
+    }
+
+    /** Read only stream buffer over a block of mapped memory, so tiles are decoded straight from the shard.*/
+    class MemoryStreamBuffer : public std::streambuf
+    {
+        public:
+
+            MemoryStreamBuffer(const char* data, unsigned long long size)
+            {
+                char* ptr = const_cast<char*>(data);
+                setg(ptr, ptr, ptr+size);
+            }
+
+        protected:
+
+            virtual pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which)
+            {
+                if (which & std::ios_base::out) return pos_type(off_type(-1));
+
+                char* ptr = gptr();
+                if (dir==std::ios_base::beg) ptr = eback()+off;
+                else if (dir==std::ios_base::cur) ptr = gptr()+off;
+                else ptr = egptr()+off;
+
+                if (ptr<eback() || ptr>egptr()) return pos_type(off_type(-1));
+
+                setg(eback(), ptr, egptr());
+                return pos_type(ptr-eback());
+            }
+
+            virtual pos_type seekpos(pos_type pos, std::ios_base::openmode which)
+            {
+                return seekoff(off_type(pos), std::ios_base::beg, which);
+            }
+    };
+
+    struct EntryLess
+    {
+        EntryLess(uint64_t mask): _mask(mask) {}
+
+        bool operator() (const std::pair<uint64_t, unsigned int>& lhs, const std::pair<uint64_t, unsigned int>& rhs) const
+        {
+            uint64_t lhs_bucket = lhs.first & _mask;
+            uint64_t rhs_bucket = rhs.first & _mask;
+            if (lhs_bucket<rhs_bucket) return true;
+            if (rhs_bucket<lhs_bucket) return false;
+            if (lhs.first<rhs.first) return true;
+            if (rhs.first<lhs.first) return false;
+            return lhs.second<rhs.second;
+        }
+
+        uint64_t _mask;
+    };
+}
+
+using namespace ShardedArchiveFormat;
+
+ShardedArchive::ShardedArchive():
+    _mode(CLOSED),
+    _indexData(0),
+    _indexSize(0),
+    _indexMapping(0)
+{
+    supportsExtension("vpba","VirtualPlanetBuilder sharded tile archive");
+
+    // lets osgDB split paths like tiles.vpba/subtile.ive into the archive and the file within it.
+    osgDB::Registry::instance()->addArchiveExtension("vpba");
+}
+
+ShardedArchive::~ShardedArchive()
+{
+    close();
+}
+
+bool ShardedArchive::acceptsExtension(const std::string& extension) const
+{
+    return osgDB::equalCaseInsensitive(extension,"vpba");
+}
+
+bool ShardedArchive::isShardedArchiveFileName(const std::string& filename)
+{
+    return osgDB::getLowerCaseFileExtension(filename)=="vpba";
+}
+
+std::string ShardedArchive::getPartFileName(const std::string& archiveName, const std::string& partName)
+{
+    return osgDB::getNameLessExtension(archiveName) + std::string(".part_") + partName + std::string(".vpba");
+}
+
+bool ShardedArchive::create(const std::string& filename, unsigned int numShards)
+{
+    close();
+
+    if (!FilePathManager::instance()->checkWritePermissionAndEnsurePathAvailability(filename))
+    {
+        log(osg::WARN,"Error: do not have write permission to create archive %s",filename.c_str());
+        return false;
+    }
+
+    if (numShards==0) numShards = 1;
+
+    for(unsigned int i=0; i<numShards; ++i)
+    {
+        std::ostringstream str;
+        str<<filename<<".shard"<<i;
+
+        osg::ref_ptr<Shard> shard = new Shard;
+        shard->_filename = str.str();
+        shard->_file = vpb::fopen(shard->_filename.c_str(), "wb");
+        if (!shard->_file)
+        {
+            log(osg::WARN,"Error: could not create archive shard %s",shard->_filename.c_str());
+            _mode = WRITING;
+            close();
+            return false;
+        }
+
+        _shards.push_back(shard);
+    }
+
+    _archiveFileName = filename;
+    _mode = WRITING;
+
+    log(osg::NOTICE,"Created archive %s with %d shards",filename.c_str(),numShards);
+
+    return true;
+}
+
+bool ShardedArchive::open(const std::string& filename)
+{
+    close();
+
+    if (!mapFile(filename, _indexData, _indexSize, _indexMapping)) return false;
+
+    const IndexHeader* header = reinterpret_cast<const IndexHeader*>(_indexData);
+    if (_indexSize<sizeof(IndexHeader) ||
+        memcmp(header->magic, magic, sizeof(magic))!=0 ||
+        header->byteOrder!=byteOrder ||
+        header->version!=version ||
+        header->numBuckets==0 ||
+        header->shardTableOffset + header->numShards*sizeof(uint64_t) > _indexSize ||
+        header->bucketTableOffset + (uint64_t(header->numBuckets)+1)*sizeof(uint64_t) > _indexSize ||
+        header->entryTableOffset + header->numEntries*sizeof(IndexEntry) > _indexSize ||
+        header->stringTableOffset > _indexSize)
+    {
+        log(osg::WARN,"Error: %s is not a valid archive index",filename.c_str());
+        unmapFile(_indexData, _indexSize, _indexMapping);
+        return false;
+    }
+
+    _archiveFileName = filename;
+    _mode = READING;
+
+    const char* strings = _indexData + header->stringTableOffset;
+    _masterFileName = strings + header->masterFileNameOffset;
+
+    // shards are named relative to the index.
+    std::string path = osgDB::getFilePath(filename);
+
+    const uint64_t* shardNames = reinterpret_cast<const uint64_t*>(_indexData + header->shardTableOffset);
+    for(unsigned int i=0; i<header->numShards; ++i)
+    {
+        osg::ref_ptr<Shard> shard = new Shard;
+        std::string shardName = strings + shardNames[i];
+        shard->_filename = (path.empty() || osgDB::isAbsolutePath(shardName)) ? shardName : path + "/" + shardName;
+
+        if (!mapFile(shard->_filename, shard->_data, shard->_dataSize, shard->_mapping))
+        {
+            log(osg::WARN,"Error: could not open archive shard %s",shard->_filename.c_str());
+        }
+
+        _shards.push_back(shard);
+    }
+
+    return true;
+}
+
+void ShardedArchive::close()
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+
+    if (_mode==WRITING)
+    {
+        Entries entries;
+        std::vector<std::string> shardFileNames;
+        for(Shards::iterator itr = _shards.begin();
+            itr != _shards.end();
+            ++itr)
+        {
+            Shard* shard = itr->get();
+            if (shard->_file)
+            {
+                fflush(shard->_file);
+                vpb::fsync(fileno(shard->_file));
+                vpb::fclose(shard->_file);
+                shard->_file = 0;
+            }
+
+            shardFileNames.push_back(osgDB::getSimpleFileName(shard->_filename));
+            entries.insert(entries.end(), shard->_entries.begin(), shard->_entries.end());
+        }
+
+        if (!_archiveFileName.empty())
+        {
+            writeIndex(_archiveFileName, _masterFileName, shardFileNames, entries);
+        }
+    }
+    else if (_mode==READING)
+    {
+        for(Shards::iterator itr = _shards.begin();
+            itr != _shards.end();
+            ++itr)
+        {
+            Shard* shard = itr->get();
+            unmapFile(shard->_data, shard->_dataSize, shard->_mapping);
+        }
+
+        unmapFile(_indexData, _indexSize, _indexMapping);
+    }
+
+    _shards.clear();
+    _mode = CLOSED;
+}
+
+bool ShardedArchive::writeIndex(const std::string& filename, const std::string& masterFileName,
+                                const std::vector<std::string>& shardFileNames, Entries& entries)
+{
+    // remove duplicates, keeping the last entry written for each file.
+    std::map<std::string, unsigned int> entryMap;
+    for(unsigned int i=0; i<entries.size(); ++i)
+    {
+        entryMap[normalizeFileName(entries[i]._filename)] = i;
+    }
+
+    uint64_t numEntries = entryMap.size();
+    uint32_t numBuckets = 1;
+    while (numBuckets<numEntries && numBuckets<0x80000000u) numBuckets <<= 1;
+    uint64_t mask = numBuckets-1;
+
+    std::string strings;
+    strings.push_back(0);
+
+    uint64_t masterFileNameOffset = strings.size();
+    strings += normalizeFileName(masterFileName);
+    strings.push_back(0);
+
+    std::vector<uint64_t> shardTable;
+    for(std::vector<std::string>::const_iterator itr = shardFileNames.begin();
+        itr != shardFileNames.end();
+        ++itr)
+    {
+        shardTable.push_back(strings.size());
+        strings += *itr;
+        strings.push_back(0);
+    }
+
+    // sort by bucket so each bucket's entries are contiguous.
+    typedef std::pair<uint64_t, unsigned int> HashIndex;
+    std::vector<HashIndex> hashIndices;
+    std::vector<uint64_t> nameOffsets(entries.size(), 0);
+    for(std::map<std::string, unsigned int>::iterator itr = entryMap.begin();
+        itr != entryMap.end();
+        ++itr)
+    {
+        hashIndices.push_back(HashIndex(computeHash(itr->first), itr->second));
+        nameOffsets[itr->second] = strings.size();
+        strings += itr->first;
+        strings.push_back(0);
+    }
+    std::sort(hashIndices.begin(), hashIndices.end(), EntryLess(mask));
+
+    std::vector<IndexEntry> entryTable(hashIndices.size());
+    std::vector<uint64_t> bucketTable(numBuckets+1, 0);
+    for(unsigned int i=0; i<hashIndices.size(); ++i)
+    {
+        const Entry& entry = entries[hashIndices[i].second];
+        IndexEntry& indexEntry = entryTable[i];
+        indexEntry.hash = hashIndices[i].first;
+        indexEntry.offset = entry._offset;
+        indexEntry.size = entry._size;
+        indexEntry.nameOffset = nameOffsets[hashIndices[i].second];
+        indexEntry.shard = entry._shard;
+        indexEntry.padding = 0;
+
+        ++bucketTable[(hashIndices[i].first & mask)+1];
+    }
+    for(unsigned int b=0; b<numBuckets; ++b)
+    {
+        bucketTable[b+1] += bucketTable[b];
+    }
+
+    IndexHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, magic, sizeof(magic));
+    header.byteOrder = byteOrder;
+    header.version = version;
+    header.numShards = shardTable.size();
+    header.numBuckets = numBuckets;
+    header.numEntries = numEntries;
+    header.shardTableOffset = sizeof(IndexHeader);
+    header.bucketTableOffset = header.shardTableOffset + shardTable.size()*sizeof(uint64_t);
+    header.entryTableOffset = header.bucketTableOffset + bucketTable.size()*sizeof(uint64_t);
+    header.stringTableOffset = header.entryTableOffset + entryTable.size()*sizeof(IndexEntry);
+    header.masterFileNameOffset = masterFileNameOffset;
+
+    FILE* fp = vpb::fopen(filename.c_str(), "wb");
+    if (!fp)
+    {
+        log(osg::WARN,"Error: could not write archive index %s",filename.c_str());
+        return false;
+    }
+
+    bool success = fwrite(&header, sizeof(header), 1, fp)==1;
+    if (!shardTable.empty()) success = success && fwrite(&shardTable.front(), sizeof(uint64_t), shardTable.size(), fp)==shardTable.size();
+    success = success && fwrite(&bucketTable.front(), sizeof(uint64_t), bucketTable.size(), fp)==bucketTable.size();
+    if (!entryTable.empty()) success = success && fwrite(&entryTable.front(), sizeof(IndexEntry), entryTable.size(), fp)==entryTable.size();
+    success = success && fwrite(strings.data(), 1, strings.size(), fp)==strings.size();
+    success = (fflush(fp)==0) && success;
+    vpb::fsync(fileno(fp));
+    success = (vpb::fclose(fp)==0) && success;
+
+    if (success) log(osg::NOTICE,"Written archive index %s, %d files in %d shards",filename.c_str(),int(numEntries),int(shardTable.size()));
+    else log(osg::WARN,"Error: failed writing archive index %s",filename.c_str());
+
+    return success;
+}
+
+bool ShardedArchive::readIndex(Entries& entries, std::vector<std::string>& shardFileNames) const
+{
+    if (_mode!=READING || !_indexData) return false;
+
+    const IndexHeader* header = reinterpret_cast<const IndexHeader*>(_indexData);
+    const char* strings = _indexData + header->stringTableOffset;
+
+    const uint64_t* shardNames = reinterpret_cast<const uint64_t*>(_indexData + header->shardTableOffset);
+    for(unsigned int i=0; i<header->numShards; ++i)
+    {
+        shardFileNames.push_back(strings + shardNames[i]);
+    }
+
+    const IndexEntry* indexEntries = reinterpret_cast<const IndexEntry*>(_indexData + header->entryTableOffset);
+    for(uint64_t i=0; i<header->numEntries; ++i)
+    {
+        Entry entry;
+        entry._filename = strings + indexEntries[i].nameOffset;
+        entry._shard = indexEntries[i].shard;
+        entry._offset = indexEntries[i].offset;
+        entry._size = indexEntries[i].size;
+        entries.push_back(entry);
+    }
+
+    return true;
+}
+
+bool ShardedArchive::merge(const std::string& filename, const std::vector<std::string>& inputArchives)
+{
+    std::string outputPath = osgDB::getFilePath(filename);
+
+    std::string masterFileName;
+    std::vector<std::string> shardFileNames;
+    Entries entries;
+
+    for(std::vector<std::string>::const_iterator itr = inputArchives.begin();
+        itr != inputArchives.end();
+        ++itr)
+    {
+        osg::ref_ptr<ShardedArchive> archive = new ShardedArchive;
+        if (!archive->open(*itr))
+        {
+            log(osg::WARN,"Error: could not open archive %s for merging",itr->c_str());
+            return false;
+        }
+
+        Entries inputEntries;
+        std::vector<std::string> inputShardFileNames;
+        archive->readIndex(inputEntries, inputShardFileNames);
+
+        if (masterFileName.empty()) masterFileName = archive->getMasterFileName();
+
+        // make the shard file names relative to the merged index.
+        std::string inputPath = osgDB::getFilePath(*itr);
+        unsigned int shardBase = shardFileNames.size();
+        for(std::vector<std::string>::iterator sitr = inputShardFileNames.begin();
+            sitr != inputShardFileNames.end();
+            ++sitr)
+        {
+            std::string shardFileName = *sitr;
+            if (!osgDB::isAbsolutePath(shardFileName) && inputPath!=outputPath)
+            {
+                if (!inputPath.empty()) shardFileName = inputPath + "/" + shardFileName;
+
+                if (!outputPath.empty())
+                {
+                    if (shardFileName.compare(0, outputPath.size()+1, outputPath+"/")==0) shardFileName.erase(0, outputPath.size()+1);
+                    else shardFileName = osgDB::getRealPath(shardFileName);
+                }
+            }
+
+            shardFileNames.push_back(shardFileName);
+        }
+
+        for(Entries::iterator eitr = inputEntries.begin();
+            eitr != inputEntries.end();
+            ++eitr)
+        {
+            eitr->_shard += shardBase;
+            entries.push_back(*eitr);
+        }
+
+        log(osg::NOTICE,"Merging archive %s, %d files in %d shards",itr->c_str(),int(inputEntries.size()),int(inputShardFileNames.size()));
+    }
+
+    return writeIndex(filename, masterFileName, shardFileNames, entries);
+}
+
+bool ShardedArchive::appendFile(const std::string& filename, const std::string& data) const
+{
+    if (_mode!=WRITING || _shards.empty()) return false;
+
+    unsigned int numShards = _shards.size();
+    unsigned int start = ++_nextShard;
+
+    // take the first shard that isn't being written to, only block once every shard is busy.
+    Shard* shard = 0;
+    unsigned int shardIndex = 0;
+    for(unsigned int i=0; i<numShards && !shard; ++i)
+    {
+        shardIndex = (start+i)%numShards;
+        if (_shards[shardIndex]->_mutex.trylock()==0) shard = _shards[shardIndex].get();
+    }
+
+    if (!shard)
+    {
+        shardIndex = start%numShards;
+        shard = _shards[shardIndex].get();
+        shard->_mutex.lock();
+    }
+
+    bool success = shard->_file!=0 && (data.empty() || fwrite(data.data(), 1, data.size(), shard->_file)==data.size());
+    if (success)
+    {
+        Entry entry;
+        entry._filename = filename;
+        entry._shard = shardIndex;
+        entry._offset = shard->_size;
+        entry._size = data.size();
+        shard->_entries.push_back(entry);
+
+        shard->_size += data.size();
+    }
+
+    shard->_mutex.unlock();
+
+    if (!success) log(osg::WARN,"Error: failed writing %s to archive shard %s",filename.c_str(),shard->_filename.c_str());
+
+    return success;
+}
+
+bool ShardedArchive::findFile(const std::string& filename, const char*& data, unsigned long long& size) const
+{
+    if (_mode!=READING || !_indexData) return false;
+
+    const IndexHeader* header = reinterpret_cast<const IndexHeader*>(_indexData);
+    const uint64_t* buckets = reinterpret_cast<const uint64_t*>(_indexData + header->bucketTableOffset);
+    const IndexEntry* entries = reinterpret_cast<const IndexEntry*>(_indexData + header->entryTableOffset);
+    const char* strings = _indexData + header->stringTableOffset;
+
+    std::string name = normalizeFileName(filename);
+    uint64_t hash = computeHash(name);
+    uint64_t bucket = hash & (header->numBuckets-1);
+
+    for(uint64_t i = buckets[bucket]; i<buckets[bucket+1]; ++i)
+    {
+        const IndexEntry& entry = entries[i];
+        if (entry.hash==hash && name==(strings + entry.nameOffset))
+        {
+            if (entry.shard>=_shards.size()) return false;
+
+            const Shard* shard = _shards[entry.shard].get();
+            if (!shard->_data || entry.offset+entry.size>shard->_dataSize) return false;
+
+            data = shard->_data + entry.offset;
+            size = entry.size;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool ShardedArchive::fileExists(const std::string& filename) const
+{
+    if (_mode==WRITING)
+    {
+        // nothing is indexed until close(), so look through the entries appended so far.
+        std::string name = normalizeFileName(filename);
+        for(Shards::const_iterator sitr = _shards.begin(); sitr != _shards.end(); ++sitr)
+        {
+            Shard* shard = sitr->get();
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock(shard->_mutex);
+            for(Entries::iterator itr = shard->_entries.begin(); itr != shard->_entries.end(); ++itr)
+            {
+                if (normalizeFileName(itr->_filename)==name) return true;
+            }
+        }
+        return false;
+    }
+
+    const char* data = 0;
+    unsigned long long size = 0;
+    return findFile(filename, data, size);
+}
+
+osgDB::FileType ShardedArchive::getFileType(const std::string& filename) const
+{
+    return fileExists(filename) ? osgDB::REGULAR_FILE : osgDB::FILE_NOT_FOUND;
+}
+
+bool ShardedArchive::getFileNames(FileNameList& fileNameList) const
+{
+    if (_mode==READING)
+    {
+        Entries entries;
+        std::vector<std::string> shardFileNames;
+        readIndex(entries, shardFileNames);
+        for(Entries::iterator itr = entries.begin(); itr != entries.end(); ++itr)
+        {
+            fileNameList.push_back(itr->_filename);
+        }
+        return true;
+    }
+    else if (_mode==WRITING)
+    {
+        for(Shards::const_iterator sitr = _shards.begin(); sitr != _shards.end(); ++sitr)
+        {
+            Shard* shard = sitr->get();
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock(shard->_mutex);
+            for(Entries::iterator itr = shard->_entries.begin(); itr != shard->_entries.end(); ++itr)
+            {
+                fileNameList.push_back(itr->_filename);
+            }
+        }
+        return true;
+    }
+    return false;
+}
+
+osgDB::ReaderWriter* ShardedArchive::getReaderWriter(const std::string& filename) const
+{
+    return osgDB::Registry::instance()->getReaderWriterForExtension(osgDB::getLowerCaseFileExtension(filename));
+}
+
+ShardedArchive::ReadResult ShardedArchive::readObject(const std::string& filename,const Options* options) const
+{
+    osgDB::ReaderWriter* rw = getReaderWriter(filename);
+    if (!rw) return ReadResult(ReadResult::FILE_NOT_HANDLED);
+
+    const char* data = 0;
+    unsigned long long size = 0;
+    if (!findFile(filename, data, size)) return ReadResult(ReadResult::FILE_NOT_FOUND);
+
+    MemoryStreamBuffer buffer(data, size);
+    std::istream in(&buffer);
+    return rw->readObject(in, options);
+}
+
+ShardedArchive::ReadResult ShardedArchive::readImage(const std::string& filename,const Options* options) const
+{
+    osgDB::ReaderWriter* rw = getReaderWriter(filename);
+    if (!rw) return ReadResult(ReadResult::FILE_NOT_HANDLED);
+
+    const char* data = 0;
+    unsigned long long size = 0;
+    if (!findFile(filename, data, size)) return ReadResult(ReadResult::FILE_NOT_FOUND);
+
+    MemoryStreamBuffer buffer(data, size);
+    std::istream in(&buffer);
+    return rw->readImage(in, options);
+}
+
+ShardedArchive::ReadResult ShardedArchive::readHeightField(const std::string& filename,const Options* options) const
+{
+    osgDB::ReaderWriter* rw = getReaderWriter(filename);
+    if (!rw) return ReadResult(ReadResult::FILE_NOT_HANDLED);
+
+    const char* data = 0;
+    unsigned long long size = 0;
+    if (!findFile(filename, data, size)) return ReadResult(ReadResult::FILE_NOT_FOUND);
+
+    MemoryStreamBuffer buffer(data, size);
+    std::istream in(&buffer);
+    return rw->readHeightField(in, options);
+}
+
+ShardedArchive::ReadResult ShardedArchive::readNode(const std::string& filename,const Options* options) const
+{
+    osgDB::ReaderWriter* rw = getReaderWriter(filename);
+    if (!rw) return ReadResult(ReadResult::FILE_NOT_HANDLED);
+
+    const char* data = 0;
+    unsigned long long size = 0;
+    if (!findFile(filename, data, size)) return ReadResult(ReadResult::FILE_NOT_FOUND);
+
+    MemoryStreamBuffer buffer(data, size);
+    std::istream in(&buffer);
+    return rw->readNode(in, options);
+}
+
+ShardedArchive::ReadResult ShardedArchive::readShader(const std::string& filename,const Options* options) const
+{
+    osgDB::ReaderWriter* rw = getReaderWriter(filename);
+    if (!rw) return ReadResult(ReadResult::FILE_NOT_HANDLED);
+
+    const char* data = 0;
+    unsigned long long size = 0;
+    if (!findFile(filename, data, size)) return ReadResult(ReadResult::FILE_NOT_FOUND);
+
+    MemoryStreamBuffer buffer(data, size);
+    std::istream in(&buffer);
+    return rw->readShader(in, options);
+}
+
+ShardedArchive::WriteResult ShardedArchive::writeObject(const osg::Object& obj, const std::string& filename,const Options* options) const
+{
+    osgDB::ReaderWriter* rw = getReaderWriter(filename);
+    if (!rw) return WriteResult(WriteResult::FILE_NOT_HANDLED);
+
+    std::ostringstream out(std::ios::out | std::ios::binary);
+    WriteResult result = rw->writeObject(obj, out, options ? options : osgDB::Registry::instance()->getOptions());
+    if (result.success() && !appendFile(filename, out.str())) return WriteResult(WriteResult::ERROR_IN_WRITING_FILE);
+    return result;
+}
+
+ShardedArchive::WriteResult ShardedArchive::writeImage(const osg::Image& image, const std::string& filename,const Options* options) const
+{
+    osgDB::ReaderWriter* rw = getReaderWriter(filename);
+    if (!rw) return WriteResult(WriteResult::FILE_NOT_HANDLED);
+
+    std::ostringstream out(std::ios::out | std::ios::binary);
+    WriteResult result = rw->writeImage(image, out, options ? options : osgDB::Registry::instance()->getOptions());
+    if (result.success() && !appendFile(filename, out.str())) return WriteResult(WriteResult::ERROR_IN_WRITING_FILE);
+    return result;
+}
+
+ShardedArchive::WriteResult ShardedArchive::writeHeightField(const osg::HeightField& heightField, const std::string& filename,const Options* options) const
+{
+    osgDB::ReaderWriter* rw = getReaderWriter(filename);
+    if (!rw) return WriteResult(WriteResult::FILE_NOT_HANDLED);
+
+    std::ostringstream out(std::ios::out | std::ios::binary);
+    WriteResult result = rw->writeHeightField(heightField, out, options ? options : osgDB::Registry::instance()->getOptions());
+    if (result.success() && !appendFile(filename, out.str())) return WriteResult(WriteResult::ERROR_IN_WRITING_FILE);
+    return result;
+}
+
+ShardedArchive::WriteResult ShardedArchive::writeNode(const osg::Node& node, const std::string& filename,const Options* options) const
+{
+    osgDB::ReaderWriter* rw = getReaderWriter(filename);
+    if (!rw) return WriteResult(WriteResult::FILE_NOT_HANDLED);
+
+    std::ostringstream out(std::ios::out | std::ios::binary);
+    WriteResult result = rw->writeNode(node, out, options ? options : osgDB::Registry::instance()->getOptions());
+    if (result.success() && !appendFile(filename, out.str())) return WriteResult(WriteResult::ERROR_IN_WRITING_FILE);
+    return result;
+}
+
+ShardedArchive::WriteResult ShardedArchive::writeShader(const osg::Shader& shader, const std::string& filename,const Options* options) const
+{
+    osgDB::ReaderWriter* rw = getReaderWriter(filename);
+    if (!rw) return WriteResult(WriteResult::FILE_NOT_HANDLED);
+
+    std::ostringstream out(std::ios::out | std::ios::binary);
+    WriteResult result = rw->writeShader(shader, out, options ? options : osgDB::Registry::instance()->getOptions());
+    if (result.success() && !appendFile(filename, out.str())) return WriteResult(WriteResult::ERROR_IN_WRITING_FILE);
+    return result;
+}
+
+/** ReaderWriter that lets osgDB open .vpba archives, so applications linking vpb can page databases straight out of them.*/
+class ReaderWriterVPBA : public osgDB::ReaderWriter
+{
+    public:
+
+        ReaderWriterVPBA()
+        {
+            supportsExtension("vpba","VirtualPlanetBuilder sharded tile archive");
+
+    // lets osgDB split paths like tiles.vpba/subtile.ive into the archive and the file within it.
+    osgDB::Registry::instance()->addArchiveExtension("vpba");
+        }
+
+        virtual const char* className() const { return "VirtualPlanetBuilder sharded archive reader"; }
+
+        virtual ReadResult openArchive(const std::string& file, ArchiveStatus status, unsigned int, const Options*) const
+        {
+            std::string ext = osgDB::getLowerCaseFileExtension(file);
+            if (!acceptsExtension(ext)) return ReadResult::FILE_NOT_HANDLED;
+
+            osg::ref_ptr<ShardedArchive> archive = new ShardedArchive;
+            if (status==READ)
+            {
+                std::string fileName = osgDB::findDataFile(file);
+                if (fileName.empty()) return ReadResult::FILE_NOT_FOUND;
+                if (!archive->open(fileName)) return ReadResult(ReadResult::ERROR_IN_READING_FILE);
+            }
+            else
+            {
+                if (!archive->create(file, OpenThreads::GetNumberOfProcessors())) return ReadResult(ReadResult::ERROR_IN_READING_FILE);
+            }
+
+            return archive.get();
+        }
+
+        virtual ReadResult readNode(const std::string& file, const Options* options) const
+        {
+            ReadResult result = openArchive(file, READ, 4096, options);
+            if (!result.validArchive()) return result;
+
+            osgDB::Archive* archive = result.getArchive();
+
+            osg::ref_ptr<Options> local_options = options ? static_cast<Options*>(options->clone(osg::CopyOp::SHALLOW_COPY)) : new Options;
+            local_options->setDatabasePath(file);
+
+            ReadResult result_2 = archive->readNode(archive->getMasterFileName(), local_options.get());
+
+            if (!options || (options->getObjectCacheHint() & Options::CACHE_ARCHIVES))
+            {
+                osgDB::Registry::instance()->addToArchiveCache(file, archive);
+            }
+
+            return result_2;
+        }
+};
+
+static osgDB::RegisterReaderWriterProxy<ReaderWriterVPBA> s_ReaderWriterVPBA_Proxy;
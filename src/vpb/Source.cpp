@@ -17,6 +17,7 @@
 #include <vpb/DataSet>
 #include <vpb/System>
 #include <vpb/BuildOptions>
+#include <vpb/ThreadPool>
 
 #include <osg/Geometry>
 #include <osg/Notify>
@@ -613,6 +614,93 @@ Source* Source::doRasterReprojectionUsingFileCache(osg::CoordinateSystemNode* cs
 }
 
 
+// vertices are reprojected in slices of this size, large enough to amortize each call into OGR and small enough to
+// share a large model out across threads.
+static const unsigned int s_reprojectionSliceSize = 65536;
+
+struct ReprojectionSlice
+{
+    ReprojectionSlice(osg::Array* array, unsigned int begin, unsigned int end):
+        _array(array),
+        _begin(begin),
+        _end(end) {}
+
+    osg::Array*     _array;
+    unsigned int    _begin;
+    unsigned int    _end;
+};
+
+typedef std::vector<ReprojectionSlice> ReprojectionSlices;
+
+template<class A>
+static void reprojectVertices(OGRCoordinateTransformation* ct, A& array, unsigned int begin, unsigned int end)
+{
+    unsigned int nCount = end-begin;
+
+    // reproject through doubles even for float arrays so no precision is lost between the two coordinate systems.
+    std::vector<double> xArray(nCount), yArray(nCount), zArray(nCount);
+
+    for(unsigned int i=0; i<nCount; ++i)
+    {
+        const typename A::ElementDataType& v = array[begin+i];
+        xArray[i] = v.x();
+        yArray[i] = v.y();
+        zArray[i] = v.z();
+    }
+
+    ct->Transform(nCount, &xArray[0], &yArray[0], &zArray[0]);
+
+    for(unsigned int i=0; i<nCount; ++i)
+    {
+        typename A::ElementDataType& v = array[begin+i];
+        v.x() = xArray[i];
+        v.y() = yArray[i];
+        v.z() = zArray[i];
+    }
+}
+
+static void reprojectSlice(OGRCoordinateTransformation* ct, const ReprojectionSlice& slice)
+{
+    osg::Vec3dArray* vec3darray = dynamic_cast<osg::Vec3dArray*>(slice._array);
+    if (vec3darray)
+    {
+        reprojectVertices(ct, *vec3darray, slice._begin, slice._end);
+        return;
+    }
+
+    osg::Vec3Array* vec3farray = dynamic_cast<osg::Vec3Array*>(slice._array);
+    if (vec3farray)
+    {
+        reprojectVertices(ct, *vec3farray, slice._begin, slice._end);
+    }
+}
+
+class ReprojectSliceOperation : public BuildOperation
+{
+    public:
+
+        ReprojectSliceOperation(ThreadPool* threadPool, const std::string& sourceWKT, const std::string& destinationWKT, const ReprojectionSlice& slice):
+            BuildOperation(threadPool, 0, "ReprojectSliceOperation", false),
+            _sourceWKT(sourceWKT),
+            _destinationWKT(destinationWKT),
+            _slice(slice) {}
+
+        virtual void build()
+        {
+            // each thread takes its own transformation from the cache as OGR's aren't safe to share between threads.
+            OGRCoordinateTransformation* ct = System::instance()->acquireCoordinateTransformation(_sourceWKT, _destinationWKT);
+            if (!ct) return;
+
+            reprojectSlice(ct, _slice);
+
+            System::instance()->releaseCoordinateTransformation(_sourceWKT, _destinationWKT, ct);
+        }
+
+        std::string         _sourceWKT;
+        std::string         _destinationWKT;
+        ReprojectionSlice   _slice;
+};
+
 class ReprojectionVisitor : public osg::NodeVisitor
 {
 public:
@@ -648,121 +736,75 @@ public:
             return false;
         }
 
-        char* source_projection_string = strdup(sourceCS->getCoordinateSystem().c_str());
-        char* importString = source_projection_string;
-        OGRSpatialReference* sourceProjection = new OGRSpatialReference;
-        sourceProjection->importFromWkt(&importString);
-
-        char* destination_projection_string = strdup(destinationCS->getCoordinateSystem().c_str());
-        importString = destination_projection_string;
-        OGRSpatialReference* destinationProjection = new OGRSpatialReference;
-        destinationProjection->importFromWkt(&importString);
+        const std::string& sourceWKT = sourceCS->getCoordinateSystem();
+        const std::string& destinationWKT = destinationCS->getCoordinateSystem();
 
-        OGRCoordinateTransformation* ct =  OGRCreateCoordinateTransformation( sourceProjection, destinationProjection );
+        OGRCoordinateTransformation* ct = System::instance()->acquireCoordinateTransformation(sourceWKT, destinationWKT);
+        if (!ct) return false;
 
-        bool success = false;
+        // reproject each vertex array once, even when it is shared between geometries.
+        std::set<osg::Array*> arrays;
+        ReprojectionSlices slices;
+        unsigned int numVertices = 0;
 
-        if (ct)
-        {
-            success = transform(ct);
-
-            delete ct;
-        }
-        
-        delete destinationProjection;
-        delete sourceProjection;
-
-        free(destination_projection_string);
-        free(source_projection_string);
-        
-        return success;
-    }
-    
-    bool transform(OGRCoordinateTransformation* ct)
-    {
         for(Geometries::iterator itr = _geometries.begin();
             itr != _geometries.end();
             ++itr)
         {
-            transform(ct, const_cast<osg::Geometry*>(*itr));
-        }
-        
-        return true;
-    }
-    
-    bool transform(OGRCoordinateTransformation* ct, osg::Geometry* geometry)
-    {
-        osg::Vec3dArray* vec3darray = dynamic_cast<osg::Vec3dArray*>(geometry->getVertexArray());
-        osg::Vec3Array* vec3farray = (vec3darray!=0) ? 0 : dynamic_cast<osg::Vec3Array*>(geometry->getVertexArray());
-        
-        unsigned int nCount = geometry->getVertexArray()->getNumElements();
-
-        // if no data to work with return;
-        if ((!vec3darray && !vec3farray) || nCount==0) return true;
-
-        double* xArray = new double[nCount];
-        double* yArray = new double[nCount];
-        double* zArray = new double[nCount];
-    
+            osg::Array* array = (*itr)->getVertexArray();
+            if (!array || !(dynamic_cast<osg::Vec3dArray*>(array) || dynamic_cast<osg::Vec3Array*>(array))) continue;
+            if (!arrays.insert(array).second) continue;
 
-        // copy the soure array to the temporary arrays
-        if (vec3darray)
-        {
-            for(unsigned int i=0; i<nCount; ++i)
+            for(unsigned int begin=0; begin<array->getNumElements(); begin+=s_reprojectionSliceSize)
             {
-                osg::Vec3d& v = (*vec3darray)[i];
-                xArray[i] = v.x();
-                yArray[i] = v.y();
-                zArray[i] = v.z();
+                slices.push_back(ReprojectionSlice(array, begin, osg::minimum(begin+s_reprojectionSliceSize, array->getNumElements())));
             }
+            numVertices += array->getNumElements();
         }
-        else if (vec3farray)
+
+        unsigned int numThreads = osg::minimum(static_cast<unsigned int>(OpenThreads::GetNumberOfProcessors()), static_cast<unsigned int>(slices.size()));
+        if (numThreads<=1)
         {
-            for(unsigned int i=0; i<nCount; ++i)
+            for(ReprojectionSlices::iterator itr = slices.begin();
+                itr != slices.end();
+                ++itr)
             {
-                osg::Vec3& v = (*vec3farray)[i];
-                xArray[i] = v.x();
-                yArray[i] = v.y();
-                zArray[i] = v.z();
+                reprojectSlice(ct, *itr);
             }
+
+            System::instance()->releaseCoordinateTransformation(sourceWKT, destinationWKT, ct);
         }
-        
-        // log(osg::NOTICE,"   reprojecting %i vertices",nCount);
+        else
+        {
+            System::instance()->releaseCoordinateTransformation(sourceWKT, destinationWKT, ct);
 
-        ct->Transform(nCount, xArray, yArray, zArray);
+            osg::ref_ptr<ThreadPool> threadPool = new ThreadPool(numThreads, false);
+            threadPool->setName("reproject");
+            threadPool->startThreads();
 
-        // copy the data back to the original arrays.
-        if (vec3darray)
-        {
-            for(unsigned int i=0; i<nCount; ++i)
+            for(ReprojectionSlices::iterator itr = slices.begin();
+                itr != slices.end();
+                ++itr)
             {
-                osg::Vec3d& v = (*vec3darray)[i];
-                //osg::notify(osg::NOTICE)<<"   Before "<<v;
-                v.x() = xArray[i];
-                v.y() = yArray[i];
-                v.z() = zArray[i];
-                // osg::notify(osg::NOTICE)<<"  after "<<v<<std::endl;
+                threadPool->run(new ReprojectSliceOperation(threadPool.get(), sourceWKT, destinationWKT, *itr));
             }
+
+            threadPool->waitForCompletion();
+            threadPool->stopThreads();
         }
-        else if (vec3farray)
+
+        for(Geometries::iterator itr = _geometries.begin();
+            itr != _geometries.end();
+            ++itr)
         {
-            for(unsigned int i=0; i<nCount; ++i)
-            {
-                osg::Vec3& v = (*vec3farray)[i];
-                v.x() = xArray[i];
-                v.y() = yArray[i];
-                v.z() = zArray[i];
-            }
+            if ((*itr)->getVertexArray()) (*itr)->getVertexArray()->dirty();
+            (*itr)->dirtyBound();
         }
 
-        // clean up the temporary arrays
-        delete [] xArray;
-        delete [] yArray;
-        delete [] zArray;
-        
+        log(osg::INFO,"ReprojectionVisitor reprojected %d vertices in %d slices using %d threads", int(numVertices), int(slices.size()), int(osg::maximum(numThreads, 1u)));
+
         return true;
     }
-        
 
     typedef std::set<osg::Geometry*> Geometries;
     Geometries _geometries;
@@ -15,12 +15,17 @@
 #include <vpb/Destination>
 #include <vpb/DataSet>
 #include <vpb/System>
+#include <vpb/Profiler>
+#include <vpb/Metrics>
 
 #include <osg/Notify>
 #include <osg/io_utils>
 #include <osgDB/ReadFile>
 #include <osgDB/FileNameUtils>
 
+#include <algorithm>
+#include <vector>
+
 #include <gdal_priv.h>
 #include <gdalwarper.h>
 
@@ -58,7 +63,42 @@ struct ValidValueOperator
         if (isNoDataValue(value)) return value;
         else return defaultValue;
     }
-    
+
+    /** Write offset + value*scale for each valid value of a row into the destination, leaving the destination unchanged
+      * where the value is no data. The converted values are staged in a scratch row of the same length so that both
+      * passes vectorize, and the no data comparison is compiled out when the valid range already excludes it.*/
+    inline void convertRow(const float* source, float* destination, float* scratch, unsigned int count, float offset, float scale) const
+    {
+        for(unsigned int i=0; i<count; ++i)
+        {
+            scratch[i] = offset + source[i]*scale;
+        }
+
+        if (noDataValue<minValue || noDataValue>maxValue) selectValidValues<false>(source, scratch, destination, count);
+        else selectValidValues<true>(source, scratch, destination, count);
+    }
+
+    // a select in place of isNoDataValue()'s branches, with the same treatment of NaNs. Every operand is loaded up front
+    // as compilers won't if-convert a select whose arms might trap.
+    template<bool CheckNoData>
+    inline void selectValidValues(const float* source, const float* converted, float* destination, unsigned int count) const
+    {
+        const float noData = noDataValue;
+        const float minimum = minValue;
+        const float maximum = maxValue;
+
+        for(unsigned int i=0; i<count; ++i)
+        {
+            float value = source[i];
+            float current = destination[i];
+            float result = converted[i];
+            result = (value<minimum) ? current : result;
+            result = (value>maximum) ? current : result;
+            if (CheckNoData) result = (value==noData) ? current : result;
+            destination[i] = result;
+        }
+    }
+
     float defaultValue;
     float noDataValue;
     float minValue;
@@ -451,6 +491,8 @@ void SourceData::read(DestinationData& destination)
 
 void SourceData::readImage(DestinationData& destination)
 {
+    Profiler::ScopedPhase phase("resampleImage");
+
     log(osg::INFO,"readImage ");
 
     if (destination._image.valid())
@@ -539,6 +581,8 @@ void SourceData::readImage(DestinationData& destination)
 
                 unsigned char* tempImage = new unsigned char[readWidth*readHeight*pixelSpace];
 
+                Metrics::instance()->count("vpb_source_bytes_read_total", double(readWidth*readHeight*pixelSpace));
+
 
                 /* New code courtesy of Frank Warmerdam of the GDAL group */
 
@@ -911,6 +955,8 @@ void SourceData::readImage(DestinationData& destination)
 
 void SourceData::readHeightField(DestinationData& destination)
 {
+    Profiler::ScopedPhase phase("resampleHeightField");
+
     log(osg::INFO,"In SourceData::readHeightField");
 
     if (destination._heightField.valid())
@@ -1088,20 +1134,24 @@ void SourceData::readHeightField(DestinationData& destination)
                     // read data into temporary array
                     float* heightData = new float [ destWidth*destHeight ];
 
+                    Metrics::instance()->count("vpb_source_bytes_read_total", double(destWidth*destHeight*sizeof(float)));
+
                     //bandSelected->RasterIO(GF_Read,windowX,_numValuesY-(windowY+windowHeight),windowWidth,windowHeight,floatdata,destWidth,destHeight,GDT_Float32,numBytesPerZvalue,lineSpace);
                     bandSelected->RasterIO(GF_Read,windowX,_numValuesY-(windowY+windowHeight),windowWidth,windowHeight,heightData,destWidth,destHeight,GDT_Float32,0,0);
 
-                    float* heightPtr = heightData;
+                    // GDAL rows run north to south, the height field's south to north, so flip the rows while converting
+                    // them straight into the height field's array.
+                    osg::FloatArray* heights = hf->getFloatArray();
+                    std::vector<float> convertedRow(osg::maximum(destWidth, 1));
+                    const float* heightPtr = heightData;
 
                     for(int r=destY+destHeight-1;r>=destY;--r)
                     {
-                        for(int c=destX;c<destX+destWidth;++c)
-                        {
-                            float h = *heightPtr++;
-                            if (!validValueOperator.isNoDataValue(h)) hf->setHeight(c,r,offset + h*scale);
-                            else if (!ignoreNoDataValue) hf->setHeight(c,r,noDataValueFill);
-                            h = hf->getHeight(c,r);
-                        }
+                        float* destinationPtr = &((*heights)[r*hf->getNumColumns()+destX]);
+                        if (!ignoreNoDataValue) std::fill(destinationPtr, destinationPtr+destWidth, noDataValueFill);
+
+                        validValueOperator.convertRow(heightPtr, destinationPtr, &convertedRow[0], destWidth, offset, scale);
+                        heightPtr += destWidth;
                     }
 
                     delete [] heightData;
@@ -15,9 +15,14 @@
 #include <vpb/BuildLog>
 #include <vpb/Date>
 #include <vpb/FileUtils>
+#include <vpb/Profiler>
+#include <vpb/Metrics>
 
 #include <map>
 #include <gdal_priv.h>
+#include <ogr_spatialref.h>
+
+#include <OpenThreads/ScopedLock>
 
 using namespace vpb;
 
@@ -121,6 +126,18 @@ System::~System()
     _machinePool = 0;
     _taskManager = 0;
     _fileCache = 0;
+
+    for(CoordinateTransformationMap::iterator itr = _coordinateTransformationMap.begin();
+        itr != _coordinateTransformationMap.end();
+        ++itr)
+    {
+        for(CoordinateTransformations::iterator citr = itr->second.begin();
+            citr != itr->second.end();
+            ++citr)
+        {
+            delete *citr;
+        }
+    }
 }
 
 void System::readEnvironmentVariables()
@@ -206,6 +223,28 @@ void System::readArguments(osg::ArgumentParser& arguments)
     while (arguments.read("--machines",_machineFileName)) {}
 
     while (arguments.read("--cache",_cacheFileName)) {}
+
+    std::string traceFileName;
+    while (arguments.read("--profile",traceFileName))
+    {
+        Profiler::instance()->setEnabled(true);
+        Profiler::instance()->setTraceFileName(traceFileName);
+    }
+
+    double metricsInterval;
+    while (arguments.read("--metrics-interval",metricsInterval))
+    {
+        Metrics::instance()->setInterval(metricsInterval);
+    }
+
+    std::string metricsFileName;
+    while (arguments.read("--metrics",metricsFileName))
+    {
+        Metrics::instance()->setEnabled(true);
+        Metrics::instance()->setFileName(metricsFileName);
+    }
+
+    Metrics::instance()->start();
 }
 
 FileCache* System::getFileCache()
@@ -256,6 +295,52 @@ void System::clearDatasetCache()
     _datasetMap.clear();
 }
 
+OGRCoordinateTransformation* System::acquireCoordinateTransformation(const std::string& sourceWKT, const std::string& destinationWKT)
+{
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_coordinateTransformationMutex);
+
+        CoordinateTransformations& cts = _coordinateTransformationMap[CoordinateSystemPair(sourceWKT, destinationWKT)];
+        if (!cts.empty())
+        {
+            OGRCoordinateTransformation* ct = cts.back();
+            cts.pop_back();
+            return ct;
+        }
+    }
+
+    // creating a transformation parses both coordinate systems, so only do it when all those created before are in use.
+    char* source_projection_string = strdup(sourceWKT.c_str());
+    char* importString = source_projection_string;
+    OGRSpatialReference* sourceProjection = new OGRSpatialReference;
+    sourceProjection->importFromWkt(&importString);
+
+    char* destination_projection_string = strdup(destinationWKT.c_str());
+    importString = destination_projection_string;
+    OGRSpatialReference* destinationProjection = new OGRSpatialReference;
+    destinationProjection->importFromWkt(&importString);
+
+    OGRCoordinateTransformation* ct = OGRCreateCoordinateTransformation( sourceProjection, destinationProjection );
+
+    delete destinationProjection;
+    delete sourceProjection;
+
+    free(destination_projection_string);
+    free(source_projection_string);
+
+    if (ct) Metrics::instance()->count("vpb_coordinate_transformations_created_total");
+
+    return ct;
+}
+
+void System::releaseCoordinateTransformation(const std::string& sourceWKT, const std::string& destinationWKT, OGRCoordinateTransformation* ct)
+{
+    if (!ct) return;
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_coordinateTransformationMutex);
+    _coordinateTransformationMap[CoordinateSystemPair(sourceWKT, destinationWKT)].push_back(ct);
+}
+
 
 class TrimN
 {
@@ -338,6 +423,7 @@ GeospatialDataset* System::openGeospatialDataset(const std::string& filename, Ac
     DatasetMap::iterator itr = _datasetMap.find(FileNameAccessModePair(filename,accessMode));
     if (itr != _datasetMap.end())
     {
+        Metrics::instance()->count("vpb_dataset_cache_hits_total");
         //osg::notify(osg::NOTICE)<<"System::openGeospatialDataset("<<filename<<") returning existing entry, ref count "<<itr->second->referenceCount()<<std::endl;
         return itr->second.get();
     }
@@ -354,6 +440,8 @@ GeospatialDataset* System::openGeospatialDataset(const std::string& filename, Ac
 
     //osg::notify(osg::NOTICE)<<"System::openGeospatialDataset("<<filename<<") requires new entry "<<std::endl;
 
+    Metrics::instance()->count("vpb_dataset_cache_misses_total");
+
     // open the new dataset.
     GeospatialDataset* dataset = new GeospatialDataset(filename, accessMode);
     if (dataset->getGDALDataset() == NULL)
@@ -0,0 +1,228 @@
+/* -*-c++-*- VirtualPlanetBuilder - Copyright (C) 1998-2007 Robert Osfield
+ *
+ * This library is open source and may be redistributed and/or modified under
+ * the terms of the OpenSceneGraph Public License (OSGPL) version 0.0 or
+ * (at your option) any later version.  The full license is in LICENSE file
+ * included with this distribution, and on the openscenegraph.org website.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * OpenSceneGraph Public License for more details.
+*/
+
+#include <vpb/TaskJournal>
+#include <vpb/FileUtils>
+#include <vpb/BuildLog>
+
+#include <OpenThreads/ScopedLock>
+
+#include <stdio.h>
+
+// lockf() is a no-op on Windows, which doesn't define the lock commands.
+#ifndef F_LOCK
+    #define F_ULOCK 0
+    #define F_LOCK 1
+#endif
+
+using namespace vpb;
+
+// records are stored as a little endian size followed by the task file name and the property/value pairs,
+// each string length prefixed, so the journal can be shared between machines of differing byte order.
+static void appendUInt(std::string& data, unsigned int value)
+{
+    data.push_back(char(value & 0xff));
+    data.push_back(char((value >> 8) & 0xff));
+    data.push_back(char((value >> 16) & 0xff));
+    data.push_back(char((value >> 24) & 0xff));
+}
+
+static void appendString(std::string& data, const std::string& str)
+{
+    appendUInt(data, str.size());
+    data.append(str);
+}
+
+static bool readUInt(const std::string& data, std::string::size_type& pos, unsigned int& value)
+{
+    if (pos+4>data.size()) return false;
+    value = (unsigned int)(unsigned char)data[pos] |
+            ((unsigned int)(unsigned char)data[pos+1] << 8) |
+            ((unsigned int)(unsigned char)data[pos+2] << 16) |
+            ((unsigned int)(unsigned char)data[pos+3] << 24);
+    pos += 4;
+    return true;
+}
+
+static bool readString(const std::string& data, std::string::size_type& pos, std::string& str)
+{
+    unsigned int size;
+    if (!readUInt(data, pos, size) || pos+size>data.size()) return false;
+    str.assign(data, pos, size);
+    pos += size;
+    return true;
+}
+
+static void encodeRecord(std::string& record, const std::string& taskFileName, const TaskJournal::Properties& properties)
+{
+    std::string body;
+    appendString(body, taskFileName);
+    appendUInt(body, properties.size());
+    for(TaskJournal::Properties::const_iterator itr = properties.begin();
+        itr != properties.end();
+        ++itr)
+    {
+        appendString(body, itr->first);
+        appendString(body, itr->second);
+    }
+
+    appendUInt(record, body.size());
+    record.append(body);
+}
+
+TaskJournal::TaskJournal(const std::string& filename):
+    _fileName(filename),
+    _readOffset(0)
+{
+}
+
+TaskJournal::~TaskJournal()
+{
+}
+
+bool TaskJournal::append(const std::string& taskFileName, const Properties& properties)
+{
+    if (properties.empty()) return true;
+
+    std::string record;
+    encodeRecord(record, taskFileName, properties);
+
+    if (vpb::access(_fileName.c_str(), F_OK)!=0)
+    {
+        FILE* file = vpb::fopen(_fileName.c_str(), "ab");
+        if (file) vpb::fclose(file);
+    }
+
+    int fd = vpb::open(_fileName.c_str(), O_WRONLY | O_APPEND);
+    if (fd<0)
+    {
+        log(osg::WARN,"Error: unable to open task journal %s",_fileName.c_str());
+        return false;
+    }
+
+    // the whole record goes out in one write, under a lock so appends from other machines don't interleave.
+    vpb::lockf(fd, F_LOCK, 0);
+    bool success = vpb::write(fd, record.data(), record.size())==ssize_t(record.size());
+    vpb::lockf(fd, F_ULOCK, 0);
+
+    vpb::close(fd);
+
+    return success;
+}
+
+unsigned int TaskJournal::readUpdates(TaskPropertiesMap& updates)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+
+    FILE* file = vpb::fopen(_fileName.c_str(), "rb");
+    if (!file) return 0;
+
+    std::string data;
+    if (fseek(file, long(_readOffset), SEEK_SET)==0)
+    {
+        char buffer[65536];
+        size_t numRead;
+        while ((numRead = fread(buffer, 1, sizeof(buffer), file))>0)
+        {
+            data.append(buffer, numRead);
+        }
+    }
+    vpb::fclose(file);
+
+    unsigned int numRecords = 0;
+    std::string::size_type pos = 0;
+    while (pos<data.size())
+    {
+        // stop at a record still being appended, it will be picked up next time.
+        std::string::size_type recordStart = pos;
+        unsigned int recordSize;
+        if (!readUInt(data, pos, recordSize) || pos+recordSize>data.size())
+        {
+            pos = recordStart;
+            break;
+        }
+
+        std::string::size_type recordEnd = pos + recordSize;
+
+        std::string taskFileName;
+        unsigned int numProperties = 0;
+        if (readString(data, pos, taskFileName) && readUInt(data, pos, numProperties))
+        {
+            Properties& properties = updates[taskFileName];
+            for(unsigned int i=0; i<numProperties && pos<recordEnd; ++i)
+            {
+                std::string property, value;
+                if (!readString(data, pos, property) || !readString(data, pos, value)) break;
+                properties[property] = value;
+            }
+        }
+
+        pos = recordEnd;
+        ++numRecords;
+    }
+
+    _readOffset += pos;
+
+    return numRecords;
+}
+
+bool TaskJournal::compact(const TaskPropertiesMap& tasks)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+
+    std::string data;
+    for(TaskPropertiesMap::const_iterator itr = tasks.begin();
+        itr != tasks.end();
+        ++itr)
+    {
+        encodeRecord(data, itr->first, itr->second);
+    }
+
+    std::string tempFileName = _fileName + ".compact";
+    FILE* file = vpb::fopen(tempFileName.c_str(), "wb");
+    if (!file)
+    {
+        log(osg::WARN,"Error: unable to compact task journal %s",_fileName.c_str());
+        return false;
+    }
+
+    bool success = data.empty() || fwrite(data.data(), 1, data.size(), file)==data.size();
+    success = (vpb::fclose(file)==0) && success;
+
+    if (success && rename(tempFileName.c_str(), _fileName.c_str())!=0)
+    {
+        // platforms that won't rename over an existing file need it removed first.
+        remove(_fileName.c_str());
+        success = rename(tempFileName.c_str(), _fileName.c_str())==0;
+    }
+
+    if (!success)
+    {
+        log(osg::WARN,"Error: failed to compact task journal %s",_fileName.c_str());
+        remove(tempFileName.c_str());
+        return false;
+    }
+
+    // everything in the compacted journal has already been consumed.
+    _readOffset = data.size();
+
+    return true;
+}
+
+void TaskJournal::clear()
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+
+    remove(_fileName.c_str());
+    _readOffset = 0;
+}
@@ -16,16 +16,21 @@
 #include <vpb/DatabaseBuilder>
 #include <vpb/System>
 #include <vpb/FileUtils>
+#include <vpb/ShardedArchive>
+#include <vpb/Profiler>
 
 #include <osgDB/ReadFile>
 #include <osgDB/WriteFile>
 #include <osg/Math>
+#include <osg/Timer>
 
 #include <osgDB/Input>
 #include <osgDB/Output>
 #include <osgDB/FileUtils>
 
+#include <algorithm>
 #include <iostream>
+#include <sstream>
 
 #include <signal.h>
 
@@ -34,6 +39,7 @@ using namespace vpb;
 TaskManager::TaskManager()
 {
     _done = false;
+    _dryRun = false;
     _buildName = "build";
 
     char str[2048];
@@ -266,6 +272,8 @@ int TaskManager::read(osg::ArgumentParser& arguments)
 
     while (arguments.read("--build-name",_buildName)) {}
 
+    while (arguments.read("--dry-run")) { _dryRun = true; }
+
     if (!terrainOutputName.empty())
     {
         if (_terrainTile.valid())
@@ -325,6 +333,43 @@ void TaskManager::nextTaskSet()
     _taskSetList.push_back(TaskSet());
 }
 
+static bool getTaskTile(const Task* task, unsigned int& level, unsigned int& x, unsigned int& y)
+{
+    return task->getProperty("tile_level",level) &&
+           task->getProperty("tile_x",x) &&
+           task->getProperty("tile_y",y);
+}
+
+bool TaskManager::isIndependentOfTaskSet(const Task* task, const TaskSet& taskSet) const
+{
+    // tasks that don't record their tile could build any part of the database.
+    unsigned int level, x, y;
+    if (!getTaskTile(task, level, x, y)) return false;
+
+    for(TaskSet::const_iterator itr = taskSet.begin();
+        itr != taskSet.end();
+        ++itr)
+    {
+        if ((*itr)->getStatus()==Task::COMPLETED) continue;
+
+        unsigned int other_level, other_x, other_y;
+        if (!getTaskTile(itr->get(), other_level, other_x, other_y)) return false;
+
+        // two tasks depend on each other when one of their tiles is an ancestor of the other.
+        unsigned int delta = level>other_level ? level-other_level : other_level-level;
+        if (level>other_level)
+        {
+            if ((x>>delta)==other_x && (y>>delta)==other_y) return false;
+        }
+        else
+        {
+            if ((other_x>>delta)==x && (other_y>>delta)==y) return false;
+        }
+    }
+
+    return true;
+}
+
 void TaskManager::addTask(Task* task)
 {
     if (!task) return;
@@ -335,8 +380,21 @@ void TaskManager::addTask(Task* task)
 }
 
 void TaskManager::addTask(const std::string& taskFileName, const std::string& application, const std::string& sourceFile,
-                          const std::string& fileListBaseName)
+                          const std::string& fileListBaseName, const std::string& type,
+                          unsigned int level, unsigned int x, unsigned int y,
+                          double estimatedCost, const std::string& requiredSources)
 {
+    // keep the running time of any previous run of this task as history for the scheduler.
+    double previousDuration = 0.0;
+    if (osgDB::fileExists(taskFileName))
+    {
+        osg::ref_ptr<Task> previousTask = new Task(taskFileName);
+        if (previousTask->read() && !previousTask->getProperty("duration",previousDuration))
+        {
+            previousTask->getProperty("previous_duration",previousDuration);
+        }
+    }
+
     osg::ref_ptr<Task> taskFile = new Task(taskFileName);
 
     if (taskFile->valid())
@@ -344,6 +402,16 @@ void TaskManager::addTask(const std::string& taskFileName, const std::string& ap
         taskFile->setProperty("application",application);
         taskFile->setProperty("source",sourceFile);
         taskFile->setProperty("fileListBaseName",fileListBaseName);
+        if (!type.empty())
+        {
+            taskFile->setProperty("type",type);
+            taskFile->setProperty("tile_level",level);
+            taskFile->setProperty("tile_x",x);
+            taskFile->setProperty("tile_y",y);
+        }
+        if (estimatedCost>0.0) taskFile->setProperty("estimated_cost",estimatedCost);
+        if (previousDuration>0.0) taskFile->setProperty("previous_duration",previousDuration);
+        if (!requiredSources.empty()) taskFile->setProperty("required_sources",requiredSources);
 
         taskFile->write();
 
@@ -400,6 +468,8 @@ void TaskManager::buildWithoutSlaves()
 
 bool TaskManager::generateTasksFromSource()
 {
+    Profiler::ScopedPhase phase("generateTasks");
+
     if (!_terrainTile) return false;
     try
     {
@@ -446,6 +516,9 @@ bool TaskManager::generateTasksFromSource()
 
         dataset->generateTasks(this);
 
+        // a dry run only reports the tiles that would be rebuilt.
+        if (_dryRun) return false;
+
         // update the current build options with the distination extents.
         bo->setDestinationExtents(dataset->getDestinationExtents());
         bo->setDistributedBuildSecondarySplitLevel(dataset->getDistributedBuildSecondarySplitLevel());
@@ -466,6 +539,8 @@ bool TaskManager::generateTasksFromSource()
 
 bool TaskManager::run()
 {
+    Profiler::ScopedPhase phase("runTasks");
+
     log(osg::NOTICE,"Begining run");
 
     if (getBuildOptions() && getBuildOptions()->getAbortRunOnError())
@@ -495,11 +570,33 @@ bool TaskManager::run()
         setDatabaseRevisions(dr.get());
     }
 
+    // status updates of the tasks are appended to the journal rather than rewriting their task files.  A previous
+    // run that was interrupted can leave updates in the journal that never reached the task files, so replay them
+    // into the task files before starting this run from an empty journal.
+    _taskJournal = new TaskJournal(getTaskJournalFileName());
+    _taskJournalUpdates.clear();
+    updateTasksFromJournal();
+    writeTaskStatusFiles();
+    _taskJournal->clear();
+
+    for(TaskSetList::iterator tsItr = _taskSetList.begin();
+        tsItr != _taskSetList.end();
+        ++tsItr)
+    {
+        for(TaskSet::iterator itr = tsItr->begin();
+            itr != tsItr->end();
+            ++itr)
+        {
+            (*itr)->setJournal(_taskJournal.get());
+        }
+    }
 
     for(TaskSetList::iterator tsItr = _taskSetList.begin();
         tsItr != _taskSetList.end() && !done();
         )
     {
+        MachinePool::Tasks tasksToRun;
+
         for(TaskSet::iterator itr = tsItr->begin();
             itr != tsItr->end() && !done();
             ++itr)
@@ -525,23 +622,86 @@ bool TaskManager::run()
                 {
                     // run the task
                     log(osg::NOTICE,"Task previously failed attempting re-run: %s",task->getFileName().c_str());
-                    getMachinePool()->run(task);
+                    tasksToRun.push_back(task);
                     break;
                 }
                 case(Task::PENDING):
                 {
                     // run the task
                     log(osg::NOTICE,"scheduling task : %s",task->getFileName().c_str());
-                    getMachinePool()->run(task);
+                    tasksToRun.push_back(task);
                     break;
                 }
             }
 
         }
 
+        // tasks from the next TaskSet that don't build any of the same tiles as the uncompleted tasks of this TaskSet
+        // can run alongside it, filling the threads that would otherwise idle while the last tasks of this TaskSet
+        // complete.  Most of them descend from a tile of this TaskSet, so check again as its tasks complete.
+        MachinePool::Tasks tasksWaiting;
+        TaskSetList::iterator nextTsItr = tsItr;
+        ++nextTsItr;
+        if (nextTsItr != _taskSetList.end())
+        {
+            for(TaskSet::iterator itr = nextTsItr->begin();
+                itr != nextTsItr->end();
+                ++itr)
+            {
+                Task* task = itr->get();
+                if (task->getStatus()==Task::PENDING || task->getStatus()==Task::FAILED) tasksWaiting.push_back(task);
+            }
+        }
+
+        osg::Timer_t startTick = osg::Timer::instance()->tick();
+
+        double predictedMakespan = getMachinePool()->run(tasksToRun);
+
+        while(!tasksWaiting.empty() && !done())
+        {
+            MachinePool::Tasks independentTasks;
+            for(MachinePool::Tasks::iterator itr = tasksWaiting.begin();
+                itr != tasksWaiting.end();
+                )
+            {
+                if (isIndependentOfTaskSet(itr->get(), *tsItr))
+                {
+                    log(osg::NOTICE,"scheduling independent task from next TaskSet : %s",(*itr)->getFileName().c_str());
+                    independentTasks.push_back(*itr);
+                    itr = tasksWaiting.erase(itr);
+                }
+                else
+                {
+                    ++itr;
+                }
+            }
+
+            if (!independentTasks.empty()) getMachinePool()->run(independentTasks);
+
+            // stop looking once nothing dispatched from this TaskSet is left to complete.
+            bool taskSetOutstanding = false;
+            for(MachinePool::Tasks::iterator itr = tasksToRun.begin();
+                itr != tasksToRun.end() && !taskSetOutstanding;
+                ++itr)
+            {
+                Task::Status status = (*itr)->getStatus();
+                taskSetOutstanding = (status==Task::PENDING || status==Task::RUNNING);
+            }
+            if (!taskSetOutstanding) break;
+
+            OpenThreads::Thread::microSleep(1000000);
+        }
+
         // now need to wait till all dispatched tasks are complete.
         getMachinePool()->waitForCompletion();
 
+        // no tasks are running now so pick up the rest of their updates and save their status.
+        updateTasksFromJournal();
+        writeTaskStatusFiles();
+
+        log(osg::NOTICE,"TaskSet predicted makespan %.1f seconds, actual makespan %.1f seconds",
+            predictedMakespan, osg::Timer::instance()->delta_s(startTick, osg::Timer::instance()->tick()));
+
         // tally up the tasks to see how we've done on this TasksSet
         unsigned int tasksPending = 0;
         unsigned int tasksRunning = 0;
@@ -654,6 +814,10 @@ bool TaskManager::run()
     log(osg::NOTICE,"End of run: tasksPending=%d taskCompleted=%d taskRunning=%d tasksFailed=%d",tasksPending,tasksCompleted,tasksRunning,tasksFailed);
 
     getMachinePool()->reportTimingStats();
+    getMachinePool()->reportLocalityStats();
+
+    updateTasksFromJournal();
+    writeTaskStatusFiles();
 
     if (tasksFailed==0)
     {
@@ -662,9 +826,141 @@ bool TaskManager::run()
     }
     else log(osg::NOTICE,"Finished run, but failed on %d  tasks.",tasksFailed);
 
+    if (tasksFailed==0 && tasksPending==0 &&
+        getBuildOptions() && ShardedArchive::isShardedArchiveFileName(getBuildOptions()->getArchiveName()))
+    {
+        mergeArchiveParts(getBuildOptions()->getArchiveName());
+    }
+
     return tasksFailed==0 && tasksPending==0;
 }
 
+std::string TaskManager::getTaskJournalFileName() const
+{
+    std::string journalFileName = _buildName + std::string(".journal");
+    return _runPath.empty() ? journalFileName : _runPath + std::string("/") + journalFileName;
+}
+
+void TaskManager::updateTaskFromJournal(Task* task)
+{
+    if (!_taskJournal || task->getJournal()!=_taskJournal.get())
+    {
+        task->read();
+        return;
+    }
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_taskJournalMutex);
+
+    _taskJournal->readUpdates(_taskJournalUpdates);
+
+    // leave the updates to other tasks for the threads running them.
+    TaskJournal::TaskPropertiesMap::iterator uitr = _taskJournalUpdates.find(task->getFileName());
+    if (uitr == _taskJournalUpdates.end()) return;
+
+    for(TaskJournal::Properties::iterator pitr = uitr->second.begin();
+        pitr != uitr->second.end();
+        ++pitr)
+    {
+        task->applyProperty(pitr->first, pitr->second);
+    }
+
+    _taskJournalUpdates.erase(uitr);
+}
+
+void TaskManager::updateTasksFromJournal()
+{
+    if (!_taskJournal) return;
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_taskJournalMutex);
+
+    _taskJournal->readUpdates(_taskJournalUpdates);
+
+    for(TaskSetList::iterator tsItr = _taskSetList.begin();
+        tsItr != _taskSetList.end() && !_taskJournalUpdates.empty();
+        ++tsItr)
+    {
+        for(TaskSet::iterator itr = tsItr->begin();
+            itr != tsItr->end();
+            ++itr)
+        {
+            Task* task = itr->get();
+            TaskJournal::TaskPropertiesMap::iterator uitr = _taskJournalUpdates.find(task->getFileName());
+            if (uitr == _taskJournalUpdates.end()) continue;
+
+            for(TaskJournal::Properties::iterator pitr = uitr->second.begin();
+                pitr != uitr->second.end();
+                ++pitr)
+            {
+                task->applyProperty(pitr->first, pitr->second);
+            }
+
+            _taskJournalUpdates.erase(uitr);
+        }
+    }
+
+    _taskJournalUpdates.clear();
+}
+
+void TaskManager::writeTaskStatusFiles()
+{
+    if (!_taskJournal) return;
+
+    TaskJournal::TaskPropertiesMap taskProperties;
+    for(TaskSetList::iterator tsItr = _taskSetList.begin();
+        tsItr != _taskSetList.end();
+        ++tsItr)
+    {
+        for(TaskSet::iterator itr = tsItr->begin();
+            itr != tsItr->end();
+            ++itr)
+        {
+            Task* task = itr->get();
+            if (task->isFileOutOfDate()) task->writeFile();
+            taskProperties[task->getFileName()] = task->getPropertyMap();
+        }
+    }
+
+    // everything consumed so far is now held by the task files, so cut the journal back to the latest status.
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_taskJournalMutex);
+    _taskJournal->compact(taskProperties);
+}
+
+bool TaskManager::mergeArchiveParts(const std::string& archiveName)
+{
+    std::string path = osgDB::getFilePath(archiveName);
+    std::string partPrefix = osgDB::getSimpleFileName(ShardedArchive::getPartFileName(archiveName, ""));
+    partPrefix = osgDB::getNameLessExtension(partPrefix);
+
+    std::string rootPart;
+    std::vector<std::string> parts;
+
+    osgDB::DirectoryContents contents = osgDB::getDirectoryContents(path.empty() ? std::string(".") : path);
+    for(osgDB::DirectoryContents::iterator itr = contents.begin();
+        itr != contents.end();
+        ++itr)
+    {
+        if (itr->compare(0, partPrefix.size(), partPrefix)!=0 || !ShardedArchive::isShardedArchiveFileName(*itr)) continue;
+
+        std::string partName = path.empty() ? *itr : path + "/" + *itr;
+        if (partName==ShardedArchive::getPartFileName(archiveName, "root")) rootPart = partName;
+        else parts.push_back(partName);
+    }
+
+    if (rootPart.empty() && parts.empty())
+    {
+        log(osg::NOTICE,"No archive parts found to merge into %s",archiveName.c_str());
+        return false;
+    }
+
+    // the root part comes first so that its master file becomes the master file of the merged archive.
+    std::sort(parts.begin(), parts.end());
+    if (!rootPart.empty()) parts.insert(parts.begin(), rootPart);
+
+    log(osg::NOTICE,"Merging %d archive parts into %s",int(parts.size()),archiveName.c_str());
+
+    return ShardedArchive::merge(archiveName, parts);
+}
+
 
 bool TaskManager::writeSource(const std::string& filename)
 {
@@ -1,9 +1,12 @@
 #include <vpb/TextureUtils>
 #include <vpb/BuildLog>
+#include <vpb/Profiler>
 #include <iostream>
 
 void vpb::compress(osg::State& state, osg::Texture& texture, osg::Texture::InternalFormatMode compressedFormat, bool generateMipMap, bool resizeToPowerOfTwo, vpb::BuildOptions::CompressionMethod method, vpb::BuildOptions::CompressionQuality quality)
 {
+    Profiler::ScopedPhase phase("compress");
+
     if(method != vpb::BuildOptions::GL_DRIVER)
     {
         osgDB::ImageProcessor* processor = osgDB::Registry::instance()->getImageProcessor();
@@ -12,6 +12,7 @@
 */
 
 #include <vpb/ThreadPool>
+#include <vpb/Metrics>
 
 using namespace vpb;
 
@@ -105,6 +106,11 @@ void ThreadPool::init()
 
 void ThreadPool::startThreads()
 {
+    if (Metrics::instance()->getEnabled())
+    {
+        Metrics::instance()->set("vpb_thread_pool_threads", _threads.size(), "pool=\""+getName()+"\"");
+    }
+
     //int numProcessors = OpenThreads::GetNumberOfProcessors();
     int processNum = 0;
     _done = false;
@@ -154,6 +160,12 @@ void ThreadPool::run(osg::Operation* op)
     }
     
     _operationQueue->add(op);
+
+    // skip building the labels, and counting the queue, for every operation when no one is collecting them.
+    if (Metrics::instance()->getEnabled())
+    {
+        Metrics::instance()->set("vpb_thread_pool_queue_depth", _operationQueue->getNumOperationsInQueue(), "pool=\""+getName()+"\"");
+    }
 }
 
 unsigned int ThreadPool::getNumOperationsRunning() const
@@ -184,6 +196,11 @@ void ThreadPool::runningOperation(BuildOperation* op)
 {
     OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
     ++_numRunningOperations;
+
+    if (Metrics::instance()->getEnabled())
+    {
+        Metrics::instance()->set("vpb_thread_pool_queue_depth", _operationQueue->getNumOperationsInQueue(), "pool=\""+getName()+"\"");
+    }
 }
 
 void ThreadPool::completedOperation(BuildOperation* op)
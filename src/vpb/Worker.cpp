@@ -0,0 +1,652 @@
+/* -*-c++-*- VirtualPlanetBuilder - Copyright (C) 1998-2007 Robert Osfield
+ *
+ * This library is open source and may be redistributed and/or modified under
+ * the terms of the OpenSceneGraph Public License (OSGPL) version 0.0 or
+ * (at your option) any later version.  The full license is in LICENSE file
+ * included with this distribution, and on the openscenegraph.org website.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * OpenSceneGraph Public License for more details.
+*/
+
+#include <vpb/Worker>
+#include <vpb/Commandline>
+#include <vpb/DataSet>
+#include <vpb/DatabaseBuilder>
+#include <vpb/System>
+#include <vpb/FileUtils>
+#include <vpb/FilePathManager>
+#include <vpb/Profiler>
+#include <vpb/Metrics>
+
+#include <osgDB/ReadFile>
+#include <osgDB/WriteFile>
+#include <osgDB/FileNameUtils>
+#include <osg/Timer>
+
+#include <iostream>
+#include <sstream>
+
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+
+#ifndef WIN32
+    #include <sys/types.h>
+    #include <sys/socket.h>
+    #include <sys/un.h>
+    #include <sys/wait.h>
+    #include <unistd.h>
+#endif
+
+using namespace vpb;
+
+Worker::Worker(const std::string& socketName, unsigned int numProcesses):
+    _socketName(socketName),
+    _numProcesses(numProcesses>0 ? numProcesses : 1)
+{
+}
+
+Worker::~Worker()
+{
+}
+
+void Worker::splitCommandLine(const std::string& commandLine, std::vector<std::string>& arguments)
+{
+    std::string argument;
+    bool inArgument = false;
+    bool inQuotes = false;
+    for(std::string::const_iterator itr = commandLine.begin();
+        itr != commandLine.end();
+        ++itr)
+    {
+        char c = *itr;
+        if (c=='"')
+        {
+            inQuotes = !inQuotes;
+            inArgument = true;
+        }
+        else if ((c==' ' || c=='\t') && !inQuotes)
+        {
+            if (inArgument) arguments.push_back(argument);
+            argument.clear();
+            inArgument = false;
+        }
+        else
+        {
+            argument.push_back(c);
+            inArgument = true;
+        }
+    }
+
+    if (inArgument) arguments.push_back(argument);
+}
+
+int Worker::runApplication(const std::string& application)
+{
+    std::vector<std::string> args;
+    splitCommandLine(application, args);
+
+    // only osgdem builds are run in process, anything else is left for the caller to run.
+    if (args.empty() || osgDB::getStrippedName(args[0])!="osgdem") return -1;
+
+    std::vector<char*> argv;
+    for(std::vector<std::string>::iterator itr = args.begin();
+        itr != args.end();
+        ++itr)
+    {
+        argv.push_back(const_cast<char*>(itr->c_str()));
+    }
+    argv.push_back(0);
+
+    int argc = args.size();
+
+    // tasks change the working directory and notify level, so restore them for the next task.
+    char cwd[2048];
+    bool hasCwd = vpb::getCurrentWorkingDirectory(cwd, sizeof(cwd))!=0;
+    osg::NotifySeverity notifyLevel = osg::getNotifySeverity();
+
+    osg::ArgumentParser arguments(&argc, &argv[0]);
+    int result = runTask(arguments);
+
+    osg::setNotifyLevel(notifyLevel);
+    if (hasCwd) vpb::chdir(cwd);
+
+    return result;
+}
+
+// record a task that stopped before its build could run, so it isn't left marked as still running.
+static int finishTask(vpb::Task* taskFile, vpb::Task::Status status, int result)
+{
+    if (taskFile)
+    {
+        taskFile->setStatus(status);
+        taskFile->write();
+    }
+    return result;
+}
+
+int Worker::runTask(osg::ArgumentParser& arguments)
+{
+    osg::Timer_t startTick = osg::Timer::instance()->tick();
+
+    vpb::Commandline commandline;
+
+    std::string runPath;
+    if (arguments.read("--run-path",runPath))
+    {
+        vpb::chdir(runPath.c_str());
+    }
+
+    // a worker runs many tasks, so only profile those that ask for it.
+    vpb::Profiler::instance()->setEnabled(false);
+    vpb::Profiler::instance()->setTraceFileName(std::string());
+    vpb::Profiler::instance()->clear();
+    vpb::Metrics::instance()->setEnabled(false);
+    vpb::Metrics::instance()->clear();
+
+    // nor carry over what earlier tasks cached, as the files they describe may since have been rewritten.
+    vpb::FilePathManager::instance()->clear();
+    vpb::System::instance()->clearDatasetCache();
+    vpb::System::instance()->setFileCache(0);
+    vpb::System::instance()->getCacheFileName().clear();
+
+    vpb::System::instance()->readArguments(arguments);
+
+    // vpbmaster collects the status of its tasks from the journal rather than from the task files.
+    std::string taskJournalFileName;
+    while (arguments.read("--task-journal",taskJournalFileName)) {}
+
+    std::string taskFileName;
+    osg::ref_ptr<vpb::Task> taskFile;
+    while (arguments.read("--task",taskFileName))
+    {
+        if (!taskFileName.empty())
+        {
+            taskFile = new vpb::Task(taskFileName);
+
+            if (!taskJournalFileName.empty()) taskFile->setJournal(new vpb::TaskJournal(taskJournalFileName));
+
+            taskFile->read();
+
+            taskFile->setStatus(vpb::Task::RUNNING);
+            taskFile->setProperty("pid",vpb::getProcessID());
+            taskFile->write();
+
+        }
+    }
+
+
+    osg::ref_ptr<osgTerrain::TerrainTile> terrain = 0;
+
+
+    //std::cout<<"PID="<<getpid()<<std::endl;
+
+    std::string sourceName;
+    while (arguments.read("-s",sourceName))
+    {
+        std::string fileName = osgDB::findDataFile( sourceName);
+        if (fileName.empty())
+        {
+
+            osg::notify(osg::NOTICE)<<"Error: osgdem running on \""<<vpb::getLocalHostName()<<"\", could not find source file \""<<sourceName<<"\""<<std::endl;
+            char str[2048];
+            if (vpb::getCurrentWorkingDirectory( str, sizeof(str) ))
+            {
+                osg::notify(osg::NOTICE)<<"       current working directory at time of error = "<<str<<std::endl;
+            }
+            osg::setNotifyLevel(osg::DEBUG_INFO);
+
+            osg::notify(osg::NOTICE)<<"       now setting NotifyLevel to DEBUG, and re-running find:"<<std::endl;
+            osg::notify(osg::NOTICE)<<std::endl;
+            fileName = osgDB::findDataFile( sourceName);
+            if (!fileName.empty())
+            {
+                osg::notify(osg::NOTICE)<<std::endl<<"Second attempt at finding source file successful!"<<std::endl<<std::endl;
+            }
+            else
+            {
+                osg::notify(osg::NOTICE)<<std::endl<<"Second attempt at finding source file also failed."<<std::endl<<std::endl;
+            }
+
+            osg::setNotifyLevel(osg::NOTICE);
+
+            return finishTask(taskFile.get(), vpb::Task::FAILED, 1);
+        }
+
+        osg::ref_ptr<osg::Node> node = osgDB::readNodeFile(fileName);
+        if (node.valid())
+        {
+            osgTerrain::TerrainTile* loaded_terrain = dynamic_cast<osgTerrain::TerrainTile*>(node.get());
+            if (loaded_terrain)
+            {
+                terrain = loaded_terrain;
+            }
+            else
+            {
+                osg::notify(osg::NOTICE)<<"Error: source file \""<<sourceName<<"\" not suitable terrain data."<<std::endl;
+                return finishTask(taskFile.get(), vpb::Task::FAILED, 1);
+            }
+        }
+        else
+        {
+            osg::notify(osg::NOTICE)<<"Error: unable to load source file \""<<sourceName<<"\""<<std::endl;
+            osg::notify(osg::NOTICE)<<"       the file was found as \""<<fileName<<"\""<<std::endl;
+            osg::notify(osg::NOTICE)<<"       now setting NotifyLevel to DEBUG, and re-running load:"<<std::endl;
+            osg::notify(osg::NOTICE)<<std::endl;
+
+            osg::setNotifyLevel(osg::DEBUG_INFO);
+
+            osg::ref_ptr<osg::Node> node = osgDB::readNodeFile(fileName);
+            if (node.valid())
+            {
+                osg::notify(osg::NOTICE)<<std::endl;
+                osg::notify(osg::NOTICE)<<"Second attempt to load source file \""<<sourceName<<"\" successful!"<<std::endl<<std::endl;
+            }
+            else
+            {
+                osg::notify(osg::NOTICE)<<std::endl;
+                osg::notify(osg::NOTICE)<<"Second attempt to load source file \""<<sourceName<<"\" also failed."<<std::endl<<std::endl;
+            }
+
+            osg::setNotifyLevel(osg::NOTICE);
+
+            return finishTask(taskFile.get(), vpb::Task::FAILED, 1);
+        }
+    }
+
+    if (!terrain) terrain = new osgTerrain::TerrainTile;
+
+    std::string terrainOutputName;
+    while (arguments.read("--so",terrainOutputName)) {}
+
+    bool report = false;
+    while (arguments.read("--report")) { report = true; }
+
+    int result = commandline.read(std::cout, arguments, terrain.get());
+    if (result) return finishTask(taskFile.get(), vpb::Task::FAILED, result);
+
+
+    // any options left unread are converted into errors to write out later.
+    arguments.reportRemainingOptionsAsUnrecognized();
+
+    // report any errors if they have occured when parsing the program aguments.
+    if (arguments.errors())
+    {
+        arguments.writeErrorMessages(std::cout);
+        return finishTask(taskFile.get(), vpb::Task::FAILED, 1);
+    }
+
+
+    if (!terrainOutputName.empty())
+    {
+        bool written = false;
+        if (terrain.valid())
+        {
+            written = osgDB::writeNodeFile(*terrain, terrainOutputName);
+
+            // make sure the OS writes changes to disk
+            vpb::sync();
+
+        }
+        else
+        {
+            osg::notify(osg::NOTICE)<<"Error: unable to create terrain output \""<<terrainOutputName<<"\""<<std::endl;
+        }
+        return finishTask(taskFile.get(), written ? vpb::Task::COMPLETED : vpb::Task::FAILED, 1);
+    }
+
+    double duration = 0.0;
+
+    // generate the database
+    if (terrain.valid())
+    {
+        try
+        {
+
+            vpb::DatabaseBuilder* db = dynamic_cast<vpb::DatabaseBuilder*>(terrain->getTerrainTechnique());
+            vpb::BuildOptions* bo = db ? db->getBuildOptions() : 0;
+
+            if (bo)
+            {
+                osg::setNotifyLevel(osg::NotifySeverity(bo->getNotifyLevel()));
+
+            }
+            osg::ref_ptr<vpb::DataSet> dataset = new vpb::DataSet;
+
+            if (bo && !(bo->getLogFileName().empty()))
+            {
+                dataset->setBuildLog(new vpb::BuildLog(bo->getLogFileName()));
+            }
+
+            if (taskFile.valid())
+            {
+                dataset->setTask(taskFile.get());
+            }
+
+            dataset->addTerrain(terrain.get());
+
+            // make sure the OS writes changes to disk
+            vpb::sync();
+
+            // check to make sure that the build itself is ready to run and configured correctly.
+            std::string buildProblems = dataset->checkBuildValidity();
+            if (buildProblems.empty())
+            {
+                result = dataset->run();
+
+                if (dataset->getBuildLog() && report)
+                {
+                    dataset->getBuildLog()->report(std::cout);
+                }
+
+                duration = osg::Timer::instance()->delta_s(startTick, osg::Timer::instance()->tick());
+
+                dataset->log(osg::NOTICE,"Elapsed time = %f",duration);
+
+                if (taskFile.valid())
+                {
+                    taskFile->setStatus(vpb::Task::COMPLETED);
+                }
+            }
+            else
+            {
+                dataset->log(osg::NOTICE,"Build configuration invalid : %s",buildProblems.c_str());
+                if (taskFile.valid())
+                {
+                    taskFile->setStatus(vpb::Task::FAILED);
+                }
+            }
+
+        }
+        catch(std::string str)
+        {
+            printf("Caught exception : %s\n",str.c_str());
+
+            if (taskFile.valid())
+            {
+                taskFile->setStatus(vpb::Task::FAILED);
+            }
+
+            result = 1;
+
+        }
+        catch(...)
+        {
+            printf("Caught exception.\n");
+
+            if (taskFile.valid())
+            {
+                taskFile->setStatus(vpb::Task::FAILED);
+            }
+
+            result = 1;
+        }
+
+    }
+
+    if (duration==0) duration = osg::Timer::instance()->delta_s(startTick, osg::Timer::instance()->tick());
+
+    // write out the queued log messages, recording the last in the task file.
+    vpb::LogFile::flushAll();
+
+    if (taskFile.valid())
+    {
+        taskFile->setProperty("duration",duration);
+        taskFile->write();
+    }
+
+    vpb::Profiler::instance()->write();
+    vpb::Metrics::instance()->stop();
+    vpb::LogFile::flushAll();
+
+    // make sure the OS writes changes to disk
+    vpb::sync();
+
+    return result;
+}
+
+#ifdef WIN32
+
+bool Worker::run()
+{
+    log(osg::WARN,"Error: vpbworker requires UNIX domain sockets, which are not available on this platform.");
+    return false;
+}
+
+void Worker::serve(int)
+{
+}
+
+int Worker::execute(const std::string&, const std::string&)
+{
+    return -1;
+}
+
+#else
+
+static volatile sig_atomic_t s_workerStopping = 0;
+
+static void workerSignalHandler(int)
+{
+    s_workerStopping = 1;
+}
+
+static bool setSocketAddress(const std::string& socketName, sockaddr_un& address)
+{
+    if (socketName.size()>=sizeof(address.sun_path)) return false;
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, socketName.c_str(), sizeof(address.sun_path)-1);
+    return true;
+}
+
+static bool writeAll(int fd, const std::string& data)
+{
+    const char* ptr = data.c_str();
+    size_t remaining = data.size();
+    while (remaining>0)
+    {
+        ssize_t written = ::write(fd, ptr, remaining);
+        if (written<0)
+        {
+            if (errno==EINTR) continue;
+            return false;
+        }
+        ptr += written;
+        remaining -= written;
+    }
+    return true;
+}
+
+static bool readLine(int fd, std::string& line)
+{
+    line.clear();
+    char c;
+    while (true)
+    {
+        ssize_t numRead = ::read(fd, &c, 1);
+        if (numRead<0)
+        {
+            if (errno==EINTR) continue;
+            return false;
+        }
+        if (numRead==0) return false;
+        if (c=='\n') return true;
+        line.push_back(c);
+    }
+}
+
+bool Worker::run()
+{
+    sockaddr_un address;
+    if (!setSocketAddress(_socketName, address))
+    {
+        log(osg::WARN,"Error: socket name %s is too long.",_socketName.c_str());
+        return false;
+    }
+
+    int listenSocket = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listenSocket<0)
+    {
+        log(osg::WARN,"Error: unable to create socket, %s",strerror(errno));
+        return false;
+    }
+
+    // remove the socket left behind by a previous worker.
+    ::unlink(_socketName.c_str());
+
+    if (::bind(listenSocket, (sockaddr*)&address, sizeof(address))!=0 || ::listen(listenSocket, SOMAXCONN)!=0)
+    {
+        log(osg::WARN,"Error: unable to listen on socket %s, %s",_socketName.c_str(),strerror(errno));
+        ::close(listenSocket);
+        return false;
+    }
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = workerSignalHandler;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGTERM, &action, 0);
+    sigaction(SIGINT, &action, 0);
+
+    log(osg::NOTICE,"Worker listening on %s with %d processes",_socketName.c_str(),_numProcesses);
+
+    typedef std::vector<pid_t> Processes;
+    Processes processes(_numProcesses, 0);
+
+    while (!s_workerStopping)
+    {
+        // start any processes that aren't running.
+        for(Processes::iterator itr = processes.begin();
+            itr != processes.end();
+            ++itr)
+        {
+            if (*itr!=0) continue;
+
+            pid_t pid = ::fork();
+            if (pid==0)
+            {
+                signal(SIGTERM, SIG_DFL);
+                signal(SIGINT, SIG_DFL);
+                serve(listenSocket);
+                _exit(0);
+            }
+            else if (pid>0)
+            {
+                *itr = pid;
+            }
+            else
+            {
+                log(osg::WARN,"Error: unable to fork worker process, %s",strerror(errno));
+            }
+        }
+
+        int status = 0;
+        pid_t pid = ::wait(&status);
+        if (pid<0)
+        {
+            if (errno==EINTR) continue;
+            break;
+        }
+
+        for(Processes::iterator itr = processes.begin();
+            itr != processes.end();
+            ++itr)
+        {
+            if (*itr==pid)
+            {
+                log(osg::NOTICE,"Worker process %d exited with status %d, restarting it.",int(pid),status);
+                *itr = 0;
+            }
+        }
+    }
+
+    log(osg::NOTICE,"Worker stopping.");
+
+    for(Processes::iterator itr = processes.begin();
+        itr != processes.end();
+        ++itr)
+    {
+        if (*itr!=0) ::kill(*itr, SIGTERM);
+    }
+
+    for(Processes::iterator itr = processes.begin();
+        itr != processes.end();
+        ++itr)
+    {
+        if (*itr!=0) ::waitpid(*itr, 0, 0);
+    }
+
+    ::close(listenSocket);
+    ::unlink(_socketName.c_str());
+
+    return true;
+}
+
+void Worker::serve(int listenSocket)
+{
+    // a vpbmaster that goes away mid task must not take this process with it when the result is written back.
+    signal(SIGPIPE, SIG_IGN);
+
+    while (true)
+    {
+        int connection = ::accept(listenSocket, 0, 0);
+        if (connection<0)
+        {
+            if (errno==EINTR) continue;
+            log(osg::WARN,"Error: worker process %d unable to accept connection, %s",vpb::getProcessID(),strerror(errno));
+            return;
+        }
+
+        std::string application;
+        if (readLine(connection, application))
+        {
+            log(osg::NOTICE,"Worker process %d running %s",vpb::getProcessID(),application.c_str());
+
+            int result = runApplication(application);
+            if (result<0)
+            {
+                // not an osgdem build, so run it as its own process.
+                result = system(application.c_str());
+            }
+
+            std::ostringstream reply;
+            reply<<result<<"\n";
+            writeAll(connection, reply.str());
+        }
+
+        ::close(connection);
+    }
+}
+
+int Worker::execute(const std::string& socketName, const std::string& application)
+{
+    sockaddr_un address;
+    if (!setSocketAddress(socketName, address)) return -1;
+
+    int connection = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (connection<0) return -1;
+
+    if (::connect(connection, (sockaddr*)&address, sizeof(address))!=0)
+    {
+        ::close(connection);
+        return -1;
+    }
+
+    std::string reply;
+    bool success = writeAll(connection, application+"\n") && readLine(connection, reply);
+
+    ::close(connection);
+
+    // the connection closing without a reply means the worker process running the task died.
+    if (!success || reply.empty()) return 1;
+
+    return atoi(reply.c_str());
+}
+
+#endif